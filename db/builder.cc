@@ -34,10 +34,12 @@ Status BuildTable(const std::string& dbname,
 
     TableBuilder* builder = new TableBuilder(options, file);
     meta->smallest.DecodeFrom(iter->key());
+    meta->has_vlog_refs = true;
     for (; iter->Valid(); iter->Next()) {
       Slice key = iter->key();
       meta->largest.DecodeFrom(key);
       builder->Add(key, iter->value());
+      AddVlogRef(key, iter->value(), &meta->vlog_refs);
     }
 
     // Finish and check for builder errors
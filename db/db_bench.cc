@@ -34,6 +34,8 @@
 //      readhot       -- read N times in random order from 1% section of DB
 //      seekrandom    -- N random seeks
 //      open          -- cost of opening a DB
+//      openreplay    -- write N values without flushing, then time the reopen
+//                       that replays them from the vlogs
 //      crc32c        -- repeated crc32c of 4K of data
 //      acquireload   -- load N*1000 times
 //   Meta operations:
@@ -111,6 +113,16 @@ static bool FLAGS_use_existing_db = false;
 // If true, reuse existing log/MANIFEST files when re-opening a database.
 static bool FLAGS_reuse_logs = false;
 
+// Number of threads that read and checksum vlogs while replaying them
+// on open.
+static int FLAGS_vlog_replay_threads = 0;
+
+// Bound on the vlog bytes replayed on open; 0 means no bound.
+static uint64_t FLAGS_max_recovery_bytes = 0;
+
+// Bytes of key-to-pointer cache for hot keys; 0 disables it.
+static int FLAGS_ptr_cache_size = 0;
+
 // Use the db with the following name.
 static const char* FLAGS_db = NULL;
 
@@ -461,6 +473,10 @@ class Benchmark {
         method = &Benchmark::OpenBench;
         num_ /= 10000;
         if (num_ < 1) num_ = 1;
+      } else if (name == Slice("openreplay")) {
+        fresh_db = true;
+        num_threads = 1;
+        method = &Benchmark::OpenReplay;
       } else if (name == Slice("fillseq")) {
         fresh_db = true;
         method = &Benchmark::WriteSeq;
@@ -718,6 +734,9 @@ class Benchmark {
     options.max_open_files = FLAGS_open_files;
     options.filter_policy = filter_policy_;
     options.reuse_logs = FLAGS_reuse_logs;
+    options.vlog_replay_threads = FLAGS_vlog_replay_threads;
+    options.max_recovery_bytes = FLAGS_max_recovery_bytes;
+    options.ptr_cache_size = FLAGS_ptr_cache_size;
     Status s = DB::Open(options, FLAGS_db, &db_);
     if (!s.ok()) {
       fprintf(stderr, "open error: %s\n", s.ToString().c_str());
@@ -733,6 +752,36 @@ class Benchmark {
     }
   }
 
+  void OpenReplay(ThreadState* thread) {
+    // Keep everything in the memtable so that the reopen has to replay
+    // all of it from the vlogs.
+    delete db_;
+    db_ = NULL;
+    const int saved_write_buffer_size = FLAGS_write_buffer_size;
+    FLAGS_write_buffer_size = 1 << 30;
+    Open();
+    FLAGS_write_buffer_size = saved_write_buffer_size;
+    RandomGenerator gen;
+    int64_t bytes = 0;
+    for (int i = 0; i < num_; i++) {
+      char key[100];
+      snprintf(key, sizeof(key), "%016d", i);
+      Status s = db_->Put(write_options_, key, gen.Generate(value_size_));
+      if (!s.ok()) {
+        fprintf(stderr, "put error: %s\n", s.ToString().c_str());
+        exit(1);
+      }
+      bytes += value_size_ + strlen(key);
+    }
+    delete db_;
+    db_ = NULL;
+
+    thread->stats.Start();
+    Open();
+    thread->stats.FinishedSingleOp();
+    thread->stats.AddBytes(bytes);
+  }
+
   void WriteSeq(ThreadState* thread) {
     DoWrite(thread, true);
   }
@@ -958,11 +1007,13 @@ int main(int argc, char** argv) {
   FLAGS_max_file_size = leveldb::Options().max_file_size;
   FLAGS_block_size = leveldb::Options().block_size;
   FLAGS_open_files = leveldb::Options().max_open_files;
+  FLAGS_vlog_replay_threads = leveldb::Options().vlog_replay_threads;
   std::string default_db_path;
 
   for (int i = 1; i < argc; i++) {
     double d;
     int n;
+    unsigned long long ull;
     char junk;
     if (leveldb::Slice(argv[i]).starts_with("--benchmarks=")) {
       FLAGS_benchmarks = argv[i] + strlen("--benchmarks=");
@@ -997,6 +1048,12 @@ int main(int argc, char** argv) {
       FLAGS_bloom_bits = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
       FLAGS_open_files = n;
+    } else if (sscanf(argv[i], "--vlog_replay_threads=%d%c", &n, &junk) == 1) {
+      FLAGS_vlog_replay_threads = n;
+    } else if (sscanf(argv[i], "--max_recovery_bytes=%llu%c", &ull, &junk) == 1) {
+      FLAGS_max_recovery_bytes = ull;
+    } else if (sscanf(argv[i], "--ptr_cache_size=%d%c", &n, &junk) == 1) {
+      FLAGS_ptr_cache_size = n;
     } else if (strncmp(argv[i], "--db=", 5) == 0) {
       FLAGS_db = argv[i] + 5;
     } else {
@@ -35,6 +35,9 @@
 #include "util/logging.h"
 #include "util/mutexlock.h"
 #include "db/garbage_collector.h"
+#include "db/garbage_sampler.h"
+#include "db/vlog_cache.h"
+#include "db/vlog_replayer.h"
 
 namespace leveldb {
 
@@ -46,9 +49,10 @@ struct DBImpl::Writer {
   WriteBatch* batch;
   bool sync;
   bool done;
+  bool relocation;  // GC pointer updates; never merged into a group
   port::CondVar cv;
 
-  explicit Writer(port::Mutex* mu) : cv(mu) { }
+  explicit Writer(port::Mutex* mu) : relocation(false), cv(mu) { }
 };
 
 struct DBImpl::CompactionState {
@@ -65,6 +69,7 @@ struct DBImpl::CompactionState {
     uint64_t number;
     uint64_t file_size;
     InternalKey smallest, largest;
+    std::map<uint64_t, uint64_t> vlog_refs;
   };
   std::vector<Output> outputs;
 
@@ -74,6 +79,32 @@ struct DBImpl::CompactionState {
 
   uint64_t total_bytes;
 
+  // Vlog extents of the values dropped by this compaction.  They are
+  // handed to the vlog manager once the compaction is installed.
+  struct DeadExtent {
+    uint64_t vlog_numb;
+    uint64_t pos;
+    uint64_t size;
+  };
+  std::vector<DeadExtent> dead_extents;
+
+  void AddDeadExtent(uint64_t vlog_numb, uint64_t pos, uint64_t size) {
+    DeadExtent e;
+    e.vlog_numb = vlog_numb;
+    e.pos = pos;
+    e.size = size;
+    dead_extents.push_back(e);
+  }
+
+  // Values relocated by this compaction, applied to the key index and the
+  // pointer cache once the outputs pointing at the new copies are installed.
+  struct Relocation {
+    std::string key;
+    std::string old_ptr;
+    std::string new_ptr;
+  };
+  std::vector<Relocation> relocations;
+
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
   explicit CompactionState(Compaction* c)
@@ -101,6 +132,10 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
   ClipToRange(&result.max_file_size,     1<<20,                       1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
+  ClipToRange(&result.max_open_vlogs,    1,                           50000);
+  if (result.ttl_vlog_window == 0) {
+    result.ttl_vlog_window = 1;  // Used as a divisor
+  }
   if (result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -131,36 +166,59 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       bg_cv_(&mutex_),
       mem_(NULL),
       imm_(NULL),
+      read_view_(NULL),
+      ptr_cache_(options_.ptr_cache_size > 0 ?
+                 new PtrCache(options_.ptr_cache_size) : NULL),
       logfile_number_(0),
       vlog_(NULL),
       vlogfile_(NULL),
       vlog_head_(0),
-      check_point_(0),
-      next_check_point_(0),
+      vlog_allocated_(0),
+      mem_vlog_bytes_(0),
+      imm_head_number_(0),
+      imm_head_pos_(0),
+      cold_vlog_number_(0),
+      cold_vlog_(NULL),
+      cold_vlogfile_(NULL),
+      cold_vlog_size_(0),
       drop_count_(0),
       vlog_manager_(options_.clean_threshold),
-      vloginfo_file_number_(0),
-      vloginfo_pos_(0),
+      key_index_(options_.key_index_partitions > 0 ?
+                 new VlogKeyIndex(options_.key_index_partitions) : NULL),
+      garbage_sample_pending_(false),
+      legacy_checkpoint_(false),
+      migrate_check_pending_(false),
+      next_cold_path_(0),
       seed_(0),
       tmp_batch_(new WriteBatch),
       bg_compaction_scheduled_(false),
+      bg_flush_scheduled_(false),
+      installing_(false),
       bg_clean_scheduled_(false),
       manual_compaction_(NULL) {
-  has_imm_.Release_Store(NULL);
+  manual_clean_cancel_.Release_Store(NULL);
   // Reserve ten files or so for other uses and give the rest to TableCache.
   const int table_cache_size = options_.max_open_files - kNumNonTableCacheFiles;
   table_cache_ = new TableCache(dbname_, &options_, table_cache_size);
   versions_ = new VersionSet(dbname_, &options_, table_cache_,
                              &internal_comparator_);
+  vlog_cache_ = new VlogCache(env_, options_.max_open_vlogs);
 }
 
 DBImpl::~DBImpl() {
   // Wait for background work to finish
   mutex_.Lock();
   shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-  while (bg_compaction_scheduled_ || bg_clean_scheduled_) {//还得等clean线程退出
+  bg_cv_.SignalAll();  // Wake up writers waiting for a memtable compaction
+  while (bg_compaction_scheduled_ || bg_flush_scheduled_ ||
+         bg_clean_scheduled_) {//还得等clean线程退出
     bg_cv_.Wait();
   }
+  ScrapeReadViews();
+  if (read_view_ != NULL) {
+    read_view_->Unref();
+    read_view_ = NULL;
+  }
   mutex_.Unlock();
 
   if (db_lock_ != NULL) {
@@ -173,7 +231,17 @@ DBImpl::~DBImpl() {
   delete tmp_batch_;
   delete vlog_;
   delete vlogfile_;
+  delete cold_vlog_;
+  delete cold_vlogfile_;
+  for (std::map<uint64_t, TtlVlog>::iterator iter = ttl_vlogs_.begin();
+       iter != ttl_vlogs_.end(); ++iter) {
+    delete iter->second.writer;
+    delete iter->second.file;
+  }
+  delete key_index_;
   delete table_cache_;
+  delete vlog_cache_;
+  delete ptr_cache_;
 
   if (owns_info_log_) {
     delete options_.info_log;
@@ -224,6 +292,9 @@ void DBImpl::MaybeIgnoreError(Status* s) const {
   }
 }
 
+// Expired TTL vlogs are deleted this long after their expiration.
+static const uint64_t kTtlVlogGraceSeconds = 60;
+
 void DBImpl::DeleteObsoleteFiles() {
   if (!bg_error_.ok()) {
     // After a background error, we don't know whether a new version may
@@ -235,10 +306,40 @@ void DBImpl::DeleteObsoleteFiles() {
   std::set<uint64_t> live = pending_outputs_;
   versions_->AddLiveFiles(&live);
 
+  // A sealed vlog that no live table, memtable or running compaction
+  // points into holds only garbage and can go without a GC pass.  GC
+  // rewrites pointers behind our back, so leave vlogs alone while it runs.
+  std::set<uint64_t> live_vlogs;
+  const bool delete_vlogs =
+      !bg_clean_scheduled_ && versions_->AddLiveVlogs(&live_vlogs);
+  live_vlogs.insert(mem_cold_vlogs_.begin(), mem_cold_vlogs_.end());
+  live_vlogs.insert(imm_cold_vlogs_.begin(), imm_cold_vlogs_.end());
+  live_vlogs.insert(compaction_cold_vlogs_.begin(),
+                    compaction_cold_vlogs_.end());
+  live_vlogs.insert(logfile_number_);
+  live_vlogs.insert(cold_vlog_number_);
+  // Values GC forwarded out of a live vlog keep their new home alive
+  vlog_manager_.AddForwardTargets(&live_vlogs, versions_->LogNumber());
+  const uint64_t now_seconds = NowSeconds();
+
   std::vector<std::string> filenames;
   env_->GetChildren(dbname_, &filenames); // Ignoring errors on purpose
+  std::vector<std::string> dirs(filenames.size(), dbname_);
   uint64_t number;
   FileType type;
+  // Migrated vlogs and their unfinished copies live in the cold paths
+  for (size_t p = 0; p < options_.vlog_cold_paths.size(); p++) {
+    const std::string& dir = options_.vlog_cold_paths[p];
+    std::vector<std::string> cold_files;
+    env_->GetChildren(dir, &cold_files);
+    for (size_t i = 0; i < cold_files.size(); i++) {
+      if (ParseFileName(cold_files[i], &number, &type) &&
+          (type == kVLogFile || type == kTempFile)) {
+        filenames.push_back(cold_files[i]);
+        dirs.push_back(dir);
+      }
+    }
+  }
   for (size_t i = 0; i < filenames.size(); i++) {
     if (ParseFileName(filenames[i], &number, &type)) {
       bool keep = true;
@@ -263,24 +364,90 @@ void DBImpl::DeleteObsoleteFiles() {
         case kCurrentFile:
         case kDBLockFile:
         case kInfoLogFile:
-        case kVLogFile:
           keep = true;
           break;
+        case kVLogFile:
+          if (vlog_manager_.GetExpiration(number) != 0) {
+            // A TTL vlog is never replayed and goes only once everything
+            // in it has expired.  Readers check the expiration before
+            // reading, the grace period covers the rest of their read.
+            keep = (!delete_vlogs ||
+                    open_ttl_vlogs_.count(number) > 0 ||
+                    vlog_manager_.GetExpiration(number) + kTtlVlogGraceSeconds >
+                        now_seconds);
+            break;
+          }
+          // Vlogs at or after the log number are still replayed at recovery
+          keep = (!delete_vlogs ||
+                  number >= versions_->LogNumber() ||
+                  live_vlogs.find(number) != live_vlogs.end());
+          break;
+        case kVFwdFile:
+          // Needed as long as some pointer still names the forwarded vlog
+          keep = (!delete_vlogs ||
+                  number >= versions_->LogNumber() ||
+                  live_vlogs.find(number) != live_vlogs.end());
+          break;
+        case kVFreeFile:
+          keep = (std::find(free_vlogs_.begin(), free_vlogs_.end(), number) !=
+                  free_vlogs_.end());
+          break;
       }
 
       if (!keep) {
         if (type == kTableFile) {
           table_cache_->Evict(number);
+          scan_samples_.erase(number);
+        } else if (type == kVLogFile) {
+          vlog_manager_.RemoveVlog(number);
+        } else if (type == kVFwdFile) {
+          vlog_manager_.RemoveForwards(number);
         }
         Log(options_.info_log, "Delete type=%d #%lld\n",
             int(type),
             static_cast<unsigned long long>(number));
-        env_->DeleteFile(dbname_ + "/" + filenames[i]);
+        if (type == kVLogFile) {
+          RecycleVlogFile(number, dirs[i] + "/" + filenames[i]);
+        } else {
+          env_->DeleteFile(dirs[i] + "/" + filenames[i]);
+        }
       }
     }
   }
 }
 
+// Cold vlogs written by GC begin with an empty batch whose sequence
+// number is zero.  User writes always carry a real sequence number, so
+// such a vlog holds nothing that has to be replayed at recovery.  TTL
+// vlogs are cold vlogs whose marker is followed by the fixed64 time at
+// which everything in them has expired, stored in *expiration (0 for
+// plain cold vlogs).
+static const int kColdMarkerSize = 12;
+
+static bool IsColdVlog(Env* env, const std::string& fname,
+                       uint64_t* expiration) {
+  *expiration = 0;
+  SequentialFile* file;
+  if (!env->NewSequentialFile(fname, &file).ok()) {
+    return false;
+  }
+  log::VReader reader(file, true, 0);
+  Slice record;
+  std::string scratch;
+  int head_size = 0;
+  if (!reader.ReadRecord(&record, &scratch, head_size) ||
+      record.size() < kColdMarkerSize ||
+      DecodeFixed64(record.data()) != 0) {
+    return false;
+  }
+  if (record.size() == kColdMarkerSize + 8 &&
+      DecodeFixed32(record.data() + 8) == 0) {
+    *expiration = DecodeFixed64(record.data() + kColdMarkerSize);
+    return true;
+  }
+  return record.size() == kColdMarkerSize;
+}
+
 Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   mutex_.AssertHeld();
 
@@ -288,6 +455,9 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   // committedeck_pointonly when the descriptor is created, and this directory
   // may already exist from a previous failed creation attempt.
   env_->CreateDir(dbname_);
+  for (size_t p = 0; p < options_.vlog_cold_paths.size(); p++) {
+    env_->CreateDir(options_.vlog_cold_paths[p]);
+  }
   assert(db_lock_ == NULL);
   Status s = env_->LockFile(LockFileName(dbname_), &db_lock_);
   if (!s.ok()) {
@@ -326,67 +496,149 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
   uint64_t number;
   FileType type;
   std::vector<uint64_t> logs;
+  std::vector<uint64_t> forward_files;
+  std::vector<uint64_t> free_files;
+  std::map<uint64_t, int> vlogs;//vlog编号->所在目录，见VlogManager::VlogInfo::path_
   for (size_t i = 0; i < filenames.size(); i++) {
     if (ParseFileName(filenames[i], &number, &type)) {
       expected.erase(number);
       if (type == kVLogFile)
-      {
-          if(number >= min_log)
-             logs.push_back(number);
-          std::string vlog_name = VLogFileName(dbname_, number);
-          SequentialFile* vlr_file;
-          s = options_.env->NewSequentialFile(vlog_name, &vlr_file);
-          log::VReader* vlog_reader = new log::VReader(vlr_file, true,0);
-          vlog_manager_.AddVlog(number, vlog_reader);
+          vlogs[number] = 0;
+      else if (type == kVFwdFile)
+          forward_files.push_back(number);
+      else if (type == kVFreeFile)
+          free_files.push_back(number);
+    }
+  }
+  //调小了recycle_vlog_num的话，多出来的文件删掉
+  std::sort(free_files.begin(), free_files.end());
+  for (size_t i = 0; i < free_files.size(); i++) {
+    if (free_vlogs_.size() < static_cast<size_t>(options_.recycle_vlog_num))
+      free_vlogs_.push_back(free_files[i]);
+    else
+      env_->DeleteFile(VFreeFileName(dbname_, free_files[i]));
+  }
+  //manifest里记着搬迁完成的vlog在哪个冷目录，两边都有文件时以它为准
+  const std::map<uint64_t, int>& vlog_paths = versions_->VlogPaths();
+  for (size_t p = 0; p < options_.vlog_cold_paths.size(); p++) {
+    const std::string& dir = options_.vlog_cold_paths[p];
+    const int path = static_cast<int>(p + 1);
+    std::vector<std::string> cold_files;
+    env_->GetChildren(dir, &cold_files);
+    for (size_t i = 0; i < cold_files.size(); i++) {
+      if (!ParseFileName(cold_files[i], &number, &type) || type != kVLogFile)
+        continue;
+      std::map<uint64_t, int>::const_iterator recorded = vlog_paths.find(number);
+      const bool moved = recorded != vlog_paths.end() && recorded->second == path;
+      std::map<uint64_t, int>::iterator found = vlogs.find(number);
+      if (found == vlogs.end()) {
+        vlogs[number] = path;
+      } else if (moved && found->second == 0) {
+        //搬迁记进manifest之后、删原文件之前崩溃了，原文件不要了
+        env_->DeleteFile(VLogFileName(dbname_, number));
+        found->second = path;
+      } else {
+        //搬迁还没记进manifest就崩溃了，拷贝不要了
+        env_->DeleteFile(VLogFileName(dir, number));
+        continue;
+      }
+      if (!moved) {
+        edit->SetVlogPath(number, path);
+        *save_manifest = true;
       }
     }
   }
+  for (std::map<uint64_t, int>::const_iterator iter = vlog_paths.begin();
+       iter != vlog_paths.end(); ++iter) {
+    std::map<uint64_t, int>::const_iterator found = vlogs.find(iter->first);
+    if (found == vlogs.end() || found->second == 0) {
+      edit->SetVlogPath(iter->first, 0);//vlog已经删掉了，或者只剩原文件
+      *save_manifest = true;
+    }
+  }
+  for (std::map<uint64_t, int>::iterator iter = vlogs.begin(); iter != vlogs.end(); ++iter)
+  {
+      number = iter->first;
+      const int path = iter->second;
+      std::string vlog_name = VLogFileName(
+          path == 0 ? dbname_ : options_.vlog_cold_paths[path - 1], number);
+      uint64_t expiration = 0;
+      if(number >= min_log && !IsColdVlog(env_, vlog_name, &expiration))
+         logs.push_back(number);
+      versions_->MarkVlogNumberUsed(number);
+      vlog_manager_.AddVlog(number, true, path);//第一次读的时候才打开
+      if(expiration != 0)
+         vlog_manager_.SetExpiration(number, expiration);
+  }
   if (!expected.empty()) {
     char buf[50];
     snprintf(buf, sizeof(buf), "%d missing files; e.g.",
              static_cast<int>(expected.size()));
     return Status::Corruption(buf, TableFileName(dbname_, *(expected.begin())));
   }
-    ReadOptions options;
-    std::string val;
-    SequenceNumber snapshot;
-    snapshot = versions_->LastSequence();
-    Version* current = versions_->current();
-    current->Ref();
-    LookupKey lkey(Slice("head"), snapshot);
-    Version::GetStats stats;
-    s = current->Get(options, lkey, &val, &stats);
+  s = RecoverForwards(forward_files);
+  if (!s.ok()) {
+    return s;
+  }
     std::sort(logs.begin(), logs.end());
-    if(s.ok()&&!logs.empty())
+    uint64_t head_number = versions_->VlogHeadNumber();
+    uint64_t head_pos = versions_->VlogHeadPos();
+    if(head_number == 0)
+    {//manifest里没有重启点，老版本的数据库把它存在sst里的"head"，值是(pos<<24)|vlog编号
+        ReadOptions options;
+        std::string val;
+        LookupKey lkey(Slice("head"), versions_->LastSequence());
+        Version::GetStats stats;
+        Version* current = versions_->current();
+        current->Ref();
+        Status hs = current->Get(options, lkey, &val, &stats);
+        current->Unref();
+        if(hs.ok() && val.size() == 8)
+        {
+            uint64_t code = DecodeFixed64(val.data());
+            head_number = code & 0xffffff;
+            head_pos = code >> 24;
+            edit->SetVlogHead(head_number, head_pos);
+            *save_manifest = true;
+            legacy_checkpoint_ = true;
+        }
+    }
+    if(head_number != 0 && !logs.empty())
     {
-        uint64_t code = DecodeFixed64(val.data());
-        uint64_t vlog_numb = code & 0xffffff;
+        uint64_t vlog_numb = head_number;
         if(vlog_numb == logs[0])
         {
-            vlog_head_ = code>>24;
+            vlog_head_ = head_pos;
         }
         else
-        {
-//上次刚好生成新的log文件，记录的head是上一个log文件的末尾，并且成功应用到了version
+        {//最后一个vlog里没有要回放的记录时打开数据库只推进了log number，或者是老版本写的manifest
             vlog_head_ = 0;
             assert(vlog_numb < logs[0]);
-            assert(logs.size() == 1);
         }
-        check_point_ = vlog_head_;//check_point代表已经被刷进sst文件的最新重启点的位置
     }
     else
     {
         vlog_head_ =0;
-        check_point_=0;
     }
-    current->Unref();
-    s = Status::OK();
+   //后台线程并行读取并校验各个vlog，这里按顺序插入memtable
+   std::vector<std::string> fnames;
+   for (size_t i = 0; i < logs.size(); i++) {
+        fnames.push_back(VLogFileName(dbname_, logs[i]));
+   }
+   VlogReplayer replayer(env_, options_.info_log, options_.paranoid_checks,
+                         options_.vlog_readahead_size,
+                         options_.vlog_replay_threads);
+   replayer.Start(fnames, vlog_head_);
+   MemTable* mem = NULL;//重启点之后的记录可能跨好几个vlog，共用一个memtable回放
    for (size_t i = 0; i < logs.size(); i++) {
-        s = RecoverLogFile(logs[i], (i == logs.size() - 1), save_manifest, edit,
-                &max_sequence);
+        s = RecoverLogFile(&replayer, i, logs[i], (i == logs.size() - 1),
+                save_manifest, edit, &max_sequence, &mem);
         if(!s.ok())
+        {
+            if(mem != NULL)
+                mem->Unref();
             return s;
-        versions_->MarkVlogNumberUsed(logs[i]);
+        }
     }
 
     if(versions_->LastSequence() < max_sequence) {
@@ -395,9 +647,185 @@ Status DBImpl::Recover(VersionEdit* edit, bool *save_manifest) {
     return Status::OK();
 }
 
-Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
+Status DBImpl::MigrateLegacyCheckpoint()
+{
+  mutex_.AssertHeld();
+  //Get要用read view，后台线程还没启动，下面的写入刷imm时会自己调度
+  InstallReadView();
+  mutex_.Unlock();
+  ReadOptions read_options;
+  std::string tail, vloginfo;
+  Status s = Get(read_options, "tail", &tail);
+  bool has_tail = s.ok() && tail.size() == 8;
+  if (s.ok() || s.IsNotFound()) {
+    s = Get(read_options, "vloginfo", &vloginfo);
+  }
+  bool has_vloginfo = s.ok();
+  if (s.ok() || s.IsNotFound()) {
+    //先删key再写manifest：中间崩溃的话head还能从sst里再读一次，
+    //tail和vloginfo丢了只是gc从头扫和重新抽样估计垃圾数
+    WriteBatch batch;
+    batch.Delete("head");
+    batch.Delete("tail");
+    batch.Delete("vloginfo");
+    WriteOptions write_options;
+    write_options.sync = true;
+    s = Write(write_options, &batch);
+  }
+  mutex_.Lock();
+  if (s.ok() && (has_tail || has_vloginfo)) {
+    VersionEdit edit;
+    if (has_tail) {
+      uint64_t code = DecodeFixed64(tail.data());
+      edit.SetCleanTail(code & 0xffffff, code >> 24);
+    }
+    if (has_vloginfo) {
+      edit.SetVlogInfo(vloginfo);
+    }
+    s = ApplyEdit(&edit);
+  }
+  if (s.ok()) {
+    legacy_checkpoint_ = false;
+    Log(options_.info_log, "Migrated legacy checkpoint keys into the MANIFEST");
+  }
+  return s;
+}
+
+Status DBImpl::BuildKeyIndex()
+{
+  mutex_.AssertHeld();
+  if (key_index_ == NULL) {
+    return Status::OK();
+  }
+  const uint64_t start_micros = env_->NowMicros();
+  // Nothing runs in the background yet, the lock is only needed by
+  // NewInternalIterator.
+  mutex_.Unlock();
+  ReadOptions options;
+  options.fill_cache = false;
+  SequenceNumber ignored;
+  uint32_t ignored_seed;
+  Iterator* iter = NewInternalIterator(options, &ignored, &ignored_seed);
+  std::string current_user_key;
+  bool has_current_user_key = false;
+  ParsedInternalKey ikey;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    if (!ParseInternalKey(iter->key(), &ikey)) {
+      continue;
+    }
+    if (has_current_user_key &&
+        user_comparator()->Compare(ikey.user_key, current_user_key) == 0) {
+      continue;  // Older version, the newest one came first
+    }
+    current_user_key.assign(ikey.user_key.data(), ikey.user_key.size());
+    has_current_user_key = true;
+    if (ikey.type == kTypeValue) {
+      key_index_->Put(ikey.user_key, iter->value());
+    }
+  }
+  Status s = iter->status();
+  delete iter;
+  mutex_.Lock();
+  Log(options_.info_log, "Built key index of %llu keys in %llu micros: %s",
+      static_cast<unsigned long long>(key_index_->NumKeys()),
+      static_cast<unsigned long long>(env_->NowMicros() - start_micros),
+      s.ToString().c_str());
+  return s;
+}
+
+Status DBImpl::RecoverForwards(const std::vector<uint64_t>& numbers)
+{
+  struct ForwardReporter : public log::Reader::Reporter {
+    bool corrupted;
+    virtual void Corruption(size_t bytes, const Status& s) {
+      corrupted = true;
+    }
+  };
+  mutex_.AssertHeld();
+  Status s;
+  for (size_t i = 0; i < numbers.size() && s.ok(); i++) {
+    const uint64_t number = numbers[i];
+    std::string fname = VFwdFileName(dbname_, number);
+    SequentialFile* file;
+    s = env_->NewSequentialFile(fname, &file);
+    if (!s.ok()) {
+      break;
+    }
+    ForwardReporter reporter;
+    reporter.corrupted = false;
+    std::vector<VlogManager::Forward> forwards;
+    bool rewrite = false;
+    {
+      log::Reader reader(file, &reporter, true/*checksum*/, 0/*initial_offset*/);
+      Slice record;
+      std::string scratch;
+      while (reader.ReadRecord(&record, &scratch)) {
+        if (!VlogManager::DecodeForwards(record, &forwards)) {
+          rewrite = true;
+          break;
+        }
+      }
+    }
+    delete file;
+    rewrite = rewrite || reporter.corrupted;
+    if (env_->FileExists(VLogFilePath(number))) {
+      // GC of this vlog did not finish.  Only forwards before the clean
+      // tail were synced ahead of it, the rest is redone when GC resumes.
+      const uint64_t limit = (versions_->CleanTailNumber() == number ?
+                              versions_->CleanTailPos() : 0);
+      size_t kept = 0;
+      for (size_t j = 0; j < forwards.size(); j++) {
+        if (forwards[j].old_pos_ < limit) {
+          forwards[kept++] = forwards[j];
+        }
+      }
+      if (kept < forwards.size()) {
+        forwards.resize(kept);
+        rewrite = true;
+      }
+    }
+    for (size_t j = 0; j < forwards.size(); j++) {
+      vlog_manager_.AddForward(number, forwards[j]);
+    }
+    if (!rewrite) {
+      continue;
+    }
+    // GC appends to the file later, so drop the stale tail on disk too
+    Log(options_.info_log, "Rewriting forward file #%llu with %d entries",
+        (unsigned long long) number, static_cast<int>(forwards.size()));
+    if (forwards.empty()) {
+      s = env_->DeleteFile(fname);
+      continue;
+    }
+    std::string tmp = TempFileName(dbname_, versions_->NewFileNumber());
+    WritableFile* tmp_file;
+    s = env_->NewWritableFile(tmp, &tmp_file);
+    if (s.ok()) {
+      log::Writer writer(tmp_file);
+      std::string record;
+      VlogManager::EncodeForwards(forwards, &record);
+      s = writer.AddRecord(record);
+      if (s.ok()) {
+        s = tmp_file->Sync();
+      }
+      if (s.ok()) {
+        s = tmp_file->Close();
+      }
+      delete tmp_file;
+    }
+    if (s.ok()) {
+      s = env_->RenameFile(tmp, fname);
+    } else {
+      env_->DeleteFile(tmp);
+    }
+  }
+  return s;
+}
+
+Status DBImpl::RecoverLogFile(VlogReplayer* replayer, size_t index,
+                              uint64_t log_number, bool last_log,
                               bool* save_manifest, VersionEdit* edit,
-                              SequenceNumber* max_sequence) {
+                              SequenceNumber* max_sequence, MemTable** memptr) {
   struct LogReporter : public log::VReader::Reporter {
     Env* env;
     Logger* info_log;
@@ -413,44 +841,41 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
 
   mutex_.AssertHeld();
 
-  // Open the log file
   std::string fname = VLogFileName(dbname_, log_number);
-  SequentialFile* file;
-  Status status = env_->NewSequentialFile(fname, &file);
-  if (!status.ok()) {
-    MaybeIgnoreError(&status);
-    return status;
-  }
-
-  // Create the log reader.
+  Status status;
   LogReporter reporter;
   reporter.env = env_;
   reporter.info_log = options_.info_log;
   reporter.fname = fname.c_str();
   reporter.status = (options_.paranoid_checks ? &status : NULL);
-  // We intentionally make log::Reader do checksumming even if
-  // paranoid_checks==false so that corruptions cause entire commits
-  // to be skipped instead of propagating bad information (like overly
-  // large sequence numbers).
-  log::VReader reader(file, &reporter, true/*checksum*/,
-                     0/*initial_offset*/);//reader析构时会delete掉file
-  if(vlog_head_ > 0)
-  {
-      if(!reader.SkipToPos(vlog_head_))
-        return Status::Corruption("reader skip false");
-  }
   Log(options_.info_log, "Recovering log #%llu",
       (unsigned long long) log_number);
 
-  // Read all the records and add to a memtable
-  std::string scratch;
-  Slice record;
+  // Read all the records and add to a memtable.  The replayer has
+  // already checksummed them; we intentionally do so even if
+  // paranoid_checks==false so that corruptions cause entire commits
+  // to be skipped instead of propagating bad information (like overly
+  // large sequence numbers).
   WriteBatch batch;
   int compactions = 0;
-  MemTable* mem = NULL;
-  int head_size = 0;
-  while (reader.ReadRecord(&record, &scratch, head_size) &&
-         status.ok()) {
+  MemTable* mem = *memptr;
+  VlogReplayer::Chunk* chunk = NULL;
+  size_t next_record = 0;
+  while (status.ok()) {
+    if (chunk == NULL || next_record == chunk->records.size()) {
+      delete chunk;
+      chunk = replayer->Next(index);
+      next_record = 0;
+      if (chunk == NULL) {
+        break;
+      }
+    }
+    const size_t record_start =
+        (next_record == 0 ? 0 : chunk->records[next_record - 1].first);
+    const size_t record_end = chunk->records[next_record].first;
+    const int head_size = chunk->records[next_record].second;
+    next_record++;
+    Slice record(chunk->data.data() + record_start, record_end - record_start);
     if (record.size() < 12) {
       reporter.Corruption(
           record.size(), Status::Corruption("log record too small"));
@@ -463,7 +888,7 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
       mem->Ref();
     }
     vlog_head_+= head_size;
-    status = WriteBatchInternal::InsertInto(&batch, mem, vlog_head_, log_number);
+    status = WriteBatchInternal::InsertInto(&batch, mem, vlog_head_, log_number, NULL);
     MaybeIgnoreError(&status);
     if (!status.ok()) {
       break;
@@ -488,43 +913,60 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
       }
     }
   }
+  bool clean_end = false;
+  if (chunk == NULL) {//读完整个vlog才取读取结果，中途出错时后台线程由replayer析构叫停
+    Status read = replayer->Finish(index, &clean_end);
+    MaybeIgnoreError(&read);
+    if (status.ok()) {
+      status = read;
+    }
+  }
+  delete chunk;
 
-  if(!last_log)//vlog文件很大，一般恢复时最多同时跨两个vlog文件，第一个恢复完后，
-  {//第二个vlog需要从文件头开始恢复
+  if(!last_log)//下一个vlog从文件头开始回放，没刷到sst的kv留在mem里接着用
+  {
       vlog_head_ = 0;
-      if (mem != NULL) {
-    //因为上面的while循环可能剩余的kv对不够刷mem，因为马上要回放下一个vlog了，需要把上一个vlog
-    //剩余的kv刷入sst
-      if (status.ok()) {
-        *save_manifest = true;
-        status = WriteLevel0Table(mem, edit, NULL);
-        }
-        mem->Unref();
-    }
+      *memptr = mem;
   }
   else
   {//回放的是最后一个vlog文件
+      *memptr = NULL;
+      if (status.ok() && !clean_end) {
+        //回放停在crc不对或者不完整的记录上，后面的字节留着查问题，不截断也不接着写。
+        //回放出来的kv刷到sst，mem_留空让DB::Open换一个新vlog
+        Log(options_.info_log, "Log #%llu: stopped at %llu before the end, "
+            "keeping the tail and starting a new log",
+            (unsigned long long) log_number, (unsigned long long) vlog_head_);
+        if (mem != NULL) {
+          *save_manifest = true;
+          status = WriteLevel0Table(mem, edit, NULL);
+          mem->Unref();
+        }
+        vlog_head_ = 0;
+        return status;
+      }
+      //回放干净地停在了文件尾，之后可能是预分配或者崩溃时没写到的清零部分，
+      //截掉之后新写的记录才能接在vlog_head_处
+      uint64_t file_size = 0;
+      if (status.ok() && env_->GetFileSize(fname, &file_size).ok() &&
+          file_size > vlog_head_) {
+        WritableFile* tail_file;
+        if (env_->NewAppendableFile(fname, &tail_file).ok()) {
+          tail_file->Truncate(vlog_head_);
+          delete tail_file;
+        }
+      }
       if(!(compactions == 0 && mem == NULL))
       {//针对的是该vlog文件中一条待恢复的kv记录都没有,只有有待恢复的记录时才会进入该分支，需要
        //重新设置重启点head
-           //针对 刚好恢复完vlog恰好mem为空 的情况
-            if(mem == NULL)
-            {
-                mem = new MemTable(internal_comparator_);
-                mem->Ref();
-            }
             if (status.ok()) {
                 *save_manifest = true;
-                *max_sequence = *max_sequence + 1;
-                char buf[8];
-                Slice v(buf, 8);//vlog_head_用了3个字节表示大小，也就是说不能超过16M,有问题需要改
-                EncodeFixed64(buf, (vlog_head_ << 24) | log_number);
-                mem->Add(*max_sequence,kTypeValue, Slice("head"),v);
-                next_check_point_ = vlog_head_;//////////
-                check_point_ = next_check_point_;///////////
-                status = WriteLevel0Table(mem, edit, NULL);
+                if(mem != NULL)//针对 刚好恢复完vlog恰好mem为空 的情况
+                    status = WriteLevel0Table(mem, edit, NULL);
+                edit->SetVlogHead(log_number, vlog_head_);
             }
-            mem->Unref();
+            if(mem != NULL)
+                mem->Unref();
       }
       if(status.ok())
       {
@@ -579,8 +1021,7 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
     if (base != NULL) {
       level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
     }
-    edit->AddFile(level, meta.number, meta.file_size,
-                  meta.smallest, meta.largest);
+    edit->AddFile(level, meta);
   }
 
   CompactionStats stats;
@@ -595,11 +1036,15 @@ void DBImpl::CompactMemTable() {
   assert(imm_ != NULL);
 
   // Save the contents of the memtable as a new Table
+  BeginInstall();
   VersionEdit edit;
-  Version* base = versions_->current();
-  base->Ref();
+  // A compaction that already picked its inputs may be writing tables the
+  // current version does not show yet, so only look past level 0 when no
+  // compaction is around.  One scheduled later waits for EndInstall().
+  Version* base = bg_compaction_scheduled_ ? NULL : versions_->current();
+  if (base != NULL) base->Ref();
   Status s = WriteLevel0Table(imm_, &edit, base);
-  base->Unref();
+  if (base != NULL) base->Unref();
 
   if (s.ok() && shutting_down_.Acquire_Load()) {
     s = Status::CloseInCompactError("Deleting DB during memtable compaction");//为了关闭clean时顺利插入tail
@@ -608,15 +1053,22 @@ void DBImpl::CompactMemTable() {
   // Replace immutable memtable with the generated Table
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
-    edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
+    //vlog可能在imm之后又换过，重启点之前的vlog才不用回放
+    edit.SetLogNumber(imm_head_number_);  // Earlier logs no longer needed
+    edit.SetVlogHead(imm_head_number_, imm_head_pos_);
+    if (imm_clean_tail_.valid) {
+      edit.SetCleanTail(imm_clean_tail_.number, imm_clean_tail_.pos);
+    }
     s = versions_->LogAndApply(&edit, &mutex_);
-    check_point_=next_check_point_;//上述的LogAndApply说明已经把next_check_point_写入到sst文件了，并应用到version_中了
   }
+  EndInstall();
   if (s.ok()) {
     // Commit to the new state
     imm_->Unref();
     imm_ = NULL;
-    has_imm_.Release_Store(NULL);
+    InstallReadView();
+    imm_cold_vlogs_.clear();
+    imm_clean_tail_ = CleanTail();
     DeleteObsoleteFiles();
   } else {
     RecordBackgroundError(s);
@@ -678,21 +1130,54 @@ void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
 }
 
 Status DBImpl::TEST_CompactMemTable() {
+  return FlushMemTable();
+}
+
+Status DBImpl::TEST_RollVlog() {
+  Writer w(&mutex_);
+  w.batch = NULL;
+  w.sync = false;
+  MutexLock l(&mutex_);
+  do {
+    // A writer ahead of us may take us into its group, queue up again
+    w.done = false;
+    writers_.push_back(&w);
+    while (!w.done && &w != writers_.front()) {
+      w.cv.Wait();
+    }
+  } while (w.done);
+  Status s = RollVlog();
+  writers_.pop_front();
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+  return s;
+}
+
+Status DBImpl::FlushMemTable() {
   // NULL batch means just wait for earlier writes to be done
   Status s = Write(WriteOptions(), NULL);
   if (s.ok()) {
     // Wait until the compaction completes
     MutexLock l(&mutex_);
-    while (imm_ != NULL && bg_error_.ok()) {
+    while (imm_ != NULL && bg_error_.ok() && !shutting_down_.Acquire_Load()) {
       bg_cv_.Wait();
     }
     if (imm_ != NULL) {
-      s = bg_error_;
+      s = bg_error_.ok() ? Status::IOError("Deleting DB during flush")
+                         : bg_error_;
     }
   }
   return s;
 }
 
+void DBImpl::SetCleanTail(uint64_t vlog_numb, uint64_t pos) {
+  MutexLock l(&mutex_);
+  mem_clean_tail_.valid = true;
+  mem_clean_tail_.number = vlog_numb;
+  mem_clean_tail_.pos = pos;
+}
+
 void DBImpl::RecordBackgroundError(const Status& s) {
   mutex_.AssertHeld();
   if (bg_error_.ok()) {
@@ -703,20 +1188,77 @@ void DBImpl::RecordBackgroundError(const Status& s) {
 
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (bg_compaction_scheduled_) {
-    // Already scheduled
-  } else if (shutting_down_.Acquire_Load()) {
+  if (shutting_down_.Acquire_Load()) {
     // DB is being deleted; no more background compactions
+    return;
   } else if (!bg_error_.ok()) {
     // Already got an error; no more changes
-  } else if (imm_ == NULL &&
-             manual_compaction_ == NULL &&
-             !versions_->NeedsCompaction()) {
+    return;
+  }
+
+  if (imm_ != NULL && !bg_flush_scheduled_) {
+    bg_flush_scheduled_ = true;
+    env_->Schedule(&DBImpl::BGFlushWork, this, Env::kFlush);
+  }
+
+  if (bg_compaction_scheduled_) {
+    // Already scheduled
+  } else if (manual_compaction_ == NULL && !versions_->NeedsCompaction()) {
     // No work to be done
   } else {
     bg_compaction_scheduled_ = true;
-    env_->Schedule(&DBImpl::BGWork, this);
+    // Level-0 compactions unblock writers, keep them from queueing behind
+    // long compactions of deeper levels
+    const bool l0 =
+        (manual_compaction_ == NULL &&
+         versions_->NumLevelFiles(0) >= config::kL0_CompactionTrigger);
+    env_->Schedule(&DBImpl::BGWork, this,
+                   l0 ? Env::kL0Compaction : Env::kCompaction);
+  }
+}
+
+void DBImpl::BeginInstall() {
+  mutex_.AssertHeld();
+  while (installing_) {
+    bg_cv_.Wait();
+  }
+  installing_ = true;
+}
+
+void DBImpl::EndInstall() {
+  mutex_.AssertHeld();
+  assert(installing_);
+  installing_ = false;
+  bg_cv_.SignalAll();
+}
+
+Status DBImpl::ApplyEdit(VersionEdit* edit) {
+  BeginInstall();
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  EndInstall();
+  return s;
+}
+
+void DBImpl::BGFlushWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlushCall();
+}
+
+void DBImpl::BackgroundFlushCall() {
+  MutexLock l(&mutex_);
+  assert(bg_flush_scheduled_);
+  if (shutting_down_.Acquire_Load()) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else if (imm_ != NULL) {
+    CompactMemTable();
   }
+
+  bg_flush_scheduled_ = false;
+
+  // The new level-0 table may call for a compaction.
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
 }
 
 void DBImpl::BGWork(void* db) {
@@ -745,11 +1287,7 @@ void DBImpl::BackgroundCall() {
 void DBImpl::BackgroundCompaction() {
   mutex_.AssertHeld();
 
-  if (imm_ != NULL) {
-    CompactMemTable();
-    return;
-  }
-
+  BeginInstall();
   Compaction* c;
   bool is_manual = (manual_compaction_ != NULL);
   InternalKey manual_end;
@@ -773,15 +1311,18 @@ void DBImpl::BackgroundCompaction() {
   Status status;
   if (c == NULL) {
     // Nothing to do
+    EndInstall();
   } else if (!is_manual && c->IsTrivialMove()) {
     // Move file to next level
     assert(c->num_input_files(0) == 1);
     FileMetaData* f = c->input(0, 0);
     c->edit()->DeleteFile(c->level(), f->number);
-    c->edit()->AddFile(c->level() + 1, f->number, f->file_size,
-                       f->smallest, f->largest);
+    c->edit()->AddFile(c->level() + 1, *f);
     status = versions_->LogAndApply(c->edit(), &mutex_);
-    if (!status.ok()) {
+    EndInstall();
+    if (status.ok()) {
+      InstallReadView();
+    } else {
       RecordBackgroundError(status);
     }
     VersionSet::LevelSummaryStorage tmp;
@@ -792,6 +1333,7 @@ void DBImpl::BackgroundCompaction() {
         status.ToString().c_str(),
         versions_->LevelSummary(&tmp));
   } else {
+    EndInstall();
     CompactionState* compact = new CompactionState(c);
     status = DoCompactionWork(compact);
     if (!status.ok()) {
@@ -936,16 +1478,24 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
   const int level = compact->compaction->level();
   for (size_t i = 0; i < compact->outputs.size(); i++) {
     const CompactionState::Output& out = compact->outputs[i];
-    compact->compaction->edit()->AddFile(
-        level + 1,
-        out.number, out.file_size, out.smallest, out.largest);
+    FileMetaData f;
+    f.number = out.number;
+    f.file_size = out.file_size;
+    f.smallest = out.smallest;
+    f.largest = out.largest;
+    f.has_vlog_refs = true;
+    f.vlog_refs = out.vlog_refs;
+    compact->compaction->edit()->AddFile(level + 1, f);
+  }
+  Status s = ApplyEdit(compact->compaction->edit());
+  if (s.ok()) {
+    InstallReadView();
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  return s;
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
   const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
 
   Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
       compact->compaction->num_input_files(0),
@@ -968,19 +1518,14 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   std::string current_user_key;
   bool has_current_user_key = false;//是否是第一次出现这个user_key
   SequenceNumber last_sequence_for_key = kMaxSequenceNumber;
+  const bool relocate = options_.compaction_relocate;
+  const uint64_t now_seconds = NowSeconds();
+  const bool punch = options_.punch_hole_threshold > 0;
+  int relocated = 0;
+  std::string relocated_ptr;
+  std::string forwarded_ptr;
+  uint64_t last_cold_vlog = 0;
   for (; input->Valid() && !shutting_down_.Acquire_Load(); ) {
-    // Prioritize immutable compaction work
-    if (has_imm_.NoBarrier_Load() != NULL) {
-      const uint64_t imm_start = env_->NowMicros();
-      mutex_.Lock();
-      if (imm_ != NULL) {
-        CompactMemTable();//就是因为有了这个，会暂时对下当前的多文件合并，转去刷immemtable
-        bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
-      }
-      mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
-    }
-
     Slice key = input->key();
     if (compact->compaction->ShouldStopBefore(key) &&
         compact->builder != NULL) {
@@ -998,38 +1543,7 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       current_user_key.clear();
       has_current_user_key = false;
       last_sequence_for_key = kMaxSequenceNumber;
-    }
-    else if(ikey.user_key == "head")
-    {//合并文件的时候去掉老版本的head kv对,这个合并比较特殊，直接和内存中的check_point_比较就好了，因为check_point_代表已经记录到sst中的最新head
-    //这里对check_point_的值并不需要强一致性，不需要加锁来获取check_point_
-        uint64_t code = DecodeFixed64(input->value().data());
-        uint64_t pos = code>>24;
-        if(pos != check_point_)
-            drop = true;
-    }
-    else if(ikey.user_key == "vloginfo")
-    {
-        uint64_t code = DecodeFixed64(input->value().data());
-        code = code>>24;
-        uint64_t file_numb = code & 0xff;
-        if(file_numb == vloginfo_file_number_)
-        {
-            uint64_t pos = code>>8;
-            if(pos < vloginfo_pos_)
-            {
-                vlog_manager_.AddDropCount(file_numb);
-                drop_count_++;
-                drop = true;
-            }
-        }
-        else
-        {
-            vlog_manager_.AddDropCount(file_numb);
-            drop_count_++;
-            drop = true;
-        }
-    }
-    else {
+    } else {
       if (!has_current_user_key ||
           user_comparator()->Compare(ikey.user_key,
                                      Slice(current_user_key)) != 0) {
@@ -1047,9 +1561,17 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     //小于smallest_snapshot才能丢弃,因为这里是last_sequence_for_key，代表的是上一条kv的seq
     //但现在的kv分离版本(原理上)是不能支持快照功能的
         // Hidden by an newer entry for same user key
-          uint64_t code = DecodeFixed64(input->value().data());
-          uint64_t vlog_numb = (code>>24)&0xff;
-           vlog_manager_.AddDropCount(vlog_numb);
+          uint64_t size, pos;
+          uint64_t vlog_numb;
+          if (ikey.type == kTypeValue &&
+              DecodeValuePtr(input->value(), &size, &vlog_numb, &pos)) {
+            // The garbage is wherever GC forwarded the value to
+            vlog_manager_.ResolveForward(&vlog_numb, &pos);
+            vlog_manager_.AddDropCount(vlog_numb);
+            if (punch) {
+              compact->AddDeadExtent(vlog_numb, pos, size);
+            }
+          }
           drop_count_++;
         drop = true;    // (A)
       } else if (ikey.type == kTypeDeletion &&
@@ -1064,9 +1586,14 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         //     td::cout<<" tail by read0"<<std::endl;maller sequence numbers will be dropped in the next
         //     few iterations of this loop (by rule (A) above).
         // Therefore this deletion marker is obsolete and can be dropped.
-         // uint64_t code = DecodeFixed64(input->value().data());//有问题。del的kv的v为空
-         // uint64_t vlog_numb = (code>>24)&0xff;
-         // vlog_manager_.AddDropCount(vlog_numb);
+        drop = true;
+      } else if (ikey.type == kTypeValue &&
+                 ikey.sequence <= compact->smallest_snapshot &&
+                 ValuePtrExpired(input->value(), now_seconds) &&
+                 compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+        // An expired value hides older entries just like a deletion and
+        // is obsolete under the same conditions.  Its TTL vlog goes as a
+        // whole, so there is no drop to count.
         drop = true;
       }
 
@@ -1082,6 +1609,70 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         (int)last_sequence_for_key, (int)compact->smallest_snapshot);
 #endif
 
+    Slice value = input->value();
+    if (!drop && ikey.type == kTypeValue) {
+      //gc转发走的值在输出sst里直接写转发后的指针，没有sst再指向源vlog时它的转发表和转发文件就删掉了
+      uint64_t size, pos;
+      uint64_t vlog_numb;
+      if (DecodeValuePtr(value, &size, &vlog_numb, &pos) &&
+          vlog_manager_.ResolveForward(&vlog_numb, &pos)) {
+        forwarded_ptr.clear();
+        EncodeValuePtr(&forwarded_ptr, size, vlog_numb, pos);
+        const uint64_t expiration = ValuePtrExpiration(value);
+        if (expiration != 0) {
+          PutVarint64(&forwarded_ptr, expiration);
+        }
+        if (key_index_ != NULL || ptr_cache_ != NULL) {
+          CompactionState::Relocation r;
+          r.key = ikey.user_key.ToString();
+          r.old_ptr = value.ToString();
+          r.new_ptr = forwarded_ptr;
+          compact->relocations.push_back(r);
+        }
+        value = forwarded_ptr;
+      }
+    }
+    if (!drop && relocate && ikey.type == kTypeValue &&
+        compact->compaction->IsBaseLevelForKey(ikey.user_key)) {
+      //最底层的合并顺便把垃圾多的vlog里的有效kv搬到cold vlog，输出sst里直接写新指针
+      uint64_t size, pos;
+      uint64_t vlog_numb;
+      bool is_ptr = DecodeValuePtr(value, &size, &vlog_numb, &pos);
+      if (is_ptr) {
+        vlog_manager_.ResolveForward(&vlog_numb, &pos);
+      }
+      if (is_ptr &&
+          vlog_manager_.ShouldRelocate(vlog_numb, options_.min_clean_threshold)) {
+        status = RelocateValue(ikey.user_key, value, &relocated_ptr);
+        if (!status.ok()) {
+          break;
+        }
+        if (key_index_ != NULL || ptr_cache_ != NULL) {
+          CompactionState::Relocation r;
+          r.key = ikey.user_key.ToString();
+          r.old_ptr = value.ToString();
+          r.new_ptr = relocated_ptr;
+          compact->relocations.push_back(r);
+        }
+        value = relocated_ptr;
+        uint64_t cold_size, cold_pos;
+        uint64_t cold_numb;
+        if (DecodeValuePtr(relocated_ptr, &cold_size, &cold_numb, &cold_pos) &&
+            cold_numb != last_cold_vlog) {
+          // Our outputs are not installed yet, keep the cold vlog alive
+          last_cold_vlog = cold_numb;
+          mutex_.Lock();
+          compaction_cold_vlogs_.insert(cold_numb);
+          mutex_.Unlock();
+        }
+        vlog_manager_.AddDropCount(vlog_numb);
+        if (punch) {
+          compact->AddDeadExtent(vlog_numb, pos, size);
+        }
+        relocated++;
+      }
+    }
+
     if (!drop) {
       // Open output file if necessary
       if (compact->builder == NULL) {
@@ -1095,7 +1686,8 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         compact->current_output()->smallest.DecodeFrom(key);
       }
       compact->current_output()->largest.DecodeFrom(key);
-      compact->builder->Add(key, input->value());
+      compact->builder->Add(key, value);
+      AddVlogRef(key, value, &compact->current_output()->vlog_refs);
 
       // Close output file if it is big enough
       if (compact->builder->FileSize() >=
@@ -1121,11 +1713,17 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   if (status.ok()) {
     status = input->status();
   }
+  if (status.ok() && relocated > 0) {
+    // The output tables point into the cold vlog, make the copies
+    // durable before the tables are installed.
+    status = SyncColdVlog();
+    Log(options_.info_log, "relocated %d values to cold vlog", relocated);
+  }
   delete input;
   input = NULL;
 
   CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
+  stats.micros = env_->NowMicros() - start_micros;
   for (int which = 0; which < 2; which++) {
     for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
       stats.bytes_read += compact->compaction->input(which, i)->file_size;
@@ -1136,28 +1734,40 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   }
 //这里在加锁，因为要应用刚才合并的结果，修改元数据
   mutex_.Lock();
+  compaction_cold_vlogs_.clear();  // Outputs are installed or dropped below
   stats_[compact->compaction->level() + 1].Add(stats);
 
   if (status.ok()) {
     status = InstallCompactionResults(compact);
-    WriteOptions write_options;
-//定期将各个vlog文件的垃圾情况持久化到vlog和sst文件里,只有最新的才有效
-    if(drop_count_ >= options_.log_dropCount_threshold)
-    {
-        vlog_manager_.Serialize(vloginfo_);
-        if (has_imm_.NoBarrier_Load() != NULL) {
-          if (imm_ != NULL) {
-            CompactMemTable();
-            bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
-            }
+    if (status.ok()) {
+      for (size_t i = 0; i < compact->dead_extents.size(); i++) {
+        const CompactionState::DeadExtent& e = compact->dead_extents[i];
+        vlog_manager_.AddDeadExtent(e.vlog_numb, e.pos, e.size);
+      }
+      for (size_t i = 0; i < compact->relocations.size(); i++) {
+        const CompactionState::Relocation& r = compact->relocations[i];
+        if (key_index_ != NULL) {
+          key_index_->Replace(r.key, r.old_ptr, r.new_ptr);
+        }
+        if (ptr_cache_ != NULL) {
+          //只有装上合并结果之后的view才看得到新指针
+          ptr_cache_->RelocateInView(r.key, r.old_ptr, r.new_ptr,
+                                     read_view_->generation);
+        }
+      }
+    }
+//定期将各个vlog文件的垃圾情况持久化到manifest里,只有最新的才有效
+    if(status.ok() && drop_count_ >= options_.log_dropCount_threshold)
+    {
+        std::string vloginfo;
+        vlog_manager_.Serialize(vloginfo);
+        VersionEdit edit;
+        edit.SetVlogInfo(vloginfo);
+        status = ApplyEdit(&edit);
+        if (status.ok()) {
+          InstallReadView();
         }
-        vloginfo_file_number_ = logfile_number_;
-        vloginfo_pos_ = vlog_head_;
         drop_count_ = 0;
-        mutex_.Unlock();
-        Put(write_options, "vloginfo", vloginfo_);//会有bug，此时如果imm不为null，且mem也大于writebuffer会死锁,所以需要
-        //在前面加上if判断has_imm_是否有imm，如果有就CompactMemTable();
-        mutex_.Lock();
     }
     // 检查是否达到垃圾回收的临界点
     MaybeScheduleClean();
@@ -1232,46 +1842,106 @@ int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
   return versions_->MaxNextLevelOverlappingBytes();
 }
 
+void DBImpl::InstallReadView() {
+  mutex_.AssertHeld();
+  ReadView* old = read_view_;
+  read_view_ = new ReadView(mem_, imm_, versions_->current(),
+                            old != NULL ? old->generation + 1 : 1);
+  if (old != NULL) {
+    old->Unref();
+  }
+  ScrapeReadViews();
+}
+
+void DBImpl::ScrapeReadViews() {
+  mutex_.AssertHeld();
+  std::vector<ReadViewCache::Slot*> slots;
+  std::vector<ReadView*> views;
+  read_views_.Scrape(&slots, &views);
+  for (size_t i = 0; i < slots.size(); i++) {
+    ApplyReadStats(slots[i], views[i]);
+    views[i]->Unref();
+  }
+}
+
+void DBImpl::ApplyReadStats(ReadViewCache::Slot* slot, ReadView* view) {
+  mutex_.AssertHeld();
+  bool schedule = false;
+  for (int i = 0; i < slot->num_pending; i++) {
+    if (view->current->UpdateStats(slot->pending[i])) {
+      schedule = true;
+    }
+  }
+  slot->num_pending = 0;
+  if (schedule) {
+    MaybeScheduleCompaction();
+  }
+}
+
 Status DBImpl::GetPtr(const ReadOptions& options,
                    const Slice& key,
                    std::string* value) {
   Status s;
-  MutexLock l(&mutex_);
-  SequenceNumber snapshot;
-  snapshot = versions_->LastSequence();
-
-  MemTable* mem = mem_;
-  MemTable* imm = imm_;
-  Version* current = versions_->current();
-  mem->Ref();
-  if (imm != NULL) imm->Ref();
-  current->Ref();
+  if (ptr_cache_ != NULL && ptr_cache_->Get(key, value)) {
+    return s;
+  }
+  // Read the sequence first: a view taken afterwards holds every write
+  // up to it, which PtrCache::Fill relies on.
+  SequenceNumber snapshot = versions_->PublishedLastSequence();
+  // Usually a cached view is at hand and mutex_ is not touched at all.
+  ReadView* view;
+  ReadViewCache::Slot* slot = read_views_.Acquire(&view);
+  if (view == NULL) {
+    MutexLock l(&mutex_);
+    view = read_view_;
+    view->Ref();
+  }
 
-  bool have_stat_update = false;
   Version::GetStats stats;
+  stats.seek_file = NULL;
 
-  // Unlock while reading from files and memtables
-  {
-    mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
-      // Done
-    } else if (imm != NULL && imm->Get(lkey, value, &s)) {
-      // Done
+  // First look in the memtable, then in the immutable memtable (if any).
+  LookupKey lkey(key, snapshot);
+  if (view->mem->Get(lkey, value, &s)) {
+    // Done
+  } else if (view->imm != NULL && view->imm->Get(lkey, value, &s)) {
+    // Done
+  } else {
+    s = view->current->Get(options, lkey, value, &stats);
+  }
+  if (s.ok() && ptr_cache_ != NULL && options.fill_cache) {
+    ptr_cache_->Fill(key, *value, snapshot, view->generation);
+  }
+
+  // Seek charges wait in the slot and are applied under mutex_ in batches.
+  bool apply_now = false;
+  if (stats.seek_file != NULL) {
+    if (slot != NULL) {
+      slot->pending[slot->num_pending++] = stats;
+      apply_now = (slot->num_pending == ReadViewCache::kMaxPendingStats);
     } else {
-      s = current->Get(options, lkey, value, &stats);
-      have_stat_update = true;
+      apply_now = true;
     }
-    mutex_.Lock();
   }
-
-  if (have_stat_update && current->UpdateStats(stats)) {
-    MaybeScheduleCompaction();
+  if (slot == NULL) {
+    MutexLock l(&mutex_);
+    if (apply_now && view->current->UpdateStats(stats)) {
+      MaybeScheduleCompaction();
+    }
+    view->Unref();
+  } else {
+    if (apply_now) {
+      MutexLock l(&mutex_);
+      ApplyReadStats(slot, view);
+    }
+    if (!read_views_.Release(slot, view)) {
+      // The view was replaced while we were reading.
+      MutexLock l(&mutex_);
+      ApplyReadStats(slot, view);
+      view->Unref();
+      read_views_.Free(slot);
+    }
   }
-  mem->Unref();
-  if (imm != NULL) imm->Unref();
-  current->Unref();
             return s;
 }
 
@@ -1286,77 +1956,129 @@ Status DBImpl::Get(const ReadOptions& options,
         return RealValue(val, value);
 }
 
+namespace {
+//vlog里的一条kv记录：tag、变长key、变长value
+Status ParseVlogValue(Slice input, std::string* value)
+{
+    Slice k, v;
+    if(input.empty() || (input[0] != kTypeValue && input[0] != kTypeExpiringValue))
+        return Status::Corruption("corrupted key for ");
+    if(input[0] == kTypeExpiringValue)
+    {//ttl vlog里的值带着8字节的过期时间
+        if(input.size() < 9)
+            return Status::Corruption("corrupted key for ");
+        input.remove_prefix(8);
+    }
+    input.remove_prefix(1);
+    if(!GetLengthPrefixedSlice(&input, &k) || !GetLengthPrefixedSlice(&input, &v))
+        return Status::Corruption("corrupted key for ");
+    value->assign(v.data(), v.size());
+    return Status::OK();
+}
+
+//两条记录之间最多隔着一个vlog记录头和一个batch头，说明它们在vlog里是挨着写进去的
+bool AdjacentInVlog(uint64_t prev_file, uint64_t prev_end,
+                    uint64_t file_numb, uint64_t pos)
+{
+    return file_numb == prev_file && pos >= prev_end &&
+           pos - prev_end <= log::kVHeaderMaxSize + 12;
+}
+}  // namespace
+
 Status DBImpl::RealValue(Slice val_ptr, std::string* value)
 {
 // MutexLock l(&mutex_);//因为vlog_reader->Read不是线程安全的，有没有什么优化呢,就是每个vlog_reader一把锁
-    Status s;
-  /*  uint64_t code = DecodeFixed64(val_ptr.data());
-    size_t size = code & 0xffffff;
-    code = code>>24;
-    uint64_t file_numb = code & 0xff;
-    uint64_t pos = code>>8;*/
-    uint32_t file_numb;
+    uint64_t file_numb;
     uint64_t pos, size;
-    if(!GetVarint64(&val_ptr, &size))
-        return Status::Corruption("parse size false in RealValue");
-    if(!GetVarint32(&val_ptr, &file_numb))
-        return Status::Corruption("parse file_numb false in RealValue");
-    if(!GetVarint64(&val_ptr, &pos))
-        return Status::Corruption("parse pos false in RealValue");
-    log::VReader*  vlog_reader = vlog_manager_.GetVlog(file_numb);
-    assert(vlog_reader != NULL);
+    if(!DecodeValuePtr(val_ptr, &size, &file_numb, &pos))
+        return Status::Corruption("parse value pointer false in RealValue");
+    const uint64_t expiration = ValuePtrExpiration(val_ptr);
+    if(expiration != 0 && expiration <= NowSeconds())
+        return Status::NotFound("value expired");//ttl vlog可能已经删掉了，不能再读
+    vlog_manager_.ResolveForward(&file_numb, &pos);//gc可能把值搬走了但没改指针
+    if(!options_.vlog_cold_paths.empty())
+        vlog_manager_.SampleRead(file_numb);
+    return ReadVlogValue(file_numb, pos, size, value);
+}
+
+Status DBImpl::ReadVlogValue(uint64_t file_numb, uint64_t pos, uint64_t size,
+                             std::string* value)
+{
+    Status s;
+    size_t n = 0;
     if(size <= 409600)
     {
         char buf[size];
-        bool b = vlog_reader->Read(buf, size, pos);
-        assert(b);
-        Slice input(buf, size);
-        Slice k, v;
-        char tag = input[0];
-        input.remove_prefix(1);
-        switch (tag) {
-            case kTypeValue:
-                if (GetLengthPrefixedSlice(&input, &k) &&GetLengthPrefixedSlice(&input, &v))
-                {
-                    value->assign(v.data(), v.size());
-                }
-                else
-                {
-                    s = Status::Corruption("corrupted key for ");
-                }
-                break;
-            default:
-                s = Status::Corruption("corrupted key for ");
-        }
+        s = ReadVlog(file_numb, pos, size, buf, &n);
+        if(s.ok() && n != size)
+            s = Status::Corruption("read value false in RealValue");
+        if(s.ok())
+            s = ParseVlogValue(Slice(buf, size), value);
     }
     else
     {//如果size太大，栈空间不够，就需要用堆来存放
         char* buf = new char[size];
-        bool b = vlog_reader->Read(buf, size, pos);
-        assert(b);
-        Slice input(buf, size);
-        Slice k, v;
-        char tag = input[0];
-        input.remove_prefix(1);
-        switch (tag) {
-            case kTypeValue:
-                if (GetLengthPrefixedSlice(&input, &k) &&GetLengthPrefixedSlice(&input, &v))
-                {
-                    value->assign(v.data(), v.size());
-                }
-                else
-                {
-                    s = Status::Corruption("corrupted key for ");
-                }
-                break;
-            default:
-                s = Status::Corruption("corrupted key for ");
-        }
+        s = ReadVlog(file_numb, pos, size, buf, &n);
+        if(s.ok() && n != size)
+            s = Status::Corruption("read value false in RealValue");
+        if(s.ok())
+            s = ParseVlogValue(Slice(buf, size), value);
         delete[] buf;
     }
     return s;
 }
 
+Status DBImpl::ReadVlog(uint64_t file_numb, uint64_t pos, size_t size,
+                        char* scratch, size_t* n)
+{
+    const std::string fname = VLogFilePath(file_numb);
+    Status s = vlog_cache_->Read(file_numb, fname, pos, size, scratch, n);
+    if(s.IsNotFound())
+    {//解析出路径之后vlog可能刚被搬走、原文件删掉了，按新路径再试一次
+        const std::string moved = VLogFilePath(file_numb);
+        if(moved != fname)
+            s = vlog_cache_->Read(file_numb, moved, pos, size, scratch, n);
+    }
+    return s;
+}
+
+Status DBImpl::RealValue(Slice val_ptr, std::string* value, ScanReadahead* ra,
+                         uint64_t now_seconds)
+{
+    uint64_t file_numb;
+    uint64_t pos, size;
+    if(!DecodeValuePtr(val_ptr, &size, &file_numb, &pos))
+        return Status::Corruption("parse value pointer false in RealValue");
+    const uint64_t expiration = ValuePtrExpiration(val_ptr);
+    if(expiration != 0 && expiration <= now_seconds)
+        return Status::NotFound("value expired");
+    vlog_manager_.ResolveForward(&file_numb, &pos);
+    if(!options_.vlog_cold_paths.empty())
+        vlog_manager_.SampleRead(file_numb);
+    const bool sequential = AdjacentInVlog(ra->file_numb, ra->last_end, file_numb, pos);
+    const bool buffered = file_numb == ra->file_numb && pos >= ra->pos &&
+                          pos + size <= ra->pos + ra->data.size();
+    ra->file_numb = file_numb;
+    ra->last_end = pos + size;
+    if(!buffered)
+    {
+        ra->data.clear();
+        //只有发现是顺序读的时候才多读，随机读不浪费带宽
+        if(!sequential || size >= options_.scan_readahead_size)
+            return ReadVlogValue(file_numb, pos, size, value);
+        size_t n = 0;
+        ra->data.resize(options_.scan_readahead_size);
+        if(!ReadVlog(file_numb, pos, ra->data.size(), &ra->data[0], &n).ok() || n < size)
+        {
+            ra->data.clear();
+            return Status::Corruption("read value false in RealValue");
+        }
+        ra->data.resize(n);
+        ra->pos = pos;
+    }
+    return ParseVlogValue(Slice(ra->data.data() + (pos - ra->pos), size), value);
+}
+
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
   SequenceNumber latest_snapshot;
   uint32_t seed;
@@ -1372,6 +2094,146 @@ void DBImpl::RecordReadSample(Slice key) {
   if (versions_->current()->RecordReadSample(key)) {
     MaybeScheduleCompaction();
   }
+  if (options_.scan_rewrite_samples > 0) {
+    RecordScanSample(key);
+  }
+}
+
+void DBImpl::RecordScanSample(Slice key) {
+  mutex_.AssertHeld();
+  // Level-0 files overlap each other and are compacted away soon, only
+  // the sorted levels are worth laying out in key order.
+  Version* current = versions_->current();
+  InternalKey ikey;
+  ikey.DecodeFrom(key);
+  for (int level = config::kNumLevels - 1; level > 0; level--) {
+    std::vector<FileMetaData*> files;
+    current->GetOverlappingInputs(level, &ikey, &ikey, &files);
+    if (files.empty()) {
+      continue;
+    }
+    FileMetaData* f = files[0];
+    if (++scan_samples_[f->number] == options_.scan_rewrite_samples) {
+      Log(options_.info_log, "table #%llu is scanned often, rewrite its values\n",
+          static_cast<unsigned long long>(f->number));
+      pending_rewrites_.push_back(std::make_pair(
+          f->smallest.user_key().ToString(), f->largest.user_key().ToString()));
+      MaybeScheduleClean();
+    }
+    break;
+  }
+}
+
+Status DBImpl::RewriteRange(const Slice* begin, const Slice* end)
+{//把范围内有效的值按key的顺序重新追加到一个新的cold vlog，再像gc搬迁一样有条件地改lsm里的指针
+    Status s;
+    {
+        MutexLock l(&cold_mutex_);
+        s = NewColdVlog();//不和之前gc、合并搬迁的值混在一个vlog里
+    }
+    if(!s.ok())
+        return s;
+
+    ReadOptions read_options;
+    read_options.fill_cache = false;
+    SequenceNumber snapshot;
+    uint32_t ignored_seed;
+    Iterator* iter = NewInternalIterator(read_options, &snapshot, &ignored_seed);
+    if(begin != NULL)
+    {
+        InternalKey start(*begin, kMaxSequenceNumber, kValueTypeForSeek);
+        iter->Seek(start.Encode());
+    }
+    else
+    {
+        iter->SeekToFirst();
+    }
+
+    WriteBatch batch;
+    std::vector<std::string> old_ptrs;
+    std::string current_key, value;
+    bool has_current_key = false;
+    //batch里的值在原来的vlog里已经是按key顺序挨着的，就不用再搬了
+    bool sorted = true;
+    uint64_t prev_file = 0;
+    uint64_t prev_end = 0;
+    uint64_t rewritten = 0, skipped = 0;
+    for(; iter->Valid() && s.ok(); iter->Next())
+    {
+        if(shutting_down_.Acquire_Load())
+        {
+            s = Status::IOError("Deleting DB during rewrite");
+            break;
+        }
+        ParsedInternalKey ikey;
+        if(!ParseInternalKey(iter->key(), &ikey) || ikey.sequence > snapshot)
+            continue;
+        if(end != NULL && user_comparator()->Compare(ikey.user_key, *end) > 0)
+            break;
+        if(has_current_key &&
+           user_comparator()->Compare(ikey.user_key, Slice(current_key)) == 0)
+            continue;//更旧的版本
+        current_key.assign(ikey.user_key.data(), ikey.user_key.size());
+        has_current_key = true;
+        if(ikey.type != kTypeValue || ValuePtrExpiration(iter->value()) != 0)
+            continue;//ttl vlog里的值到期后整个删掉，不搬
+
+        uint64_t file_numb;
+        uint64_t pos, size;
+        if(!DecodeValuePtr(iter->value(), &size, &file_numb, &pos))
+        {
+            s = Status::Corruption("parse value pointer false in RewriteRange");
+            break;
+        }
+        vlog_manager_.ResolveForward(&file_numb, &pos);
+        if(WriteBatchInternal::Count(&batch) > 0 &&
+           !AdjacentInVlog(prev_file, prev_end, file_numb, pos))
+            sorted = false;
+        prev_file = file_numb;
+        prev_end = pos + size;
+        s = ReadVlogValue(file_numb, pos, size, &value);
+        if(!s.ok())
+            break;
+        batch.Put(ikey.user_key, value);
+        old_ptrs.push_back(iter->value().ToString());
+
+        if(WriteBatchInternal::ByteSize(&batch) > options_.clean_write_buffer_size)
+        {
+            if(sorted)
+            {
+                skipped += WriteBatchInternal::Count(&batch);
+            }
+            else
+            {
+                uint64_t batch_pos, batch_file;
+                s = AddColdRecord(&batch, &batch_pos, &batch_file);
+                if(s.ok())
+                    s = WriteRelocations(&batch, old_ptrs, batch_pos, batch_file);
+                rewritten += WriteBatchInternal::Count(&batch);
+            }
+            batch.Clear();
+            old_ptrs.clear();
+            sorted = true;
+        }
+    }
+    if(s.ok())
+        s = iter->status();
+    delete iter;
+
+    if(s.ok() && WriteBatchInternal::Count(&batch) > 0 && !sorted)
+    {
+        uint64_t batch_pos, batch_file;
+        s = AddColdRecord(&batch, &batch_pos, &batch_file);
+        if(s.ok())
+            s = WriteRelocations(&batch, old_ptrs, batch_pos, batch_file);
+        rewritten += WriteBatchInternal::Count(&batch);
+    }
+    if(s.ok())
+        s = SyncColdVlog();//新指针落到sst之前cold vlog要先落盘
+    Log(options_.info_log, "rewrite range: %llu values rewritten, %llu already in order, %s\n",
+        static_cast<unsigned long long>(rewritten),
+        static_cast<unsigned long long>(skipped), s.ToString().c_str());
+    return s;
 }
 
 // Convenience methods
@@ -1384,6 +2246,9 @@ Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
 }
 
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
+  if (options.ttl > 0 && my_batch != NULL) {
+    return WriteWithTtl(options, my_batch);
+  }
   Writer w(&mutex_);
   w.batch = my_batch;
   w.sync = options.sync;
@@ -1407,26 +2272,46 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
     WriteBatchInternal::SetSequence(updates, last_sequence + 1);
     last_sequence += WriteBatchInternal::Count(updates);
 
+    // Roll to a new vlog before this record would take the current one
+    // past max_vlog_size.  The memtable is unaffected, the recovery
+    // checkpoint of a memtable may sit in any earlier vlog.
+    if (vlog_head_ > 0 &&
+        vlog_head_ + log::kVHeaderMaxSize +
+            WriteBatchInternal::ByteSize(updates) > options_.max_vlog_size) {
+      status = RollVlog();
+    }
+
     // Add to log and apply to memtable.  We can release the lock
     // during this phase since &w is currently responsible for logging
     // and protects against concurrent loggers and concurrent writes
     // into mem_.
-    {
+    if (status.ok()) {
       mutex_.Unlock();
+      PreallocateVlog(vlog_head_ + log::kVHeaderMaxSize +
+                      WriteBatchInternal::ByteSize(updates));
     int head_size = 0;
       status = vlog_->AddRecord(WriteBatchInternal::Contents(updates), head_size);
       bool sync_error = false;
       if (status.ok() && options.sync) {
-        status = vlogfile_->Sync();
+        status = SyncTtlVlogs();
+        if (status.ok()) {
+          status = vlogfile_->Sync();
+        }
         if (!status.ok()) {
           sync_error = true;
         }
       }
      vlog_head_ += head_size;
+      const uint64_t batch_pos = vlog_head_;
       if (status.ok()) {
-        status = WriteBatchInternal::InsertInto(updates, mem_, vlog_head_, logfile_number_);//vlog_head_代表每条kv对在vlog中的位置
+        status = WriteBatchInternal::InsertInto(updates, mem_, vlog_head_, logfile_number_,
+                                                ptr_cache_);//vlog_head_代表每条kv对在vlog中的位置
+      }
+      if (status.ok() && key_index_ != NULL) {
+        key_index_->Apply(updates, batch_pos, logfile_number_);
       }
       mutex_.Lock();
+      mem_vlog_bytes_ += head_size + WriteBatchInternal::ByteSize(updates);
       if (sync_error) {
         // The state of the log file is indeterminate: the log record we
         // just added may or may not show up when the DB is re-opened.
@@ -1458,6 +2343,412 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   return status;
 }
 
+namespace {
+class TtlSplitter : public WriteBatch::Handler {
+ public:
+  uint64_t expiration_;
+  WriteBatch values_;
+  virtual void Put(const Slice& key, const Slice& value) {
+    WriteBatchInternal::PutExpiring(&values_, key, value, expiration_);
+  }
+  virtual void Delete(const Slice& key) { }
+};
+
+class PtrCollector : public WriteBatch::Handler {
+ public:
+  std::vector<std::string> ptrs_;
+  virtual void Put(const Slice& key, const Slice& value) {
+    ptrs_.push_back(value.ToString());
+  }
+  virtual void Delete(const Slice& key) { }
+};
+
+// Rebuilds the user's batch in its original order, with every put
+// replaced by a reference to its copy in the TTL vlog.
+class RefBuilder : public WriteBatch::Handler {
+ public:
+  const std::vector<std::string>* ptrs_;
+  size_t index_;
+  WriteBatch refs_;
+  virtual void Put(const Slice& key, const Slice& value) {
+    WriteBatchInternal::PutRef(&refs_, key, (*ptrs_)[index_++]);
+  }
+  virtual void Delete(const Slice& key) {
+    refs_.Delete(key);
+  }
+};
+}  // namespace
+
+Status DBImpl::WriteWithTtl(const WriteOptions& options, WriteBatch* my_batch) {
+  TtlSplitter splitter;
+  splitter.expiration_ = NowSeconds() + options.ttl;
+  Status s = my_batch->Iterate(&splitter);
+  if (!s.ok()) {
+    return s;
+  }
+  WriteOptions log_options = options;
+  log_options.ttl = 0;
+  if (WriteBatchInternal::Count(&splitter.values_) == 0) {
+    return Write(log_options, my_batch);  // Only deletions
+  }
+
+  // The values must be in the TTL vlog before the references to them
+  // can be logged.
+  uint64_t pos, file_numb;
+  s = AddTtlRecord(&splitter.values_, splitter.expiration_, options.sync,
+                   &pos, &file_numb);
+  if (!s.ok()) {
+    return s;
+  }
+  PtrCollector collector;
+  s = splitter.values_.Iterate(&collector, pos, file_numb);
+  if (!s.ok()) {
+    return s;
+  }
+  RefBuilder builder;
+  builder.ptrs_ = &collector.ptrs_;
+  builder.index_ = 0;
+  s = my_batch->Iterate(&builder);
+  if (!s.ok()) {
+    return s;
+  }
+  return Write(log_options, &builder.refs_);
+}
+
+// REQUIRES: ttl_mutex_ is held
+Status DBImpl::NewTtlVlog(uint64_t window, TtlVlog* vlog) {
+  ttl_mutex_.AssertHeld();
+  MutexLock l(&mutex_);
+  const uint64_t expiration = (window + 1) * options_.ttl_vlog_window;
+  uint64_t number = versions_->NewVlogNumber();
+  std::string fname = VLogFileName(dbname_, number);
+  WritableFile* file;
+  Status s = env_->NewWritableFile(fname, &file);
+  uint64_t size = 0;
+  if (s.ok()) {
+    WriteBatch empty;
+    std::string marker = WriteBatchInternal::Contents(&empty).ToString();
+    PutFixed64(&marker, expiration);
+    int head_size = 0;
+    log::VWriter writer(file);
+    s = writer.AddRecord(marker, head_size);
+    size = head_size + marker.size();
+    if (!s.ok()) {
+      delete file;
+    }
+  }
+  if (!s.ok()) {
+    env_->DeleteFile(fname);
+    versions_->ReuseVlogNumber(number);
+    return s;
+  }
+  vlog_manager_.AddVlog(number, false);
+  vlog_manager_.SetExpiration(number, expiration);
+  open_ttl_vlogs_.insert(number);
+  vlog->number = number;
+  vlog->file = file;
+  vlog->writer = new log::VWriter(file);
+  vlog->size = size;
+  vlog->dirty = true;
+  Log(options_.info_log, "new ttl vlog %llu, expires at %llu\n",
+      static_cast<unsigned long long>(number),
+      static_cast<unsigned long long>(expiration));
+  return s;
+}
+
+// REQUIRES: ttl_mutex_ is held
+void DBImpl::CloseTtlVlog(TtlVlog* vlog) {
+  ttl_mutex_.AssertHeld();
+  // Later sync writes cover the references logged so far, the values
+  // they point to have to be durable too.  While the vlog is open,
+  // SyncTtlVlogs() takes care of that.
+  vlog->file->Sync();
+  vlog->file->Close();
+  delete vlog->writer;
+  delete vlog->file;
+  MutexLock l(&mutex_);
+  open_ttl_vlogs_.erase(vlog->number);
+}
+
+Status DBImpl::SyncTtlVlogs() {
+  MutexLock l(&ttl_mutex_);
+  Status s;
+  for (std::map<uint64_t, TtlVlog>::iterator iter = ttl_vlogs_.begin();
+       s.ok() && iter != ttl_vlogs_.end(); ++iter) {
+    if (iter->second.dirty) {
+      s = iter->second.file->Sync();
+      if (s.ok()) {
+        iter->second.dirty = false;
+      }
+    }
+  }
+  return s;
+}
+
+Status DBImpl::AddTtlRecord(const WriteBatch* batch, uint64_t expiration,
+                            bool sync, uint64_t* pos, uint64_t* file_numb) {
+  MutexLock l(&ttl_mutex_);
+  const uint64_t window = expiration / options_.ttl_vlog_window;
+  // Windows that ended already get no more writes
+  const uint64_t now_window = NowSeconds() / options_.ttl_vlog_window;
+  while (!ttl_vlogs_.empty() && ttl_vlogs_.begin()->first < now_window) {
+    CloseTtlVlog(&ttl_vlogs_.begin()->second);
+    ttl_vlogs_.erase(ttl_vlogs_.begin());
+  }
+  std::map<uint64_t, TtlVlog>::iterator iter = ttl_vlogs_.find(window);
+  if (iter != ttl_vlogs_.end() && iter->second.size >= options_.max_vlog_size) {
+    CloseTtlVlog(&iter->second);
+    ttl_vlogs_.erase(iter);
+    iter = ttl_vlogs_.end();
+  }
+  Status s;
+  if (iter == ttl_vlogs_.end()) {
+    TtlVlog vlog;
+    s = NewTtlVlog(window, &vlog);
+    if (!s.ok()) {
+      return s;
+    }
+    iter = ttl_vlogs_.insert(std::make_pair(window, vlog)).first;
+  }
+  TtlVlog* vlog = &iter->second;
+  int head_size = 0;
+  s = vlog->writer->AddRecord(WriteBatchInternal::Contents(batch), head_size);
+  if (s.ok()) {
+    vlog->dirty = true;
+  }
+  if (s.ok() && sync) {
+    s = vlog->file->Sync();
+    if (s.ok()) {
+      vlog->dirty = false;
+    }
+  }
+  if (s.ok()) {
+    *pos = vlog->size + head_size;
+    *file_numb = vlog->number;
+    vlog->size = *pos + WriteBatchInternal::ByteSize(batch);
+  }
+  return s;
+}
+
+namespace {
+// Applies the pointers of values relocated by GC.  A key is only
+// repointed if it still resolves to the copy GC read; otherwise the
+// user has overwritten or deleted it since, and the relocated copy is
+// simply garbage in the cold vlog.
+class RelocationInserter : public WriteBatch::Handler {
+ public:
+  SequenceNumber sequence_;
+  SequenceNumber snapshot_;
+  MemTable* mem_;
+  MemTable* imm_;
+  Version* current_;
+  const std::vector<std::string>* old_ptrs_;
+  size_t index_;
+  int dropped_;
+  VlogKeyIndex* key_index_;
+  PtrCache* ptr_cache_;
+
+  virtual void Put(const Slice& key, const Slice& value) {
+    const std::string& old_ptr = (*old_ptrs_)[index_++];
+    bool live;
+    if (key_index_ != NULL) {
+      // The index holds the latest pointer of every live key, and user
+      // writes are kept out while relocations are installed.
+      live = key_index_->Replace(key, old_ptr, value);
+    } else {
+      std::string ptr;
+      Status s;
+      LookupKey lkey(key, snapshot_);
+      if (mem_->Get(lkey, &ptr, &s)) {
+        // Done
+      } else if (imm_ != NULL && imm_->Get(lkey, &ptr, &s)) {
+        // Done
+      } else {
+        Version::GetStats stats;
+        s = current_->Get(ReadOptions(), lkey, &ptr, &stats);
+      }
+      live = s.ok() && ptr == old_ptr;
+    }
+    if (live) {
+      mem_->Add(++sequence_, kTypeValue, key, value);
+      if (ptr_cache_ != NULL) {
+        ptr_cache_->Relocate(key, old_ptr, value, sequence_);
+      }
+    } else {
+      dropped_++;
+    }
+  }
+  virtual void Delete(const Slice& key) {
+    assert(false);  // GC never relocates deletions
+  }
+};
+}  // namespace
+
+// REQUIRES: cold_mutex_ is held
+Status DBImpl::NewColdVlog() {
+  cold_mutex_.AssertHeld();
+  MutexLock l(&mutex_);
+  Status s;
+  if (cold_vlogfile_ != NULL) {
+    // Relocated pointers into the old cold vlog may still be only in
+    // the memtable, GC relies on them being durable before unlinking
+    // the source vlog.
+    s = cold_vlogfile_->Sync();
+    if (!s.ok()) {
+      return s;
+    }
+    cold_vlogfile_->Close();
+    delete cold_vlog_;
+    delete cold_vlogfile_;
+    cold_vlog_ = NULL;
+    cold_vlogfile_ = NULL;
+  }
+
+  uint64_t number = versions_->NewVlogNumber();
+  std::string fname = VLogFileName(dbname_, number);
+  WritableFile* file;
+  s = env_->NewWritableFile(fname, &file);
+  uint64_t size = 0;
+  if (s.ok()) {
+    WriteBatch marker;
+    int head_size = 0;
+    log::VWriter writer(file);
+    s = writer.AddRecord(WriteBatchInternal::Contents(&marker), head_size);
+    size = head_size + WriteBatchInternal::ByteSize(&marker);
+    if (!s.ok()) {
+      delete file;
+    }
+  }
+  if (!s.ok()) {
+    env_->DeleteFile(fname);
+    versions_->ReuseVlogNumber(number);
+    vlog_manager_.SetColdVlog(0);
+    return s;
+  }
+  vlog_manager_.AddVlog(number, false);
+  vlog_manager_.SetColdVlog(number);
+  cold_vlog_number_ = number;
+  cold_vlogfile_ = file;
+  cold_vlog_ = new log::VWriter(file);
+  cold_vlog_size_ = size;
+  Log(options_.info_log, "new cold vlog %llu\n",
+      static_cast<unsigned long long>(number));
+  return s;
+}
+
+Status DBImpl::AddColdRecord(const WriteBatch* batch, uint64_t* pos,
+                             uint64_t* file_numb) {
+  MutexLock l(&cold_mutex_);
+  Status s;
+  if (cold_vlog_ == NULL || cold_vlog_size_ >= options_.max_vlog_size) {
+    s = NewColdVlog();
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  int head_size = 0;
+  s = cold_vlog_->AddRecord(WriteBatchInternal::Contents(batch), head_size);
+  if (s.ok()) {
+    *pos = cold_vlog_size_ + head_size;
+    *file_numb = cold_vlog_number_;
+    cold_vlog_size_ = *pos + WriteBatchInternal::ByteSize(batch);
+  }
+  return s;
+}
+
+Status DBImpl::SyncColdVlog() {
+  MutexLock l(&cold_mutex_);
+  if (cold_vlogfile_ == NULL) {
+    return Status::OK();
+  }
+  return cold_vlogfile_->Sync();
+}
+
+namespace {
+class PtrCapture : public WriteBatch::Handler {
+ public:
+  std::string ptr_;
+  virtual void Put(const Slice& key, const Slice& value) {
+    ptr_.assign(value.data(), value.size());
+  }
+  virtual void Delete(const Slice& key) { }
+};
+}  // namespace
+
+Status DBImpl::RelocateValue(const Slice& key, const Slice& ptr,
+                             std::string* new_ptr) {
+  std::string value;
+  Status s = RealValue(ptr, &value);
+  if (!s.ok()) {
+    return s;
+  }
+  WriteBatch batch;
+  batch.Put(key, value);
+  uint64_t pos, file_numb;
+  s = AddColdRecord(&batch, &pos, &file_numb);
+  if (s.ok()) {
+    PtrCapture capture;
+    s = batch.Iterate(&capture, pos, file_numb);
+    new_ptr->swap(capture.ptr_);
+  }
+  return s;
+}
+
+Status DBImpl::WriteRelocations(const WriteBatch* batch,
+                                const std::vector<std::string>& old_ptrs,
+                                uint64_t pos, uint64_t file_numb) {
+  Writer w(&mutex_);
+  w.batch = NULL;
+  w.sync = false;
+  w.done = false;
+  w.relocation = true;
+
+  MutexLock l(&mutex_);
+  writers_.push_back(&w);
+  while (&w != writers_.front()) {
+    w.cv.Wait();
+  }
+
+  // Being at the front of the writer queue keeps user writes out of
+  // mem_ until all relocations are checked and applied.
+  Status status = MakeRoomForWrite(false);
+  if (status.ok()) {
+    RelocationInserter inserter;
+    inserter.sequence_ = versions_->LastSequence();
+    inserter.snapshot_ = inserter.sequence_;
+    inserter.mem_ = mem_;
+    inserter.imm_ = imm_;
+    inserter.current_ = versions_->current();
+    inserter.old_ptrs_ = &old_ptrs;
+    inserter.index_ = 0;
+    inserter.dropped_ = 0;
+    inserter.key_index_ = key_index_;
+    inserter.ptr_cache_ = ptr_cache_;
+    mem_->Ref();
+    if (imm_ != NULL) imm_->Ref();
+    inserter.current_->Ref();
+    {
+      mutex_.Unlock();
+      status = batch->Iterate(&inserter, pos, file_numb);
+      mutex_.Lock();
+    }
+    versions_->SetLastSequence(inserter.sequence_);
+    inserter.mem_->Unref();
+    if (inserter.imm_ != NULL) inserter.imm_->Unref();
+    inserter.current_->Unref();
+    for (int i = 0; i < inserter.dropped_; i++) {
+      vlog_manager_.AddDropCount(file_numb);
+    }
+    mem_cold_vlogs_.insert(file_numb);
+  }
+
+  writers_.pop_front();
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+  return status;
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-NULL batch
 WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
@@ -1481,6 +2772,11 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   ++iter;  // Advance past "first"
   for (; iter != writers_.end(); ++iter) {
     Writer* w = *iter;
+    if (w->relocation) {
+      // GC pointer updates are applied on their own, see WriteRelocations().
+      break;
+    }
+
     if (w->sync && !first->sync) {
       // Do not include a sync write into a batch handled by a non-sync write.
       break;
@@ -1533,8 +2829,18 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       allow_delay = false;  // Do not delay a single write more than once
       mutex_.Lock();
     } else if (!force &&
-               (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size)) {
-      // There is room in current memtable
+               (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size) &&
+               (options_.max_recovery_bytes == 0 ||
+                mem_vlog_bytes_ < options_.max_recovery_bytes / 2)) {
+      // There is room in current memtable.  The memtable only holds value
+      // pointers, so also switch once its records take half of
+      // max_recovery_bytes in the vlog: the tail replayed by Open() is
+      // at most the bytes of imm_ plus those of mem_.
+      break;
+    } else if (imm_ != NULL && shutting_down_.Acquire_Load()) {
+      // No more background work when shutting down, so the previous
+      // memtable will never be compacted.
+      s = Status::IOError("Deleting DB during write");
       break;
     } else if (imm_ != NULL) {
       // We have filled up the current memtable, but the previous
@@ -1550,50 +2856,111 @@ Status DBImpl::MakeRoomForWrite(bool force) {
      // assert(versions_->PrevLogNumber() == 0);
 
       imm_ = mem_;
-    //把当前vlog文件的大小记录下来，作为head对应的v值插入imm表，imm将会持久化到sst文件
-    //恢复时我们从head对应的vlog起始处开始恢复就好了，相当于设置一个检查点
-    uint64_t last_sequence = versions_->LastSequence();
-    last_sequence++;
-    char buf[8];
-    Slice v(buf, 8);
-    EncodeFixed64(buf, (vlog_head_ << 24) | logfile_number_ );
-    imm_->Add(last_sequence,kTypeValue, Slice("head"),v);
-    versions_->SetLastSequence(last_sequence);//如果sst文件写成功了，head代表vlog文件从head开始的偏移的kv是在
-    //mem，需要恢复.如果head的imm没有成功写入到sst中，那么会从上一次写入成功的head开始恢复
-    next_check_point_ = vlog_head_;//next_check_point_ 代表将要被刷进sst，它同imm一起
-    //被刷入sst,check_point代表已经刷入到sst文件的最新check_point,其实恢复就是从该检查点开始的
-      has_imm_.Release_Store(imm_);
+      imm_cold_vlogs_.swap(mem_cold_vlogs_);
+      mem_cold_vlogs_.clear();
+      imm_clean_tail_ = mem_clean_tail_;
+      mem_clean_tail_ = CleanTail();
+      //imm里的kv都在当前vlog的vlog_head_之前，imm刷到sst时把这个位置作为重启点一起写入manifest
+      //如果imm没有成功写入sst，那么会从上一次写入成功的重启点开始恢复
+      imm_head_number_ = logfile_number_;
+      imm_head_pos_ = vlog_head_;
+      mem_vlog_bytes_ = 0;
       mem_ = new MemTable(internal_comparator_);
       mem_->Ref();
+      InstallReadView();
       force = false;   // Do not force another compaction if have room
-      if(vlog_head_ >= options_.max_vlog_size)
-      {
-    //新生成的vlog文件的编号会和imm生成的sst文件一起应用到version中，见CompactMemTable
-         uint32_t new_log_number = versions_->NewVlogNumber();//对于newdb且不能重用上次的log(即不能logandapply新生成的log)，会有bug
-         vlog_head_ = 0;
-         WritableFile* vlfile;
-         s = env_->NewWritableFile(VLogFileName(dbname_, new_log_number), &vlfile);
-         if (!s.ok()) {
-            versions_->ReuseVlogNumber(new_log_number);
-            break;
-         }
-         delete vlog_;
-         delete vlogfile_;
-         vlogfile_ = vlfile;
-         logfile_number_ = new_log_number;
-         vlog_ = new log::VWriter(vlfile);
-          SequentialFile* vlr_file;
-          s = options_.env->NewSequentialFile(VLogFileName(dbname_, new_log_number), &vlr_file);
-          log::VReader* vlog_reader = new log::VReader(vlr_file, true,0);
-          vlog_manager_.AddVlog(new_log_number, vlog_reader);
-          Log(options_.info_log, "new vlog %d...\n", new_log_number);
-      }
       MaybeScheduleCompaction();
     }
   }
   return s;
 }
 
+// REQUIRES: mutex_ is held and we are the writer at the front of writers_
+Status DBImpl::RollVlog() {
+  mutex_.AssertHeld();
+  //重启点可能在前面的vlog里，之后的同步写落盘时它前面的记录也必须已经落盘
+  mutex_.Unlock();
+  Status s = SyncTtlVlogs();
+  if (s.ok()) {
+    s = vlogfile_->Sync();
+  }
+  mutex_.Lock();
+  if (!s.ok()) {
+    RecordBackgroundError(s);
+    return s;
+  }
+  //新vlog的编号随下一次LogAndApply持久化，在这之前崩溃的话恢复时MarkVlogNumberUsed
+  uint64_t new_log_number = versions_->NewVlogNumber();
+  WritableFile* vlfile;
+  s = NewVlogFile(new_log_number, &vlfile);
+  if (!s.ok()) {
+    versions_->ReuseVlogNumber(new_log_number);
+    return s;
+  }
+  delete vlog_;
+  delete vlogfile_;
+  vlogfile_ = vlfile;
+  vlog_ = new log::VWriter(vlfile);
+  logfile_number_ = new_log_number;
+  vlog_head_ = 0;
+  vlog_allocated_ = 0;
+  vlog_manager_.AddVlog(new_log_number);
+  Log(options_.info_log, "new vlog %llu...\n",
+      static_cast<unsigned long long>(new_log_number));
+  if (!options_.vlog_cold_paths.empty()) {
+    //每换一次vlog结束一个读次数的统计周期
+    migrate_check_pending_ = true;
+    MaybeScheduleClean();
+  }
+  return s;
+}
+
+Status DBImpl::NewVlogFile(uint64_t number, WritableFile** result) {
+  mutex_.AssertHeld();
+  std::string fname = VLogFileName(dbname_, number);
+  while (!free_vlogs_.empty()) {
+    const uint64_t free_number = free_vlogs_.front();
+    free_vlogs_.pop_front();
+    std::string free_name = VFreeFileName(dbname_, free_number);
+    Status s = env_->ReuseWritableFile(free_name, fname, result);
+    if (s.ok()) {
+      Log(options_.info_log, "reuse vlog file #%llu as #%llu\n",
+          static_cast<unsigned long long>(free_number),
+          static_cast<unsigned long long>(number));
+      return s;
+    }
+    env_->DeleteFile(free_name);
+  }
+  return env_->NewWritableFile(fname, result);
+}
+
+bool DBImpl::RecycleVlogFile(uint64_t number, const std::string& fname) {
+  mutex_.AssertHeld();
+  vlog_cache_->Evict(number);//还在读的reader读完才关闭文件
+  //冷存储目录里的vlog不重用，新vlog总是建在数据库目录
+  if (free_vlogs_.size() < static_cast<size_t>(options_.recycle_vlog_num) &&
+      fname == VLogFileName(dbname_, number) &&
+      env_->RenameFile(fname, VFreeFileName(dbname_, number)).ok()) {
+    free_vlogs_.push_back(number);
+    return true;
+  }
+  env_->DeleteFile(fname);
+  return false;
+}
+
+void DBImpl::PreallocateVlog(uint64_t end) {
+  if (end <= vlog_allocated_ || options_.vlog_preallocate_size == 0) {
+    return;
+  }
+  //一次多分配一块，不够一块时分配到max_vlog_size为止
+  const uint64_t start = std::max(vlog_allocated_, vlog_head_);
+  const uint64_t limit = std::max(
+      end, std::min(start + options_.vlog_preallocate_size,
+                    options_.max_vlog_size));
+  vlogfile_->Preallocate(start, limit - start);//只是提示，失败了照样写
+  vlog_allocated_ = limit;
+}
+
 void DBImpl::CleanVlog()
 {//不可重入
     mutex_.Lock();
@@ -1621,19 +2988,44 @@ void DBImpl::MaybeScheduleClean(bool isManuaClean)
     else if(!bg_error_.ok())
     {
     }
-    else if(vlog_manager_.HasVlogToClean() || isManuaClean)
+    else if(manual_clean_.pending)
+    {
+        manual_clean_.pending = false;
+        bg_clean_scheduled_ = true;
+        env_->Schedule(&DBImpl::BGManualClean, this, Env::kGarbageCollection);
+    }
+    else if(garbage_sample_pending_)
+    {//先估计出各个vlog的垃圾数，gc才知道该回收哪个
+        garbage_sample_pending_ = false;
+        bg_clean_scheduled_ = true;
+        env_->Schedule(&DBImpl::BGSampleGarbage, this, Env::kGarbageCollection);
+    }
+    else if(vlog_manager_.HasVlogToClean() || isManuaClean ||
+            (options_.punch_hole_threshold > 0 &&
+             vlog_manager_.HasHolesToPunch(options_.punch_hole_threshold, versions_->LogNumber())))
     {
         bg_clean_scheduled_ = true;
         if(!isManuaClean)
         {
-    //    env_->Schedule(&DBImpl::BGClean, this);//不能是schedule，一个线程池.可能会死锁
-            env_->StartThread(&DBImpl::BGClean, this);
+            //gc有自己的线程池，不会和刷imm、合并抢线程
+            env_->Schedule(&DBImpl::BGClean, this, Env::kGarbageCollection);
         }
         else
         {
-            env_->StartThread(&DBImpl::BGCleanAll, this);
+            env_->Schedule(&DBImpl::BGCleanAll, this, Env::kGarbageCollection);
         }
     }
+    else if(!pending_rewrites_.empty())
+    {//gc优先，clean线程空闲时才重写扫描多的范围
+        bg_clean_scheduled_ = true;
+        env_->Schedule(&DBImpl::BGRewrite, this, Env::kGarbageCollection);
+    }
+    else if(migrate_check_pending_)
+    {
+        migrate_check_pending_ = false;
+        bg_clean_scheduled_ = true;
+        env_->Schedule(&DBImpl::BGMigrate, this, Env::kGarbageCollection);
+    }
 }
 
 void DBImpl::BGCleanRecover(void* db)
@@ -1651,12 +3043,245 @@ void DBImpl::BGClean(void* db)
     reinterpret_cast<DBImpl*>(db)->BackgroundClean();
 }
 
+void DBImpl::BGManualClean(void* db)
+{
+    reinterpret_cast<DBImpl*>(db)->BackgroundManualClean();
+}
+
+void DBImpl::BGSampleGarbage(void* db)
+{
+    reinterpret_cast<DBImpl*>(db)->BackgroundSampleGarbage();
+}
+
+void DBImpl::BackgroundSampleGarbage()
+{
+    mutex_.Lock();
+    std::set<uint64_t> vlogs = vlog_manager_.GetVlogsToClean(0);//除了当前vlog和cold vlog
+    mutex_.Unlock();
+
+    GarbageSampler sampler(this);
+    for(std::set<uint64_t>::iterator iter = vlogs.begin(); iter != vlogs.end(); ++iter)
+    {
+        if(shutting_down_.Acquire_Load())
+            break;
+        GarbageSampler::Estimate est;
+        Status s = sampler.Sample(*iter, options_.garbage_sample_records, &est);
+        if(!s.ok() || est.records == 0)
+            continue;
+        const uint64_t dead = static_cast<uint64_t>(est.lower * est.entries);
+        mutex_.Lock();
+        Log(options_.info_log, "vlog %llu sampled %llu kvs, garbage ratio %.3f (>= %.3f), "
+            "estimated %llu dead, known %llu\n",
+            static_cast<unsigned long long>(*iter),
+            static_cast<unsigned long long>(est.records), est.ratio, est.lower,
+            static_cast<unsigned long long>(dead),
+            static_cast<unsigned long long>(vlog_manager_.GetDropCount(*iter)));
+        vlog_manager_.SetEstimatedDropCount(*iter, dead);
+        mutex_.Unlock();
+    }
+
+    mutex_.Lock();
+    bg_clean_scheduled_ = false;
+    if(!shutting_down_.Acquire_Load())
+        MaybeScheduleClean();//估计值可能让一些vlog达到了回收阈值
+    bg_cv_.SignalAll();
+    mutex_.Unlock();
+}
+
+void DBImpl::BGRewrite(void* db)
+{
+    reinterpret_cast<DBImpl*>(db)->BackgroundRewrite();
+}
+
+void DBImpl::BackgroundRewrite()
+{
+    mutex_.Lock();
+    std::pair<std::string, std::string> range = pending_rewrites_.front();
+    pending_rewrites_.pop_front();
+    mutex_.Unlock();
+
+    Slice begin(range.first), end(range.second);
+    Status s = RewriteRange(&begin, &end);
+    if(!s.ok())
+        Log(options_.info_log, "rewrite range failed: %s\n", s.ToString().c_str());
+
+    mutex_.Lock();
+    bg_clean_scheduled_ = false;
+    if(CleanWorkPending() && !shutting_down_.Acquire_Load())
+        MaybeScheduleClean();
+    bg_cv_.SignalAll();//CleanVlog可能在等这次clean结束
+    mutex_.Unlock();
+}
+
+void DBImpl::BGMigrate(void* db)
+{
+    reinterpret_cast<DBImpl*>(db)->BackgroundMigrate();
+}
+
+void DBImpl::BackgroundMigrate()
+{
+    std::vector<uint64_t> vlogs;
+    mutex_.Lock();
+    //回放要用的vlog不搬，恢复时它们总在dbname_下
+    vlog_manager_.GetVlogsToMigrate(options_.vlog_cold_read_threshold, versions_->LogNumber(), &vlogs);
+    mutex_.Unlock();
+
+    for(size_t i = 0; i < vlogs.size() && !IsShutDown(); i++)
+    {
+        const int path = static_cast<int>(next_cold_path_++ % options_.vlog_cold_paths.size()) + 1;
+        Status s = MigrateVlog(vlogs[i], path);
+        Log(options_.info_log, "migrate vlog %llu to %s: %s\n",
+            static_cast<unsigned long long>(vlogs[i]),
+            options_.vlog_cold_paths[path - 1].c_str(), s.ToString().c_str());
+        if(!s.ok())
+            break;
+    }
+
+    mutex_.Lock();
+    bg_clean_scheduled_ = false;
+    if(CleanWorkPending() && !shutting_down_.Acquire_Load())
+        MaybeScheduleClean();
+    bg_cv_.SignalAll();
+    mutex_.Unlock();
+}
+
+Status DBImpl::MigrateVlog(uint64_t number, int path)
+{//只在clean线程里做，gc、打洞不会同时动这个vlog，bg_clean_scheduled_也挡住了DeleteObsoleteFiles
+    const std::string& dir = options_.vlog_cold_paths[path - 1];
+    const std::string src = VLogFileName(dbname_, number);
+    const std::string dst = VLogFileName(dir, number);
+    mutex_.Lock();
+    const uint64_t tmp_number = versions_->NewFileNumber();
+    pending_outputs_.insert(tmp_number);
+    mutex_.Unlock();
+    const std::string tmp = TempFileName(dir, tmp_number);
+
+    SequentialFile* in;
+    WritableFile* out;
+    Status s = env_->NewSequentialFile(src, &in);
+    if(s.ok())
+    {
+        s = env_->NewWritableFile(tmp, &out);
+        if(!s.ok())
+            delete in;
+    }
+    //打过的洞读出来全是0，拷贝里照样打掉，不然搬一次洞就被填实了
+    std::vector<std::pair<uint64_t, uint64_t> > holes;
+    if(s.ok())
+    {
+        static const size_t kBlockSize = 4096;
+        static const char kZeros[kBlockSize] = { 0 };
+        const size_t kBufferSize = 1 << 20;
+        char* buf = new char[kBufferSize];
+        Slice chunk;
+        uint64_t offset = 0;
+        while(s.ok() && !IsShutDown())
+        {
+            s = in->Read(kBufferSize, &chunk, buf);
+            if(!s.ok() || chunk.empty())
+                break;
+            for(size_t i = 0; options_.punch_hole_threshold != 0 &&
+                              i + kBlockSize <= chunk.size(); i += kBlockSize)
+            {
+                if(memcmp(chunk.data() + i, kZeros, kBlockSize) != 0)
+                    continue;
+                if(!holes.empty() && holes.back().first + holes.back().second == offset + i)
+                    holes.back().second += kBlockSize;
+                else
+                    holes.push_back(std::make_pair(offset + i, static_cast<uint64_t>(kBlockSize)));
+            }
+            offset += chunk.size();
+            s = out->Append(chunk);
+        }
+        delete[] buf;
+        if(s.ok() && IsShutDown())
+            s = Status::IOError("shutting down during vlog migration");
+        if(s.ok())
+            s = out->Sync();
+        if(s.ok())
+            s = out->Close();
+        delete out;
+        delete in;
+    }
+    if(s.ok() && !holes.empty())
+    {
+        SequentialFile* copy;
+        if(env_->NewSequentialFile(tmp, &copy).ok())
+        {//打不了洞只是多占空间
+            for(size_t i = 0; i < holes.size(); i++)
+                copy->DeallocateDiskSpace(holes[i].first, holes[i].second);
+            delete copy;
+        }
+    }
+    //拷贝完整地落盘之后才能改名，恢复时看到dst就说明拷贝是完整的
+    if(s.ok())
+        s = env_->RenameFile(tmp, dst);
+    if(s.ok())
+        s = env_->SyncDir(dir);
+    if(!s.ok())
+    {
+        env_->DeleteFile(tmp);
+        env_->DeleteFile(dst);
+    }
+
+    mutex_.Lock();
+    pending_outputs_.erase(tmp_number);
+    if(s.ok())
+    {//新位置记进manifest之后才能删原文件，否则崩溃后恢复会把拷贝当成没搬完的删掉
+        VersionEdit edit;
+        edit.SetVlogPath(number, path);
+        s = ApplyEdit(&edit);
+        if(!s.ok())
+            env_->DeleteFile(dst);
+    }
+    if(s.ok())
+    {
+        vlog_manager_.MoveVlog(number, path);
+        vlog_cache_->Evict(number);//旧reader还开着这个文件，正在读的读完之后空间才释放
+        env_->DeleteFile(src);
+    }
+    mutex_.Unlock();
+    return s;
+}
+
+std::string DBImpl::VLogFilePath(uint64_t number)
+{
+    const int path = vlog_manager_.GetPath(number);
+    return VLogFileName(path == 0 ? dbname_ : options_.vlog_cold_paths[path - 1], number);
+}
+
+void DBImpl::PunchHoles()
+{
+    if(options_.punch_hole_threshold == 0)
+        return;
+    std::vector<VlogManager::Hole> holes;
+    mutex_.Lock();
+    vlog_manager_.GetHolesToPunch(options_.punch_hole_threshold, versions_->LogNumber(), &holes);
+    mutex_.Unlock();
+    //打洞和gc都在clean线程里做，gc遍历vlog时不会有新的洞出现
+    uint64_t bytes = 0;
+    for(size_t i = 0; i < holes.size() && !IsShutDown(); i++)
+    {
+        const uint64_t number = holes[i].vlog_numb_;
+        if(vlog_cache_->DeallocateDiskSpace(number, VLogFilePath(number),
+                                            holes[i].offset_, holes[i].len_).ok())
+            bytes += holes[i].len_;
+    }
+    if(!holes.empty())
+        Log(options_.info_log, "punched %llu bytes of holes in vlogs\n",
+            static_cast<unsigned long long>(bytes));
+}
+
 void DBImpl::BackgroundCleanAll()
 {
+    PunchHoles();
     while(vlog_manager_.HasVlogToClean())
     {
+        const uint64_t vlog_numb = vlog_manager_.GetVlogToClean();
+        if(vlog_numb == 0)
+            break;
         GarbageCollector garbager(this);
-        garbager.SetVlog(vlog_manager_.GetVlogToClean());
+        garbager.SetVlog(vlog_numb);
         garbager.BeginGarbageCollect();
         vlog_manager_.RemoveCleaningVlog();
         if(shutting_down_.Acquire_Load() || !bg_error_.ok())
@@ -1668,44 +3293,58 @@ void DBImpl::BackgroundCleanAll()
     {
         if(shutting_down_.Acquire_Load() || !bg_error_.ok())
             break;
+        vlog_manager_.SetCleaningVlog(*iter);
         GarbageCollector garbager(this);
         garbager.SetVlog(*iter);
-        garbager.BeginGarbageCollect();
-        vlog_manager_.RemoveCleaningVlog(*iter);
+        if(garbager.BeginGarbageCollect())
+            vlog_manager_.RemoveCleaningVlog(*iter);
+        else
+            vlog_manager_.SetCleaningVlog(0);
     }
     mutex_.Lock();
     bg_clean_scheduled_ = false;
     has_cleaned_ = true;
+    if(CleanWorkPending() && !shutting_down_.Acquire_Load())
+        MaybeScheduleClean();//等着的手动gc、范围重写或者垃圾抽样
     bg_cv_.SignalAll();//要唤醒cleanvlog
     mutex_.Unlock();
 }
 
 void DBImpl::BackgroundClean()
 {
-    GarbageCollector garbager(this);
-    garbager.SetVlog(vlog_manager_.GetVlogToClean());
-    garbager.BeginGarbageCollect();
-    vlog_manager_.RemoveCleaningVlog();
+    PunchHoles();
+    const uint64_t vlog_numb = vlog_manager_.GetVlogToClean();
+    if(vlog_numb != 0)
+    {
+        GarbageCollector garbager(this);
+        garbager.SetVlog(vlog_numb);
+        garbager.BeginGarbageCollect();
+        vlog_manager_.RemoveCleaningVlog();
+    }
 
     mutex_.Lock();
     bg_clean_scheduled_ = false;
-    if(shutting_down_.Acquire_Load())
-        bg_cv_.SignalAll();
+    if(CleanWorkPending() && !shutting_down_.Acquire_Load())
+        MaybeScheduleClean();//等着的手动gc、范围重写或者垃圾抽样
+    bg_cv_.SignalAll();//CleanVlog可能在等这次clean结束
     mutex_.Unlock();
 }
 
 void DBImpl::BackgroundRecoverClean()
 {
-    std::string val;
-    ReadOptions read_options;
-    Status s = Get(read_options,"tail",&val);
-    if(s.ok())
+    mutex_.Lock();
+    uint64_t vlog_numb = versions_->CleanTailNumber();
+    uint64_t tail = versions_->CleanTailPos();
+    bool exist = vlog_manager_.HasVlog(vlog_numb);
+    mutex_.Unlock();
+    if(vlog_numb != 0 && exist && !vlog_manager_.Recover(vlog_numb))
+    {//手动gc中断留下的，不接着回收，回收位置随下一次manifest更新清掉
+        Log(options_.info_log, "skip resuming clean of vlog %llu below threshold\n",
+            static_cast<unsigned long long>(vlog_numb));
+        SetCleanTail(0, 0);
+    }
+    else if(vlog_numb != 0 && exist)//该vlog可能已经没有任何引用，被直接删掉了
     {
-        uint64_t code = DecodeFixed64(val.data());
-        uint64_t vlog_numb = code & 0xffffff;
-        uint64_t tail = code>>24;
-        vlog_manager_.Recover(vlog_numb);
-
         GarbageCollector garbager(this);
         garbager.SetVlog(vlog_manager_.GetVlogToClean(), tail);
         garbager.BeginGarbageCollect();
@@ -1714,8 +3353,103 @@ void DBImpl::BackgroundRecoverClean()
 
     mutex_.Lock();
     bg_clean_scheduled_ = false;
+    if(CleanWorkPending() && !shutting_down_.Acquire_Load())
+        MaybeScheduleClean();//等着的手动gc、范围重写或者垃圾抽样
+    bg_cv_.SignalAll();//CleanVlog可能在等这次clean结束
+    mutex_.Unlock();
+}
+
+Status DBImpl::StartManualClean(const std::vector<uint64_t>& vlogs,
+                                uint64_t min_garbage,
+                                uint64_t bytes_per_second)
+{
+    MutexLock l(&mutex_);
+    if(manual_clean_.progress.running)
+        return Status::InvalidArgument("manual clean is already running");
     if(shutting_down_.Acquire_Load())
-        bg_cv_.SignalAll();
+        return Status::IOError("Deleting DB during manual clean");
+    if(!bg_error_.ok())
+        return bg_error_;
+    manual_clean_.vlogs = vlogs;
+    manual_clean_.min_garbage = min_garbage;
+    manual_clean_.bytes_per_second = bytes_per_second;
+    manual_clean_.progress = ManualCleanProgress();
+    manual_clean_.progress.running = true;
+    manual_clean_.pending = true;
+    manual_clean_cancel_.Release_Store(NULL);
+    MaybeScheduleClean();//clean线程正忙的话，等它结束后再开始
+    return Status::OK();
+}
+
+void DBImpl::CancelManualClean()
+{
+    MutexLock l(&mutex_);
+    manual_clean_cancel_.Release_Store(this);
+    if(manual_clean_.pending)
+    {//还没开始
+        manual_clean_.pending = false;
+        manual_clean_.progress.running = false;
+    }
+}
+
+void DBImpl::GetManualCleanProgress(ManualCleanProgress* progress)
+{
+    MutexLock l(&mutex_);
+    *progress = manual_clean_.progress;
+}
+
+void DBImpl::AddManualCleanProgress(uint64_t scanned, uint64_t relocated,
+                                    uint64_t freed)
+{
+    MutexLock l(&mutex_);
+    manual_clean_.progress.bytes_scanned += scanned;
+    manual_clean_.progress.bytes_relocated += relocated;
+    manual_clean_.progress.bytes_freed += freed;
+}
+
+void DBImpl::BackgroundManualClean()
+{
+    mutex_.Lock();
+    std::vector<uint64_t> vlogs = manual_clean_.vlogs;
+    if(vlogs.empty())
+    {
+        std::set<uint64_t> to_clean = vlog_manager_.GetVlogsToClean(manual_clean_.min_garbage);
+        vlogs.assign(to_clean.begin(), to_clean.end());
+    }
+    const uint64_t bytes_per_second = manual_clean_.bytes_per_second;
+    manual_clean_.progress.vlogs_total = vlogs.size();
+    mutex_.Unlock();
+
+    for(size_t i = 0; i < vlogs.size(); i++)
+    {
+        mutex_.Lock();
+        bool stop = shutting_down_.Acquire_Load() || !bg_error_.ok() || IsManualCleanCancelled();
+        bool can_clean = vlog_manager_.CanClean(vlogs[i]);
+        mutex_.Unlock();
+        if(stop)
+            break;
+        if(can_clean)//当前vlog、cold vlog以及已经删掉的vlog跳过
+        {
+            vlog_manager_.SetCleaningVlog(vlogs[i]);
+            GarbageCollector garbager(this);
+            garbager.SetVlog(vlogs[i]);
+            garbager.SetManual(bytes_per_second);
+            if(garbager.BeginGarbageCollect())
+                vlog_manager_.RemoveCleaningVlog(vlogs[i]);
+            else
+                vlog_manager_.SetCleaningVlog(0);
+        }
+        mutex_.Lock();
+        manual_clean_.progress.vlogs_done++;
+        mutex_.Unlock();
+    }
+
+    mutex_.Lock();
+    manual_clean_.progress.running = false;
+    bg_clean_scheduled_ = false;
+    if(CleanWorkPending() && !shutting_down_.Acquire_Load())
+        MaybeScheduleClean();//等着的范围重写或者垃圾抽样
+    bg_cv_.SignalAll();
     mutex_.Unlock();
 }
 
@@ -1781,6 +3515,20 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
              static_cast<unsigned long long>(total_usage));
     value->append(buf);
     return true;
+  } else if (in == "manual-clean") {
+    const ManualCleanProgress& p = manual_clean_.progress;
+    char buf[200];
+    snprintf(buf, sizeof(buf),
+             "running: %d\nvlogs: %llu/%llu\nscanned: %llu\n"
+             "relocated: %llu\nfreed: %llu\n",
+             p.running ? 1 : 0,
+             static_cast<unsigned long long>(p.vlogs_done),
+             static_cast<unsigned long long>(p.vlogs_total),
+             static_cast<unsigned long long>(p.bytes_scanned),
+             static_cast<unsigned long long>(p.bytes_relocated),
+             static_cast<unsigned long long>(p.bytes_freed));
+    value->append(buf);
+    return true;
   }
 
   return false;
@@ -1833,6 +3581,14 @@ Status DB::Open(const Options& options, const std::string& dbname,
   *dbptr = NULL;
 
   DBImpl* impl = new DBImpl(options, dbname);
+  Env* env = impl->env_;
+  env->SetBackgroundThreads(options.background_flush_threads, Env::kFlush);
+  env->SetBackgroundThreads(options.background_compaction_threads,
+                            Env::kL0Compaction);
+  env->SetBackgroundThreads(options.background_compaction_threads,
+                            Env::kCompaction);
+  env->SetBackgroundThreads(options.background_gc_threads,
+                            Env::kGarbageCollection);
   impl->mutex_.Lock();
   VersionEdit edit;
   // Recover handles create_if_missing, error_if_exists
@@ -1842,8 +3598,7 @@ Status DB::Open(const Options& options, const std::string& dbname,
     // Create new log and a corresponding memtable.
     uint64_t new_log_number = impl->versions_->NewVlogNumber();
     WritableFile* lfile;
-    s = options.env->NewWritableFile(VLogFileName(dbname, new_log_number),
-                                     &lfile);
+    s = impl->NewVlogFile(new_log_number, &lfile);
     if (s.ok()) {
       edit.SetLogNumber(new_log_number);
       impl->vlogfile_ = lfile;
@@ -1851,30 +3606,49 @@ Status DB::Open(const Options& options, const std::string& dbname,
       impl->vlog_ = new log::VWriter(lfile);
       impl->mem_ = new MemTable(impl->internal_comparator_);
       impl->mem_->Ref();
-      SequentialFile* vlr_file;
-      s = impl->options_.env->NewSequentialFile(VLogFileName(impl->dbname_, new_log_number), &vlr_file);
-      log::VReader* vlog_reader = new log::VReader(vlr_file, true,0);
-      impl->vlog_manager_.AddVlog(new_log_number, vlog_reader);
+      impl->vlog_manager_.AddVlog(new_log_number);
       Log(impl->options_.info_log,"newdb\n");
     }
   }
   if (s.ok() && save_manifest) {
     edit.SetLogNumber(impl->logfile_number_);
-    s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
+    s = impl->ApplyEdit(&edit);
   }
   if (s.ok()) {
-        impl->mutex_.Unlock();
-        std::string val;
-        ReadOptions read_options;
-        s = impl->Get(read_options,"vloginfo",&val);
-        if(s.ok())
+    // Must be complete before GC or compaction may consult or update it
+    s = impl->BuildKeyIndex();
+  }
+  if (s.ok() && impl->legacy_checkpoint_) {
+    s = impl->MigrateLegacyCheckpoint();
+  }
+  std::string vloginfo;
+  if (s.ok()) {
+    vloginfo = impl->versions_->VlogInfo();
+    if (!vloginfo.empty()) {
+      impl->vlog_manager_.Deserialize(vloginfo);
+    }
+    if (!vloginfo.empty() && VlogManager::IsLegacyFormat(vloginfo)) {
+      //旧格式的vlog编号只有16位，马上换成新格式，之后就不再写旧格式了
+      std::string upgraded;
+      impl->vlog_manager_.Serialize(upgraded);
+      VersionEdit info_edit;
+      info_edit.SetVlogInfo(upgraded);
+      s = impl->ApplyEdit(&info_edit);
+    }
+  }
+  if (s.ok()) {
+    impl->InstallReadView();
+        if(!vloginfo.empty())
         {
-            impl->vlog_manager_.Deserialize(val);
             impl->bg_clean_scheduled_ = true;
-            impl->env_->StartThread(&DBImpl::BGCleanRecover, impl);
+            impl->env_->Schedule(&DBImpl::BGCleanRecover, impl,
+                                 Env::kGarbageCollection);
+        }
+        if(options.garbage_sample_records > 0)
+        {//恢复gc正在跑的话等它结束再抽样
+            impl->garbage_sample_pending_ = true;
+            impl->MaybeScheduleClean();
         }
-        impl->mutex_.Lock();
-       s=Status::OK();
     impl->DeleteObsoleteFiles();
     impl->MaybeScheduleCompaction();
   }
@@ -1915,6 +3689,20 @@ Status DestroyDB(const std::string& dbname, const Options& options) {
         }
       }
     }
+    for (size_t p = 0; p < options.vlog_cold_paths.size(); p++) {
+      const std::string& dir = options.vlog_cold_paths[p];
+      std::vector<std::string> cold_files;
+      env->GetChildren(dir, &cold_files);
+      for (size_t i = 0; i < cold_files.size(); i++) {
+        if (ParseFileName(cold_files[i], &number, &type) &&
+            (type == kVLogFile || type == kTempFile)) {
+          Status del = env->DeleteFile(dir + "/" + cold_files[i]);
+          if (result.ok() && !del.ok()) {
+            result = del;
+          }
+        }
+      }
+    }
     env->UnlockFile(lock);  // Ignore error since state is already gone
     env->DeleteFile(lockname);
     env->DeleteDir(dbname);  // Ignore error in case dir contains other files
@@ -6,8 +6,12 @@
 #define STORAGE_LEVELDB_DB_DB_IMPL_H_
 
 #include <deque>
+#include <map>
 #include <set>
+#include <vector>
 #include "db/dbformat.h"
+#include "db/ptr_cache.h"
+#include "db/read_view.h"
 #include "db/log_writer.h"//可以去掉
 #include "db/vlog_writer.h"
 #include "db/vlog_reader.h"
@@ -16,6 +20,7 @@
 #include "leveldb/env.h"
 #include "port/port.h"
 #include "port/thread_annotations.h"
+#include "db/vlog_key_index.h"
 #include "db/vlog_manager.h"
 
 namespace leveldb {
@@ -26,6 +31,8 @@ class Version;
 class VersionEdit;
 class VersionSet;
 class GarbageCollector;
+class VlogCache;
+class VlogReplayer;
 
 class DBImpl : public DB {
  public:
@@ -54,6 +61,30 @@ class DBImpl : public DB {
   Status RealValue(Slice val_ptr, std::string* value);//因为从sst文件和memtable获得的v只是vlog的索引
   //需要从vlog文件读出索引位置处的value值,val_ptr是索引，value是存放真正v的
 
+  // Vlog bytes buffered by one iterator.  Once consecutive values turn
+  // out to be adjacent in the same vlog (e.g. after RewriteRange) they
+  // are served from one large read instead of one read per value.
+  struct ScanReadahead {
+    uint64_t file_numb;  // vlog of data, 0 if nothing read yet
+    uint64_t pos;        // vlog offset of data[0]
+    std::string data;
+    uint64_t last_end;   // end of the previous value, detects sequential reads
+    ScanReadahead() : file_numb(0), pos(0), last_end(0) { }
+  };
+  // Expiration is checked against now_seconds, the time the iterator was
+  // created, so a value it stopped on is never expired under it.
+  Status RealValue(Slice val_ptr, std::string* value, ScanReadahead* ra,
+                   uint64_t now_seconds);
+
+  // Rewrite the live values of the user keys in [*begin,*end] into a
+  // new cold vlog in key order, so that scans over the range read the
+  // vlog sequentially.  begin==NULL is treated as a key before all keys
+  // and end==NULL as a key after all keys.  Runs in the calling thread.
+  Status RewriteRange(const Slice* begin, const Slice* end);
+
+  // Wall clock used for TTL expirations.
+  uint64_t NowSeconds() { return env_->NowMicros() / 1000000; }
+
   // Extra methods (for testing) that are not in the public DB interface
 
   // Compact any files in the named level that overlap [*begin,*end]
@@ -62,6 +93,9 @@ class DBImpl : public DB {
   // Force current memtable contents to be compacted.
   Status TEST_CompactMemTable();
 
+  // Seal the current vlog, later writes go to a new one.
+  Status TEST_RollVlog();
+
   // Return an internal iterator over the current state of the database.
   // The keys of this iterator are internal keys (see format.h).
   // The returned iterator should be deleted when no longer needed.
@@ -77,6 +111,31 @@ class DBImpl : public DB {
   void RecordReadSample(Slice key);
   void CleanVlog();
   bool has_cleaned_;
+
+  // Progress of the GC started by StartManualClean().
+  struct ManualCleanProgress {
+    bool running;
+    uint64_t vlogs_total;
+    uint64_t vlogs_done;
+    uint64_t bytes_scanned;    // vlog bytes read by GC
+    uint64_t bytes_relocated;  // live values rewritten to cold vlogs
+    uint64_t bytes_freed;      // size of the vlogs deleted
+    ManualCleanProgress()
+        : running(false), vlogs_total(0), vlogs_done(0),
+          bytes_scanned(0), bytes_relocated(0), bytes_freed(0) { }
+  };
+
+  // Clean "vlogs" on the clean thread and return at once.  An empty
+  // "vlogs" picks every vlog with at least "min_garbage" dropped records.
+  // GC reads at most "bytes_per_second" of vlog, 0 means no limit.  If
+  // an automatic clean is running the manual one starts after it.
+  // Progress is also reported by the "leveldb.manual-clean" property.
+  Status StartManualClean(const std::vector<uint64_t>& vlogs,
+                          uint64_t min_garbage, uint64_t bytes_per_second);
+  // Stop the manual clean at the next vlog record.  The vlog being
+  // cleaned is kept; values already relocated stay relocated.
+  void CancelManualClean();
+  void GetManualCleanProgress(ManualCleanProgress* progress);
   void MaybeScheduleClean(bool isManualClean = false);
   bool IsShutDown()
   {
@@ -85,6 +144,7 @@ class DBImpl : public DB {
  private:
   friend class DB;
   friend class GarbageCollector;
+  friend class GarbageSampler;
   struct CompactionState;
   struct Writer;
 
@@ -109,10 +169,31 @@ class DBImpl : public DB {
   // log-file/memtable and writes a new descriptor iff successful.
   // Errors are recorded in bg_error_.
   void CompactMemTable() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Flushes and compactions run concurrently.  Picking a compaction and
+  // installing a version edit happen between BeginInstall() and
+  // EndInstall(), so no one picks from or applies onto a version that is
+  // about to be replaced: LogAndApply() releases mutex_ while it writes
+  // the MANIFEST.
+  void BeginInstall() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void EndInstall() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // versions_->LogAndApply() between BeginInstall() and EndInstall()
+  Status ApplyEdit(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status RecoverVlogFile(bool* save_manifest, VersionEdit* edit, SequenceNumber* max_sequence);
-  //数据库恢复是靠vlog文件恢复
-  Status RecoverLogFile(uint64_t log_number, bool last_log, bool* save_manifest,
-                        VersionEdit* edit, SequenceNumber* max_sequence)
+  //打开数据库时扫描lsm，建立每个key最新指针的索引
+  Status BuildKeyIndex() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  //老版本把重启点、gc回收位置和vloginfo存成用户key "head"、"tail"、"vloginfo"。
+  //Recover从sst里读出head，这里把tail和vloginfo搬进manifest，再删掉这三个key
+  Status MigrateLegacyCheckpoint() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  //加载gc留下的转发文件，被转发的vlog还在时截掉回收位置之后没有落盘保证的转发
+  Status RecoverForwards(const std::vector<uint64_t>& numbers)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  //数据库恢复是靠vlog文件恢复，记录从replayer的第index个vlog取，
+  //*mem是前面的vlog回放剩下还没刷到sst的memtable
+  Status RecoverLogFile(VlogReplayer* replayer, size_t index,
+                        uint64_t log_number, bool last_log, bool* save_manifest,
+                        VersionEdit* edit, SequenceNumber* max_sequence,
+                        MemTable** mem)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
@@ -120,20 +201,124 @@ class DBImpl : public DB {
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Seal the current vlog and continue writing into a new one.
+  Status RollVlog() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Create the file for new user vlog "number", reusing a recycled vlog
+  // file if there is one.
+  Status NewVlogFile(uint64_t number, WritableFile** result)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Vlog "number" at "fname" is dead.  Keep the file for NewVlogFile if
+  // the pool has room, delete it otherwise.  Returns true if it was kept.
+  bool RecycleVlogFile(uint64_t number, const std::string& fname)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Make sure the current vlog has disk space reserved up to "end".
+  // REQUIRES: the caller is the front writer.
+  void PreallocateVlog(uint64_t end);
+
+  // Force the current memtable to be flushed and wait until it is
+  // installed in the current version.
+  Status FlushMemTable();
+
+  // Called by GC to record where cleaning vlog "vlog_numb" resumes after
+  // a restart.  The position is persisted with the flush of the current
+  // memtable, which holds the pointers GC has relocated so far.  A zero
+  // "vlog_numb" forgets the position.
+  void SetCleanTail(uint64_t vlog_numb, uint64_t pos);
+
+  // Values that survived a GC pass are cold: they are appended to the
+  // current cold vlog instead of being mixed again with fresh user
+  // writes.  The record for "batch" starts at *pos in vlog *file_numb.
+  Status AddColdRecord(const WriteBatch* batch, uint64_t* pos,
+                       uint64_t* file_numb);
+  Status SyncColdVlog();
+  Status NewColdVlog();
+
+  // Copy the value "ptr" refers to into the cold vlog and store a
+  // pointer to the new copy in *new_ptr.  Used by compactions that
+  // relocate values out of vlogs with a lot of garbage.
+  Status RelocateValue(const Slice& key, const Slice& ptr,
+                       std::string* new_ptr);
+
+  // "batch" holds values GC has appended to vlog "file_numb" at offset
+  // "pos".  For every entry, point its key at the new copy, but only if
+  // the key still points at the matching entry of "old_ptrs".
+  Status WriteRelocations(const WriteBatch* batch,
+                          const std::vector<std::string>& old_ptrs,
+                          uint64_t pos, uint64_t file_numb);
   WriteBatch* BuildBatchGroup(Writer** last_writer);
 
+  // Puts of a write with WriteOptions::ttl go to the TTL vlog of their
+  // expiration window, the batch logged in the vlog only references them.
+  Status WriteWithTtl(const WriteOptions& options, WriteBatch* my_batch);
+  Status AddTtlRecord(const WriteBatch* batch, uint64_t expiration, bool sync,
+                      uint64_t* pos, uint64_t* file_numb);
+  struct TtlVlog;
+  Status NewTtlVlog(uint64_t window, TtlVlog* vlog)
+      EXCLUSIVE_LOCKS_REQUIRED(ttl_mutex_);
+  void CloseTtlVlog(TtlVlog* vlog) EXCLUSIVE_LOCKS_REQUIRED(ttl_mutex_);
+  // Syncs the open TTL vlogs written since their last sync.  Called before
+  // every sync of the current vlog, so that a durable reference never
+  // points at a value that is not durable.  REQUIRES: mutex_ not held.
+  Status SyncTtlVlogs();
+
   void RecordBackgroundError(const Status& s);
 
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Publish mem_, imm_ and the current version as the view Get reads
+  // from.  Called whenever one of them changes.
+  void InstallReadView() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Drop the views cached in read_views_, folding their pending seek
+  // stats into the versions they were gathered on.
+  void ScrapeReadViews() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void ApplyReadStats(ReadViewCache::Slot* slot, ReadView* view)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   static void BGWork(void* db);
   void BackgroundCall();
+  static void BGFlushWork(void* db);
+  void BackgroundFlushCall();
   void  BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   static void BGClean(void* db);
   static void BGCleanAll(void* db);
   static void BGCleanRecover(void* db);
+  static void BGManualClean(void* db);
+  static void BGRewrite(void* db);
+  static void BGSampleGarbage(void* db);
+  static void BGMigrate(void* db);
   void BackgroundClean();
   void BackgroundCleanAll();
   void BackgroundRecoverClean();
+  void BackgroundManualClean();
+  void BackgroundRewrite();
+  void BackgroundSampleGarbage();
+  void BackgroundMigrate();
+  // Work queued for the clean thread besides automatic GC.
+  bool CleanWorkPending() const EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return manual_clean_.pending || !pending_rewrites_.empty() ||
+           garbage_sample_pending_ || migrate_check_pending_;
+  }
+  // Copy sealed vlog "number" into options_.vlog_cold_paths[path - 1],
+  // record the new location in the MANIFEST and switch readers over to
+  // the copy.
+  Status MigrateVlog(uint64_t number, int path);
+  // Name of vlog "number" in whichever directory it lives in now.
+  std::string VLogFilePath(uint64_t number);
+  // Count a scan sample against the deepest table holding "key" and
+  // queue the table's key range for RewriteRange once it is hot.
+  void RecordScanSample(Slice key) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status ReadVlogValue(uint64_t file_numb, uint64_t pos, uint64_t size,
+                       std::string* value);
+  // Read up to "size" bytes at "pos" of vlog "file_numb" through
+  // vlog_cache_, opening the vlog on first use.  *n is short only at EOF.
+  Status ReadVlog(uint64_t file_numb, uint64_t pos, size_t size,
+                  char* scratch, size_t* n);
+  // Called by GC on behalf of a manual clean.
+  bool IsManualCleanCancelled() {
+    return manual_clean_cancel_.Acquire_Load() != NULL;
+  }
+  void AddManualCleanProgress(uint64_t scanned, uint64_t relocated,
+                              uint64_t freed);
+  // Free the disk blocks of vlog extents that compactions found dead.
+  void PunchHoles();
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   Status DoCompactionWork(CompactionState* compact)
@@ -155,6 +340,7 @@ class DBImpl : public DB {
 
   // table_cache_ provides its own synchronization
   TableCache* table_cache_;
+  VlogCache* vlog_cache_;//按需打开的vlog reader
 
   // Lock over the persistent DB state.  Non-NULL iff successfully acquired.
   FileLock* db_lock_;
@@ -165,7 +351,9 @@ class DBImpl : public DB {
   port::CondVar bg_cv_;          // Signalled when background work finishes
   MemTable* mem_;
   MemTable* imm_;                // Memtable being compacted
-  port::AtomicPointer has_imm_;  // So bg thread can detect non-NULL imm_
+  ReadView* read_view_;          // mem_, imm_ and current for Get
+  PtrCache* ptr_cache_;          // Latest pointers of hot keys, may be NULL
+  ReadViewCache read_views_;     // Lets Get reuse a view without mutex_
 //  WritableFile* logfile_;
   uint64_t logfile_number_;//当前vlog文件的编号
 //  uint64_t vlogfile_number_;
@@ -173,13 +361,60 @@ class DBImpl : public DB {
   log::VWriter* vlog_; //写vlog的包装类
   WritableFile* vlogfile_;//vlog文件写打开
   uint64_t vlog_head_;//当前vlog文件的偏移写
-  uint64_t check_point_;//当前vlog文件的重启点
-  uint64_t next_check_point_;//当前vlog文件的下一个重启点，check_point_是已经写入到sst文件里
+  uint64_t vlog_allocated_;//当前vlog预分配到的位置，只有写队列的队首会改
+  std::deque<uint64_t> free_vlogs_;//回收完等着重用的vlog文件，编号是原来的vlog编号，见VFreeFileName
+  uint64_t mem_vlog_bytes_;//mem_里的kv在vlog里占的字节数，重启点之后要回放的就是imm和mem的这部分
+  uint64_t imm_head_number_;//imm刷到sst后的重启点，和sst一起写入manifest
+  uint64_t imm_head_pos_;
+  port::Mutex cold_mutex_;//clean线程和合并线程都会写cold vlog，先于mutex_加锁
+  uint64_t cold_vlog_number_;//当前cold vlog的编号，0代表还没有创建
+  log::VWriter* cold_vlog_;//gc以及合并把搬迁的有效kv追加到cold vlog
+  WritableFile* cold_vlogfile_;
+  uint64_t cold_vlog_size_;
+  //只被memtable、imm或者正在进行的合并引用的cold vlog，sst里的引用见FileMetaData::vlog_refs
+  std::set<uint64_t> mem_cold_vlogs_;
+  std::set<uint64_t> imm_cold_vlogs_;
+  std::set<uint64_t> compaction_cold_vlogs_;
+  port::Mutex ttl_mutex_;//保护ttl_vlogs_，先于mutex_加锁
+  struct TtlVlog {
+    uint64_t number;
+    WritableFile* file;
+    log::VWriter* writer;
+    uint64_t size;
+    bool dirty;//上次sync之后又写过
+  };
+  std::map<uint64_t, TtlVlog> ttl_vlogs_;//过期窗口 -> 正在写的ttl vlog
+  std::set<uint64_t> open_ttl_vlogs_;//正在写的ttl vlog编号，受mutex_保护
   uint64_t drop_count_;//合并产生了多少条垃圾记录，这些新产生的信息还没有持久化到sst文件
   VlogManager vlog_manager_;
-  std::string vloginfo_;
-  uint64_t vloginfo_file_number_;
-  uint64_t vloginfo_pos_;
+  VlogKeyIndex* key_index_;//options.key_index_partitions为0时是NULL
+  //gc的回收位置，和它之前搬迁的指针所在的memtable一起写入manifest
+  struct CleanTail {
+    bool valid;
+    uint64_t number;
+    uint64_t pos;
+    CleanTail() : valid(false), number(0), pos(0) { }
+  };
+  CleanTail mem_clean_tail_;
+  CleanTail imm_clean_tail_;
+  //StartManualClean的参数，pending表示还在等clean线程空出来
+  struct ManualClean {
+    bool pending;
+    std::vector<uint64_t> vlogs;
+    uint64_t min_garbage;
+    uint64_t bytes_per_second;
+    ManualCleanProgress progress;
+    ManualClean() : pending(false), min_garbage(0), bytes_per_second(0) { }
+  };
+  ManualClean manual_clean_;
+  port::AtomicPointer manual_clean_cancel_;
+  //options.scan_rewrite_samples打开时，每个sst被扫描采样的次数，以及等着clean线程重写的key范围
+  std::map<uint64_t, int> scan_samples_;
+  std::deque<std::pair<std::string, std::string> > pending_rewrites_;
+  bool garbage_sample_pending_;//打开数据库后还没有抽样估计各个vlog的垃圾数
+  bool legacy_checkpoint_;//Recover发现了老版本存在用户key里的重启点，Open要迁移
+  bool migrate_check_pending_;//换了新vlog，该检查有没有读得少的vlog要搬到冷存储目录了
+  size_t next_cold_path_;//冷存储目录轮流用，只有clean线程访问
 //  log::VReader* vlog_reader_;//读vlog的包装类
 //  SequentialFile* vlog_reader_file_;//vlog文件读打开
   uint32_t seed_;                // For sampling.
@@ -196,6 +431,12 @@ class DBImpl : public DB {
 
   // Has a background compaction been scheduled or is running?
   bool bg_compaction_scheduled_;
+  // Has a memtable flush been scheduled or is running?  It runs on its
+  // own thread, alongside a compaction.
+  bool bg_flush_scheduled_;
+  // Held, with mutex_ released at times, by whoever picks a compaction
+  // or installs a new version; see BeginInstall().
+  bool installing_;
   bool bg_clean_scheduled_;
   // Information for a manual compaction
   struct ManualCompaction {
@@ -57,7 +57,8 @@ class DBIter: public Iterator {
         direction_(kForward),
         valid_(false),
         rnd_(seed),
-        bytes_counter_(RandomPeriod()) {
+        bytes_counter_(RandomPeriod()),
+        now_seconds_(db->NowSeconds()) {
   }
   virtual ~DBIter() {
     delete iter_;
@@ -72,12 +73,14 @@ class DBIter: public Iterator {
         saved_real_value_.clear();
     if(direction_ == kForward)
     {
-        status_ = db_->RealValue(iter_->value(), &saved_real_value_);
-    }//还需要改进，效率太低
+        status_ = db_->RealValue(iter_->value(), &saved_real_value_, &readahead_,
+                                 now_seconds_);
+    }//相邻的值在vlog里也相邻时从readahead_里取，否则每个值读一次vlog
     else
     {
-        status_ = db_->RealValue(saved_value_, &saved_real_value_);
-    }
+        status_ = db_->RealValue(saved_value_, &saved_real_value_, &readahead_,
+                                 now_seconds_);
+    }//过期按创建迭代器的时间算，停在这里的值不会读的时候才过期，ttl vlog删除前还有宽限期
     return saved_real_value_;
   }
   virtual Status status() const {
@@ -126,11 +129,13 @@ class DBIter: public Iterator {
   std::string saved_key_;     // == current key when direction_==kReverse
   std::string saved_value_;   // == current raw value when direction_==kReverse
   mutable std::string saved_real_value_;//用来存放当前iter对应的真实value，saved_value_仅仅是索引
+  mutable DBImpl::ScanReadahead readahead_;
   Direction direction_;
   bool valid_;
 
   Random rnd_;
   ssize_t bytes_counter_;
+  const uint64_t now_seconds_;  // Values expired at creation are hidden
 
   // No copying allowed
   DBIter(const DBIter&);
@@ -178,12 +183,6 @@ void DBIter::Next() {
   }
 
   FindNextUserEntry(true, &saved_key_);
-  //过滤掉head为key的kv对，因为它不是用户创建的，是我们用来进行恢复的有关vlog的信息
-  while(iter_->Valid() && (key().ToString() == "head" || key().ToString() == "vloginfo"))
-  {
-    SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
-    FindNextUserEntry(true, &saved_key_);
-  }
 }
 
 void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
@@ -204,6 +203,10 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
           if (skipping &&
               user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
             // Entry hidden
+          } else if (ValuePtrExpired(iter_->value(), now_seconds_)) {
+            // An expired value hides older entries like a deletion
+            SaveKey(ikey.user_key, skip);
+            skipping = true;
           } else {
             valid_ = true;
             saved_key_.clear();
@@ -242,11 +245,6 @@ void DBIter::Prev() {
     direction_ = kReverse;
   }
   FindPrevUserEntry();
-  //过滤掉head为key的kv对，因为它不是用户创建的，是我们用来进行恢复的有关vlog的信息
-  while(iter_->Valid() && (key().ToString() == "head" || key().ToString() == "vloginfo"))
-  {
-    FindPrevUserEntry();
-  }
 }
 
 void DBIter::FindPrevUserEntry() {
@@ -263,6 +261,10 @@ void DBIter::FindPrevUserEntry() {
           break;
         }
         value_type = ikey.type;
+        if (value_type == kTypeValue &&
+            ValuePtrExpired(iter_->value(), now_seconds_)) {
+          value_type = kTypeDeletion;  // Expired values read as deletions
+        }
         if (value_type == kTypeDeletion) {
           saved_key_.clear();
           ClearSavedValue();
@@ -300,11 +302,6 @@ void DBIter::Seek(const Slice& target) {
   iter_->Seek(saved_key_);
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
-   // if((iter_->Valid() && key().ToString() == "head"))
-    if(iter_->Valid() && (key().ToString() == "head" || key().ToString() == "vloginfo"))
-    {
-        Next();
-    }
   } else {
     valid_ = false;
   }
@@ -316,11 +313,6 @@ void DBIter::SeekToFirst() {
   iter_->SeekToFirst();
   if (iter_->Valid()) {
     FindNextUserEntry(false, &saved_key_ /* temporary storage */);
-   // if((iter_->Valid() && key().ToString() == "head"))
-    if(iter_->Valid() && (key().ToString() == "head" || key().ToString() == "vloginfo"))
-    {
-        Next();
-    }
   } else {
     valid_ = false;
   }
@@ -331,11 +323,6 @@ void DBIter::SeekToLast() {
   ClearSavedValue();
   iter_->SeekToLast();
   FindPrevUserEntry();
-   // if((iter_->Valid() && key().ToString() == "head"))
-    if(iter_->Valid() && (key().ToString() == "head" || key().ToString() == "vloginfo"))
-    {
-        Prev();
-    }
 }
 
 }  // anonymous namespace
@@ -6,17 +6,21 @@
 #include "leveldb/filter_policy.h"
 #include "db/db_impl.h"
 #include "db/filename.h"
+#include "db/garbage_sampler.h"
+#include "db/table_cache.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
 #include "leveldb/cache.h"
 #include "leveldb/env.h"
 #include "leveldb/table.h"
+#include "leveldb/table_builder.h"
 #include "util/hash.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
 #include "util/testharness.h"
 #include "util/testutil.h"
 #include "unistd.h"
+#include <sys/stat.h>
 #include <iostream>
 namespace leveldb {
 
@@ -76,17 +80,39 @@ class SpecialEnv : public EnvWrapper {
   // Force write to manifest files to fail while this pointer is non-NULL
   port::AtomicPointer manifest_write_error_;
 
+  // The next table file created waits in NewWritableFile() while this
+  // pointer is non-NULL; table_creation_blocked_ is set once it waits.
+  port::AtomicPointer block_table_creation_;
+  port::AtomicPointer table_creation_blocked_;
+
+  // Opening the vlog named by the std::string this points to waits in
+  // NewSequentialFile() while it is non-NULL; vlog_open_blocked_ is set
+  // once it waits.
+  port::AtomicPointer block_vlog_open_;
+  port::AtomicPointer vlog_open_blocked_;
+
   bool count_random_reads_;
   AtomicCounter random_read_counter_;
 
+  // Number of vlog files opened with NewSequentialFile.
+  AtomicCounter vlog_open_counter_;
+
+  // Added to the wall clock, lets tests expire TTL values.
+  uint64_t now_offset_micros_;
+
   explicit SpecialEnv(Env* base) : EnvWrapper(base) {
     delay_data_sync_.Release_Store(NULL);
     data_sync_error_.Release_Store(NULL);
     no_space_.Release_Store(NULL);
     non_writable_.Release_Store(NULL);
     count_random_reads_ = false;
+    now_offset_micros_ = 0;
     manifest_sync_error_.Release_Store(NULL);
     manifest_write_error_.Release_Store(NULL);
+    block_table_creation_.Release_Store(NULL);
+    table_creation_blocked_.Release_Store(NULL);
+    block_vlog_open_.Release_Store(NULL);
+    vlog_open_blocked_.Release_Store(NULL);
   }
 
   Status NewWritableFile(const std::string& f, WritableFile** r) {
@@ -149,6 +175,14 @@ class SpecialEnv : public EnvWrapper {
     if (non_writable_.Acquire_Load() != NULL) {
       return Status::IOError("simulated write error");
     }
+    if (strstr(f.c_str(), ".ldb") != NULL &&
+        block_table_creation_.Acquire_Load() != NULL &&
+        table_creation_blocked_.Acquire_Load() == NULL) {
+      table_creation_blocked_.Release_Store(this);
+      while (block_table_creation_.Acquire_Load() != NULL) {
+        DelayMilliseconds(10);
+      }
+    }
 
     Status s = target()->NewWritableFile(f, r);
     if (s.ok()) {
@@ -231,6 +265,26 @@ class SpecialEnv : public EnvWrapper {
     }
     return s;
   }
+
+  Status NewSequentialFile(const std::string& f, SequentialFile** r) {
+    if (strstr(f.c_str(), ".vlog") != NULL) {
+      vlog_open_counter_.Increment();
+    }
+    const std::string* blocked =
+        reinterpret_cast<const std::string*>(block_vlog_open_.Acquire_Load());
+    if (blocked != NULL && *blocked == f &&
+        vlog_open_blocked_.Acquire_Load() == NULL) {
+      vlog_open_blocked_.Release_Store(this);
+      while (block_vlog_open_.Acquire_Load() != NULL) {
+        DelayMilliseconds(10);
+      }
+    }
+    return target()->NewSequentialFile(f, r);
+  }
+
+  uint64_t NowMicros() {
+    return target()->NowMicros() + now_offset_micros_;
+  }
 };
 
 class DBTest {
@@ -243,6 +297,7 @@ class DBTest {
     kReuse,
     kFilter,
     kUncompressed,
+    kPtrCache,
     kEnd
   };
   int option_config_;
@@ -296,6 +351,9 @@ class DBTest {
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kPtrCache:
+        options.ptr_cache_size = 1 << 20;
+        break;
       default:
         break;
     }
@@ -365,8 +423,6 @@ class DBTest {
     std::string result;
     Iterator* iter = db_->NewIterator(ReadOptions());
     for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
-    if(iter->key().ToString() == "head" || iter->key().ToString() == "vloginfo")//head kv对不是用户创建的，需要跳过
-        continue;
       std::string s = IterStatus(iter);
       result.push_back('(');
       result.append(s);
@@ -377,8 +433,6 @@ class DBTest {
     // Check reverse iteration results are the reverse of forward results
     size_t matched = 0;
     for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
-    if(iter->key().ToString() == "head"|| iter->key().ToString() == "vloginfo")//跳过head kv
-        continue;
       ASSERT_LT(matched, forward.size());
       ASSERT_EQ(IterStatus(iter), forward[forward.size() - matched - 1]);
       matched++;
@@ -584,14 +638,13 @@ TEST(DBTest,garbageAll)
     dbfull()->TEST_CompactMemTable();//sst1(2层)
     std::string big(100000,'1');
     ASSERT_OK(Put(big, "11"));
-    ASSERT_OK(Put("foo", "v2"));//会生成log2，同时还生成sst2(只含big以及head，它们写在log1里)(1层)
-    dbfull()->TEST_CompactMemTable();//生成sst3(0层),包含foo和head
-    dbfull()->TEST_CompactRange(1, NULL, NULL);//导致1和2层合并，无冲突
+    ASSERT_OK(Put("foo", "v2"));//会生成log2，同时还生成sst2(只含big，写在log1里)(2层)
+    dbfull()->TEST_CompactMemTable();//生成sst3(1层),包含foo
+    dbfull()->TEST_CompactRange(1, NULL, NULL);//导致1和2层合并
     ASSERT_OK(Put(big, "22"));
-    ASSERT_OK(Put("foo", "v3"));//生成log3，同时还生成sst2(只含big以及head，它们写在log2里)(0层)
-    dbfull()->TEST_CompactMemTable();//生成sst4(0层)，包含foo和head
-    ASSERT_EQ(NumTableFilesAtLevel(0), 3);
-    ASSERT_EQ(NumTableFilesAtLevel(1), 0);
+    ASSERT_OK(Put("foo", "v3"));//生成log3，同时还生成只含big的sst，写在log2里
+    dbfull()->TEST_CompactMemTable();//生成包含foo的sst
+    ASSERT_EQ("0,2,2", FilesPerLevel());
    dbfull()->CleanVlog();//log文件都没有冲突的垃圾记录
 }
 
@@ -609,14 +662,13 @@ TEST(DBTest,garbageAll1)
     dbfull()->TEST_CompactMemTable();//sst1(2层)
     std::string big(100000,'1');
     ASSERT_OK(Put(big, "11"));
-    ASSERT_OK(Put("foo", "v2"));//会生成log2，同时还生成sst2(只含big以及head，它们写在log1里)(1层)
-    dbfull()->TEST_CompactMemTable();//生成sst3(0层),包含foo和head
-    dbfull()->TEST_CompactRange(1, NULL, NULL);//导致1和2层合并，无冲突
+    ASSERT_OK(Put("foo", "v2"));//会生成log2，同时还生成sst2(只含big，写在log1里)(2层)
+    dbfull()->TEST_CompactMemTable();//生成sst3(1层),包含foo
+    dbfull()->TEST_CompactRange(1, NULL, NULL);//导致1和2层合并
     ASSERT_OK(Put(big, "22"));
-    ASSERT_OK(Put("foo", "v3"));//生成log3，同时还生成sst2(只含big以及head，它们写在log2里)(0层)
-    dbfull()->TEST_CompactMemTable();//生成sst4(0层)，包含foo和head
-    ASSERT_EQ(NumTableFilesAtLevel(0), 3);
-    ASSERT_EQ(NumTableFilesAtLevel(1), 0);
+    ASSERT_OK(Put("foo", "v3"));//生成log3，同时还生成只含big的sst，写在log2里
+    dbfull()->TEST_CompactMemTable();//生成包含foo的sst
+    ASSERT_EQ("0,2,2", FilesPerLevel());
     dbfull()->TEST_CompactRange(0, NULL, NULL);//导致1和0层合并，冲突,log2的foo失效
     dbfull()->TEST_CompactRange(1, NULL, NULL);//导致1和0层合并，冲突,log1的foo和big失效
    dbfull()->CleanVlog();
@@ -639,18 +691,19 @@ TEST(DBTest,garbage)
     ASSERT_OK(Put("bar", "b2"));
     dbfull()->TEST_CompactMemTable();//生成sst在第一层
     dbfull()->TEST_CompactRange(1, NULL, NULL);//导致1和2层合并，不会触发垃圾回收，因为是当前vlog
-    //合并后生成的vloginfo在mem中
-    ASSERT_EQ(NumTableFilesAtLevel(0), 0);
-Reopen(&options);//测试重新打开时恢复vloginfo信息,vloginfo在reopen前是在mem中，所以会生成新的sst
-    ASSERT_EQ(NumTableFilesAtLevel(0), 1);
+    //合并后生成的vloginfo已经写入manifest
+    ASSERT_EQ("0,0,1", FilesPerLevel());
+Reopen(&options);//测试重新打开时从manifest恢复vloginfo信息
+    ASSERT_EQ("0,0,1", FilesPerLevel());
     std::string big(100000,'1');
     ASSERT_OK(Put(big, "11"));
     ASSERT_OK(Put("bar", "b3"));//生成新的vlog,同时也会生成sst，bar/b3不会在新生成的sst中
     DelayMilliseconds(1000);
-    ASSERT_EQ(NumTableFilesAtLevel(0), 2);//第一层的文件就是big/11以及head  和vloginfo和head
-    dbfull()->TEST_CompactRange(0, NULL, NULL);//导致1和0层合并,没有drop，所以不会put vloginfo
+    ASSERT_EQ("0,0,2", FilesPerLevel());//新的文件就是big/11
+    dbfull()->TEST_CompactRange(0, NULL, NULL);
     dbfull()->TEST_CompactMemTable();//刷bar/v3,生成sst，在第1层
-    ASSERT_EQ(NumTableFilesAtLevel(0), 1);
+    //bar只和第2层重叠，刷下去的sst放在第1层
+    ASSERT_EQ("0,1,2", FilesPerLevel());
     dbfull()->TEST_CompactRange(0, NULL, NULL);//导致1和0层合并
     dbfull()->TEST_CompactRange(1, NULL, NULL);//导致1和2层合并，会触发垃圾回收
     ASSERT_OK(Put("a", "va"));//为了检验一边垃圾回收的同时也能一边插入
@@ -741,11 +794,11 @@ TEST(DBTest,garbage1)
     ASSERT_OK(Put(big, "11"));
     ASSERT_OK(Put("bar", "b3"));//生成新的vlog,同时也会生成sst，bar/b3不会在新生成的sst中
     DelayMilliseconds(1000);
-    ASSERT_EQ(NumTableFilesAtLevel(1), 1);//第一层的文件就是big/11以及head
+    ASSERT_EQ(NumTableFilesAtLevel(2), 2);//和2层没有重叠的big/11直接放到第2层
     ASSERT_OK(Delete(big));
-    dbfull()->TEST_CompactRange(1, NULL, NULL);//导致1和2层合并，不会触发垃圾回收
+    dbfull()->TEST_CompactRange(1, NULL, NULL);//1层为空，什么都不做
     ASSERT_EQ(NumTableFilesAtLevel(1), 0);
-    ASSERT_EQ(NumTableFilesAtLevel(2), 1);
+    ASSERT_EQ(NumTableFilesAtLevel(2), 2);
     dbfull()->TEST_CompactMemTable();//刷bar/v3 del big,生成sst，在第1层
     dbfull()->TEST_CompactRange(1, NULL, NULL);//导致1和2层合并，会触发垃圾回收
     ASSERT_EQ("v3", Get("foo"));
@@ -758,26 +811,1210 @@ TEST(DBTest,garbage1)
     ASSERT_EQ("NOT_FOUND", Get("big"));
     ASSERT_EQ("b3", Get("bar"));
     ASSERT_OK(Put("a", "va3"));
-    dbfull()->TEST_CompactMemTable();//生成sst在第一层
-    ASSERT_EQ(NumTableFilesAtLevel(1), 1);
+    dbfull()->TEST_CompactMemTable();//生成sst,后台gc可能同时在刷mem，不检查所在的层
     dbfull()->TEST_CompactRange(1, NULL, NULL);//导致1和2层合并，不会触发垃圾回收
     ASSERT_EQ("va3", Get("a"));
     ASSERT_EQ("vb2", Get("b"));
 }
 
+TEST(DBTest, GarbageCollectRelocatesLiveValues)
+{
+    Options options = CurrentOptions();
+    options.clean_threshold = 3;
+    options.min_clean_threshold = 1;
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    Reopen(&options);
+    std::string big(200, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + "v1"));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 5; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    dbfull()->TEST_CompactMemTable();
+    db_->CompactRange(NULL, NULL);//vlog1里的前5个key失效
+    dbfull()->CleanVlog();
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, 1)));
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+    Reopen(&options);//搬迁后的指针已经持久化
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, GarbageCollectCheckpoints)
+{
+    Options options = CurrentOptions();
+    options.clean_threshold = 3;
+    options.min_clean_threshold = 1;
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    options.clean_write_buffer_size = 1;//每条有效kv单独搬迁
+    options.clean_checkpoint_size = 1;//每条vlog记录后都刷一次sst并记录回收位置
+    Reopen(&options);
+    std::string big(200, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + "v1"));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 10; i += 2)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    dbfull()->TEST_CompactMemTable();
+    db_->CompactRange(NULL, NULL);
+    dbfull()->CleanVlog();
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, 1)));
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i % 2 == 0 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+    Reopen(&options);//回收完后不会再从检查点接着回收
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i % 2 == 0 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, VlogForwarding)
+{
+    Options options = CurrentOptions();
+    options.clean_threshold = 3;
+    options.min_clean_threshold = 1;
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    options.vlog_forwarding = true;
+    Reopen(&options);
+    std::string big(200, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + "v1"));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 10; i += 2)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    dbfull()->TEST_CompactMemTable();
+    db_->CompactRange(NULL, NULL);
+    dbfull()->CleanVlog();
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, 1)));
+    ASSERT_TRUE(env_->FileExists(VFwdFileName(dbname_, 1)));
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i % 2 == 0 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+    //gc没有改lsm里的指针，仍然指向vlog1
+    std::string ptr;
+    uint64_t size, file_numb, pos;
+    ASSERT_OK(dbfull()->GetPtr(ReadOptions(), "k1", &ptr));
+    ASSERT_TRUE(DecodeValuePtr(ptr, &size, &file_numb, &pos));
+    ASSERT_EQ(1, file_numb);
+
+    Reopen(&options);//转发表从文件加载
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i % 2 == 0 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+
+    //没有指针再指向vlog1后转发文件被删掉
+    for(int i = 1; i < 10; i += 2)
+        ASSERT_OK(Put("k" + NumberToString(i), "v3"));
+    dbfull()->TEST_CompactMemTable();
+    db_->CompactRange(NULL, NULL);
+    dbfull()->CleanVlog();//cold vlog里的值也失效了，gc运行时不删vlog和转发文件
+    Reopen(&options);
+    ASSERT_TRUE(!env_->FileExists(VFwdFileName(dbname_, 1)));
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i % 2 == 0 ? "v2" : "v3", Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, CompactionDropsVlogForwards)
+{
+    Options options = CurrentOptions();
+    options.clean_threshold = 3;
+    options.min_clean_threshold = 1;
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    options.vlog_forwarding = true;
+    Reopen(&options);
+    std::string big(200, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + "v1"));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 10; i += 2)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    dbfull()->TEST_CompactMemTable();
+    db_->CompactRange(NULL, NULL);
+    dbfull()->CleanVlog();
+    ASSERT_TRUE(env_->FileExists(VFwdFileName(dbname_, 1)));
+
+    //合并把转发后的指针写进新的sst，不用等用户覆盖这些key
+    ASSERT_EQ("0,0,1", FilesPerLevel());
+    dbfull()->TEST_CompactRange(2, NULL, NULL);
+    ASSERT_EQ("0,0,0,1", FilesPerLevel());
+    ASSERT_TRUE(!env_->FileExists(VFwdFileName(dbname_, 1)));
+    std::string ptr;
+    uint64_t size, file_numb, pos;
+    ASSERT_OK(dbfull()->GetPtr(ReadOptions(), "k1", &ptr));
+    ASSERT_TRUE(DecodeValuePtr(ptr, &size, &file_numb, &pos));
+    ASSERT_NE(1, file_numb);
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i % 2 == 0 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+    Reopen(&options);
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i % 2 == 0 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+}
+
+static void WaitForManualClean(DBImpl* db, DBImpl::ManualCleanProgress* progress)
+{
+    for(;;)
+    {
+        db->GetManualCleanProgress(progress);
+        if(!progress->running)
+            break;
+        DelayMilliseconds(10);
+    }
+}
+
+TEST(DBTest, ManualClean)
+{
+    Options options = CurrentOptions();
+    options.clean_threshold = 1000000;//不自动回收
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    Reopen(&options);
+    std::string big(200, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + "v1"));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 5; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    dbfull()->TEST_CompactMemTable();
+    db_->CompactRange(NULL, NULL);//vlog1里的前5个key失效
+    std::string vlog1 = VLogFileName(dbname_, 1);
+    ASSERT_TRUE(env_->FileExists(vlog1));
+
+    //限速到每秒1字节，马上取消，vlog1还在
+    std::vector<uint64_t> vlogs(1, 1);
+    ASSERT_OK(dbfull()->StartManualClean(vlogs, 0, 1));
+    ASSERT_TRUE(!dbfull()->StartManualClean(vlogs, 0, 0).ok());
+    dbfull()->CancelManualClean();
+    DBImpl::ManualCleanProgress progress;
+    WaitForManualClean(dbfull(), &progress);
+    ASSERT_TRUE(env_->FileExists(vlog1));
+    ASSERT_EQ(0, progress.bytes_freed);
+
+    //垃圾数达到5的vlog只有vlog1
+    ASSERT_OK(dbfull()->StartManualClean(std::vector<uint64_t>(), 5, 0));
+    WaitForManualClean(dbfull(), &progress);
+    ASSERT_TRUE(!env_->FileExists(vlog1));
+    ASSERT_EQ(1, progress.vlogs_total);
+    ASSERT_EQ(1, progress.vlogs_done);
+    ASSERT_GT(progress.bytes_scanned, 10 * big.size());
+    ASSERT_GT(progress.bytes_relocated, 5 * big.size());
+    ASSERT_EQ(progress.bytes_scanned, progress.bytes_freed);
+    std::string prop;
+    ASSERT_TRUE(db_->GetProperty("leveldb.manual-clean", &prop));
+    ASSERT_TRUE(prop.find("running: 0\nvlogs: 1/1\n") == 0) << prop;
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, ReopenAfterManualClean)
+{
+    Options options = CurrentOptions();
+    options.clean_threshold = 1000000;//不自动回收
+    options.log_dropCount_threshold = 1;//垃圾数写进manifest，重启后才会去恢复gc
+    options.clean_checkpoint_size = 200;//gc每搬一条就刷一次，回收位置写进manifest
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    Reopen(&options);
+    std::string big(200, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + "v1"));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 5; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    dbfull()->TEST_CompactMemTable();
+    db_->CompactRange(NULL, NULL);//vlog1里的前5个key失效
+    std::string vlog1 = VLogFileName(dbname_, 1);
+    std::vector<uint64_t> vlogs(1, 1);
+    DBImpl::ManualCleanProgress progress;
+
+    //限速的手动gc回收到一半时关闭数据库，留下了vlog1的回收位置
+    ASSERT_OK(dbfull()->StartManualClean(vlogs, 0, 1));
+    DelayMilliseconds(300);
+    Reopen(&options);
+    //垃圾数不到阈值，恢复时不接着回收；排在后面的手动gc结束时恢复已经做完了
+    ASSERT_OK(dbfull()->StartManualClean(std::vector<uint64_t>(), 1000000, 0));
+    WaitForManualClean(dbfull(), &progress);
+    ASSERT_TRUE(env_->FileExists(vlog1));
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+
+    //取消的手动gc同样不会在重启后继续
+    ASSERT_OK(dbfull()->StartManualClean(vlogs, 0, 1));
+    DelayMilliseconds(300);
+    dbfull()->CancelManualClean();
+    WaitForManualClean(dbfull(), &progress);
+    Reopen(&options);
+    ASSERT_OK(dbfull()->StartManualClean(std::vector<uint64_t>(), 1000000, 0));
+    WaitForManualClean(dbfull(), &progress);
+    ASSERT_TRUE(env_->FileExists(vlog1));
+
+    ASSERT_OK(dbfull()->StartManualClean(vlogs, 0, 0));
+    WaitForManualClean(dbfull(), &progress);
+    ASSERT_TRUE(!env_->FileExists(vlog1));
+    Reopen(&options);
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, KeyIndexGarbageCollect)
+{
+    Options options = CurrentOptions();
+    options.clean_threshold = 1000000;//只手动回收
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    options.key_index_partitions = 4;
+    Reopen(&options);
+    std::string big(200, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + "v1"));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 10; i += 2)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    ASSERT_OK(Delete("k1"));
+    Reopen(&options);//索引从lsm重建
+    ASSERT_OK(Put("k3", "v3"));//索引里的指针跟着用户写入更新
+    std::vector<uint64_t> vlogs(1, 1);
+    ASSERT_OK(dbfull()->StartManualClean(vlogs, 0, 0));
+    DBImpl::ManualCleanProgress progress;
+    WaitForManualClean(dbfull(), &progress);
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, 1)));
+    ASSERT_EQ("NOT_FOUND", Get("k1"));
+    ASSERT_EQ("v3", Get("k3"));
+    for(int i = 0; i < 10; i++)
+    {
+        if(i % 2 == 0)
+            ASSERT_EQ("v2", Get("k" + NumberToString(i)));
+        else if(i != 1 && i != 3)
+            ASSERT_EQ(big + "v1", Get("k" + NumberToString(i)));
+    }
+    Reopen(&options);
+    ASSERT_EQ("NOT_FOUND", Get("k1"));
+    ASSERT_EQ(big + "v1", Get("k5"));
+}
+
+TEST(DBTest, RewriteRangeInKeyOrder)
+{
+    Options options = CurrentOptions();
+    options.clean_threshold = 1000000;//只手动回收
+    options.clean_write_buffer_size = 1000;
+    Reopen(&options);
+    std::string big(100, 'x');
+    char buf[20];
+    for(int i = 49; i >= 0; i--)
+    {//倒着写，值在vlog里和key的顺序相反
+        snprintf(buf, sizeof(buf), "k%03d", i);
+        ASSERT_OK(Put(buf, big + buf));
+    }
+    dbfull()->TEST_CompactMemTable();
+    Slice begin("k010"), end("k039");
+    ASSERT_OK(dbfull()->RewriteRange(&begin, &end));
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+
+    //范围内每个key最新的指针都在同一个vlog里，并且位置随key递增
+    Iterator* iter = dbfull()->TEST_NewInternalIterator();
+    std::string last_key;
+    uint32_t first_file = 0;
+    uint64_t last_pos = 0;
+    int n = 0;
+    for(iter->SeekToFirst(); iter->Valid(); iter->Next())
+    {
+        ParsedInternalKey ikey;
+        ASSERT_TRUE(ParseInternalKey(iter->key(), &ikey));
+        std::string user_key = ikey.user_key.ToString();
+        if(user_key == last_key || user_key < "k010" || user_key > "k039")
+            continue;
+        last_key = user_key;
+        uint64_t size, file_numb, pos;
+        ASSERT_TRUE(DecodeValuePtr(iter->value(), &size, &file_numb, &pos));
+        if(n == 0)
+            first_file = file_numb;
+        ASSERT_EQ(first_file, file_numb);
+        ASSERT_TRUE(n == 0 || pos > last_pos);
+        last_pos = pos;
+        n++;
+    }
+    delete iter;
+    ASSERT_EQ(30, n);
+
+    for(int i = 0; i < 50; i++)
+    {
+        snprintf(buf, sizeof(buf), "k%03d", i);
+        ASSERT_EQ(big + buf, Get(buf));
+    }
+    //顺序扫描从合并读出来的缓冲区里取值
+    iter = db_->NewIterator(ReadOptions());
+    int i = 0;
+    for(iter->SeekToFirst(); iter->Valid(); iter->Next(), i++)
+    {
+        snprintf(buf, sizeof(buf), "k%03d", i);
+        ASSERT_EQ(buf, iter->key().ToString());
+        ASSERT_EQ(big + buf, iter->value().ToString());
+    }
+    ASSERT_OK(iter->status());
+    ASSERT_EQ(50, i);
+    delete iter;
+
+    Reopen(&options);
+    for(int i = 0; i < 50; i++)
+    {
+        snprintf(buf, sizeof(buf), "k%03d", i);
+        ASSERT_EQ(big + buf, Get(buf));
+    }
+}
+
+TEST(DBTest, SampleVlogGarbage)
+{
+    Options options = CurrentOptions();
+    options.clean_threshold = 1000000;
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    Reopen(&options);
+    std::string big(200, 'x');
+    for(int i = 0; i < 100; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + "v1"));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 80; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    dbfull()->TEST_CompactMemTable();//没有合并过，vlog1记录的垃圾数还是0
+
+    GarbageSampler sampler(dbfull());
+    GarbageSampler::Estimate est;
+    ASSERT_OK(sampler.Sample(1, 40, &est));
+    ASSERT_GE(est.records, 20);
+    ASSERT_LE(est.lower, est.ratio);
+    ASSERT_GT(est.ratio, 0.6);
+    ASSERT_GT(est.entries, 70);
+    ASSERT_LT(est.entries, 130);
+
+    //重启后抽样估计的垃圾数超过阈值，vlog1不用等合并就被回收
+    options.clean_threshold = 30;
+    options.garbage_sample_records = 40;
+    Reopen(&options);
+    for(int i = 0; i < 100 && env_->FileExists(VLogFileName(dbname_, 1)); i++)
+        env_->SleepForMicroseconds(100000);
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, 1)));
+    for(int i = 0; i < 100; i++)
+        ASSERT_EQ(i < 80 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, SampleVlogGarbageMixedBatches)
+{
+    Options options = CurrentOptions();
+    options.clean_threshold = 1000000;
+    options.max_vlog_size = 10000000;
+    options.write_buffer_size = 10000000;
+    Reopen(&options);
+    std::string big(200, 'x');
+    //大batch里的kv全部失效，跟在后面的单条kv都有效：按记录后面的位置抽样会偏向单条kv
+    for(int b = 0; b < 20; b++)
+    {
+        WriteBatch batch;
+        for(int i = 0; i < 10; i++)
+            batch.Put("b" + NumberToString(b * 10 + i), big);
+        ASSERT_OK(db_->Write(WriteOptions(), &batch));
+        for(int i = 0; i < 5; i++)
+            ASSERT_OK(Put("s" + NumberToString(b * 5 + i), big));
+    }
+    dbfull()->TEST_RollVlog();
+    for(int i = 0; i < 200; i++)
+        ASSERT_OK(Put("b" + NumberToString(i), "v2"));
+    dbfull()->TEST_CompactMemTable();
+
+    GarbageSampler sampler(dbfull());
+    GarbageSampler::Estimate est;
+    ASSERT_OK(sampler.Sample(1, 200, &est));
+    ASSERT_GE(est.batches, 150);
+    ASSERT_GT(est.ratio, 0.55);//实际是200/300
+    ASSERT_LT(est.ratio, 0.8);
+    ASSERT_LE(est.lower, est.ratio);
+    ASSERT_GT(est.lower, 0.4);
+    ASSERT_GT(est.entries, 250);
+    ASSERT_LT(est.entries, 350);
+}
+
+TEST(DBTest, VlogRollsAtExactSize)
+{
+    Options options = CurrentOptions();
+    options.max_vlog_size = 10000;
+    options.write_buffer_size = 1000000;//不切换memtable
+    Reopen(&options);
+    std::string big(500, 'x');
+    for(int i = 0; i < 100; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + NumberToString(i)));
+    ASSERT_EQ(0, TotalTableFiles());
+    std::vector<std::string> filenames;
+    ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+    uint64_t number, size;
+    FileType type;
+    int vlogs = 0;
+    for(size_t i = 0; i < filenames.size(); i++)
+    {
+        if(ParseFileName(filenames[i], &number, &type) && type == kVLogFile)
+        {
+            ASSERT_OK(env_->GetFileSize(VLogFileName(dbname_, number), &size));
+            ASSERT_LE(size, options.max_vlog_size);
+            vlogs++;
+        }
+    }
+    ASSERT_GE(vlogs, 5);
+
+    //重启点在第一个vlog里，回放要跨过后面所有的vlog
+    Reopen(&options);
+    for(int i = 0; i < 100; i++)
+        ASSERT_EQ(big + NumberToString(i), Get("k" + NumberToString(i)));
+    for(int i = 0; i < 50; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 50; i < 100; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    Reopen(&options);
+    for(int i = 0; i < 100; i++)
+        ASSERT_EQ("v2", Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, ParallelVlogReplay)
+{
+    Options options = CurrentOptions();
+    options.max_vlog_size = 3 << 20;
+    options.write_buffer_size = 64 << 20;//不切换memtable，全部靠回放恢复
+    options.vlog_replay_threads = 3;
+    Reopen(&options);
+    //每个vlog超过回放线程切的一段，后写的vlog覆盖前面vlog里的同一批key
+    std::string big(100000, 'x');
+    for(int round = 0; round < 4; round++)
+    {
+        for(int i = 0; i < 40; i++)
+            ASSERT_OK(Put("k" + NumberToString(i), big + NumberToString(round * 100 + i)));
+    }
+    ASSERT_OK(Delete("k7"));
+    ASSERT_EQ(0, TotalTableFiles());
+
+    for(int threads = 3; threads >= 1; threads -= 2)
+    {
+        options.vlog_replay_threads = threads;
+        Reopen(&options);
+        for(int i = 0; i < 40; i++)
+        {
+            if(i == 7)
+                ASSERT_EQ("NOT_FOUND", Get("k7"));
+            else
+                ASSERT_EQ(big + NumberToString(300 + i), Get("k" + NumberToString(i)));
+        }
+    }
+    ASSERT_OK(Put("k7", "v2"));
+    Reopen(&options);
+    ASSERT_EQ("v2", Get("k7"));
+}
+
+TEST(DBTest, ParallelVlogReplaySplitsVlog)
+{
+    Options options = CurrentOptions();
+    options.max_vlog_size = 64 << 20;//只有一个vlog，回放时切成几段
+    options.write_buffer_size = 64 << 20;
+    options.vlog_replay_threads = 3;
+    options.create_if_missing = true;
+    std::string big(100000, 'x');
+    for(int corrupt = 0; corrupt < 2; corrupt++)
+    {
+        DestroyAndReopen(&options);
+        //后面的段覆盖前面段里的同一批key，huge比一段还长，盖住的段里没有记录开头
+        for(int round = 0; round < 3; round++)
+        {
+            for(int i = 0; i < 40; i++)
+                ASSERT_OK(Put("k" + NumberToString(i), "v" + NumberToString(round * 100 + i) + ":" + big));
+        }
+        ASSERT_OK(Put("huge", std::string(9 << 20, 'h')));
+        for(int i = 0; i < 10; i++)
+            ASSERT_OK(Put("k" + NumberToString(i), "after" + NumberToString(i)));
+        ASSERT_EQ(0, TotalTableFiles());
+        if(!corrupt)
+        {
+            for(int threads = 3; threads >= 1; threads -= 2)
+            {
+                options.vlog_replay_threads = threads;
+                Reopen(&options);
+                for(int i = 0; i < 40; i++)
+                {
+                    ASSERT_TRUE(Get("k" + NumberToString(i)) == (i < 10 ? "after" + NumberToString(i) :
+                                "v" + NumberToString(200 + i) + ":" + big));
+                }
+                ASSERT_EQ(9 << 20, Get("huge").size());
+            }
+            continue;
+        }
+
+        //v204是第三段的第一条记录，改掉它之后第三段从下一条开始，和第二段接不上，
+        //要和不切段时一样在v204停下
+        Close();
+        std::vector<std::string> filenames;
+        ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+        uint64_t number, last = 0;
+        FileType type;
+        for(size_t i = 0; i < filenames.size(); i++)
+        {
+            if(ParseFileName(filenames[i], &number, &type) && type == kVLogFile)
+                last = std::max(last, number);
+        }
+        const std::string fname = VLogFileName(dbname_, last);
+        std::string contents;
+        ASSERT_OK(ReadFileToString(env_, fname, &contents));
+        const size_t pos = contents.find("v204:");
+        ASSERT_TRUE(pos != std::string::npos);
+        contents[pos + 100] ^= 0x55;
+        ASSERT_OK(WriteStringToFile(env_, contents, fname));
+        options.vlog_replay_threads = 3;
+        Reopen(&options);
+        for(int i = 0; i < 40; i++)
+        {
+            ASSERT_TRUE(Get("k" + NumberToString(i)) ==
+                        "v" + NumberToString((i < 4 ? 200 : 100) + i) + ":" + big);
+        }
+        ASSERT_EQ("NOT_FOUND", Get("huge"));
+    }
+}
+
+TEST(DBTest, MaxRecoveryBytes)
+{
+    Options options = CurrentOptions();
+    options.write_buffer_size = 64 << 20;//memtable里只有指针，按write_buffer_size不会切换
+    Reopen(&options);
+    std::string big(10000, 'x');
+    for(int i = 0; i < 100; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + NumberToString(i)));
+    ASSERT_EQ(0, TotalTableFiles());
+
+    //回放量限制在200KB左右，写1MB的值要刷好几次sst
+    options.max_recovery_bytes = 200000;
+    options.create_if_missing = true;
+    DestroyAndReopen(&options);
+    for(int i = 0; i < 100; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + NumberToString(i)));
+    ASSERT_OK(Put("k0", "v2"));
+    ASSERT_GE(TotalTableFiles(), 5);
+    Reopen(&options);
+    ASSERT_EQ("v2", Get("k0"));
+    for(int i = 1; i < 100; i++)
+        ASSERT_EQ(big + NumberToString(i), Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, VlogCacheOpensLazily)
+{
+    Options options = CurrentOptions();
+    options.env = env_;
+    options.max_vlog_size = 10000;
+    options.max_open_vlogs = 2;
+    options.write_buffer_size = 1000000;
+    Reopen(&options);
+    std::string big(2000, 'x');
+    for(int i = 0; i < 50; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + NumberToString(i)));
+    dbfull()->TEST_CompactMemTable();
+
+    std::vector<std::string> filenames;
+    ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+    uint64_t number;
+    FileType type;
+    int vlogs = 0;
+    for(size_t i = 0; i < filenames.size(); i++)
+    {
+        if(ParseFileName(filenames[i], &number, &type) && type == kVLogFile)
+            vlogs++;
+    }
+    ASSERT_GE(vlogs, 10);
+
+    //打开数据库时只读重启点所在的vlog，其余的vlog第一次读值时才打开
+    env_->vlog_open_counter_.Reset();
+    Reopen(&options);
+    ASSERT_LE(env_->vlog_open_counter_.Read(), 2);
+    env_->vlog_open_counter_.Reset();
+
+    //值分布在十来个vlog里，最多同时开两个，读过的vlog被淘汰后再读要重新打开
+    for(int round = 0; round < 2; round++)
+    {
+        for(int i = 0; i < 50; i++)
+            ASSERT_EQ(big + NumberToString(i), Get("k" + NumberToString(i)));
+    }
+    ASSERT_GE(env_->vlog_open_counter_.Read(), 20);
+    ASSERT_EQ(big + "7", Get("k7"));
+    const int opens = env_->vlog_open_counter_.Read();
+    ASSERT_EQ(big + "7", Get("k7"));
+    ASSERT_EQ(opens, env_->vlog_open_counter_.Read());
+}
+
+TEST(DBTest, MigrateColdVlogs)
+{
+    Options options = CurrentOptions();
+    const std::string cold_path = dbname_ + "_cold";
+    options.vlog_cold_paths.push_back(cold_path);
+    options.vlog_cold_read_threshold = 1;//抽到一次读就不搬
+    options.max_vlog_size = 1000000;
+    Close();
+    ASSERT_OK(DestroyDB(dbname_, options));//冷存储目录里可能有上次失败留下的vlog
+    options.create_if_missing = true;
+    Reopen(&options);
+    std::string big(200, 'x');
+    //每轮写一个vlog，切换vlog时检查一次；vlog1一直没人读，vlog2每轮都读
+    for(int round = 0; round < 6; round++)
+    {
+        for(int i = 0; i < 20; i++)
+            ASSERT_OK(Put("r" + NumberToString(round) + "_" + NumberToString(i), big));
+        for(int n = 0; n < 5 && round >= 1; n++)
+            for(int i = 0; i < 20; i++)
+                ASSERT_EQ(big, Get("r1_" + NumberToString(i)));
+        dbfull()->TEST_RollVlog();
+        dbfull()->TEST_CompactMemTable();
+    }
+    for(int i = 0; i < 100 && !env_->FileExists(VLogFileName(cold_path, 1)); i++)
+        env_->SleepForMicroseconds(100000);
+    ASSERT_TRUE(env_->FileExists(VLogFileName(cold_path, 1)));
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, 1)));
+    ASSERT_TRUE(env_->FileExists(VLogFileName(dbname_, 2)));
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(cold_path, 2)));
+
+    for(int i = 0; i < 20; i++)
+        ASSERT_EQ(big, Get("r0_" + NumberToString(i)));
+    Reopen(&options);//恢复时到冷存储目录里找vlog
+    for(int round = 0; round < 6; round++)
+        for(int i = 0; i < 20; i++)
+            ASSERT_EQ(big, Get("r" + NumberToString(round) + "_" + NumberToString(i)));
+
+    //模拟两种崩溃：vlog1搬迁记进manifest后原文件还没删，vlog2拷贝完还没记进manifest
+    Close();
+    std::string contents;
+    ASSERT_OK(ReadFileToString(env_, VLogFileName(cold_path, 1), &contents));
+    ASSERT_OK(WriteStringToFile(env_, contents, VLogFileName(dbname_, 1)));
+    ASSERT_OK(ReadFileToString(env_, VLogFileName(dbname_, 2), &contents));
+    ASSERT_OK(WriteStringToFile(env_, contents, VLogFileName(cold_path, 2)));
+    Reopen(&options);
+    ASSERT_TRUE(env_->FileExists(VLogFileName(cold_path, 1)));
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, 1)));
+    ASSERT_TRUE(env_->FileExists(VLogFileName(dbname_, 2)));
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(cold_path, 2)));
+    for(int round = 0; round < 6; round++)
+        for(int i = 0; i < 20; i++)
+            ASSERT_EQ(big, Get("r" + NumberToString(round) + "_" + NumberToString(i)));
+
+    Close();
+    ASSERT_OK(DestroyDB(dbname_, options));
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(cold_path, 1)));
+    env_->DeleteDir(cold_path);
+}
+
+namespace {
+struct ReadDuringMigrationState {
+  DB* db;
+  std::string key;
+  Status status;
+  std::string value;
+  port::AtomicPointer done;
+};
+
+static void ReadDuringMigration(void* arg) {
+  ReadDuringMigrationState* state = reinterpret_cast<ReadDuringMigrationState*>(arg);
+  state->status = state->db->Get(ReadOptions(), state->key, &state->value);
+  state->done.Release_Store(state);
+}
+}  // namespace
+
+TEST(DBTest, ReadDuringMigration)
+{
+    Options options = CurrentOptions();
+    options.env = env_;
+    const std::string cold_path = dbname_ + "_cold";
+    options.vlog_cold_paths.push_back(cold_path);
+    options.vlog_cold_read_threshold = 1000000;
+    options.max_vlog_size = 1000000;
+    Close();
+    ASSERT_OK(DestroyDB(dbname_, options));
+    options.create_if_missing = true;
+    Reopen(&options);
+    std::string big(200, 'x');
+    for(int i = 0; i < 20; i++)
+        ASSERT_OK(Put("r0_" + NumberToString(i), big));
+    dbfull()->TEST_RollVlog();
+    dbfull()->TEST_CompactMemTable();
+    Reopen(&options);//vlog cache是空的
+
+    //读的线程解析出vlog1在dbname_下，打开它之前停住，等vlog1搬走、原文件删掉再打开
+    const std::string src = VLogFileName(dbname_, 1);
+    env_->block_vlog_open_.Release_Store(const_cast<std::string*>(&src));
+    ReadDuringMigrationState state;
+    state.db = db_;
+    state.key = "r0_0";
+    state.done.Release_Store(NULL);
+    env_->StartThread(&ReadDuringMigration, &state);
+    for(int i = 0; i < 500 && env_->vlog_open_blocked_.Acquire_Load() == NULL; i++)
+        DelayMilliseconds(10);
+    ASSERT_TRUE(env_->vlog_open_blocked_.Acquire_Load() != NULL);
+
+    for(int round = 1; round < 100 && env_->FileExists(src); round++)
+    {
+        for(int i = 0; i < 20; i++)
+            ASSERT_OK(Put("r" + NumberToString(round) + "_" + NumberToString(i), big));
+        dbfull()->TEST_RollVlog();
+        dbfull()->TEST_CompactMemTable();
+        env_->SleepForMicroseconds(10000);
+    }
+    ASSERT_TRUE(!env_->FileExists(src));
+    ASSERT_TRUE(env_->FileExists(VLogFileName(cold_path, 1)));
+
+    env_->block_vlog_open_.Release_Store(NULL);
+    while(state.done.Acquire_Load() == NULL)
+        DelayMilliseconds(10);
+    env_->vlog_open_blocked_.Release_Store(NULL);
+    ASSERT_OK(state.status);
+    ASSERT_EQ(big, state.value);
+
+    Close();
+    ASSERT_OK(DestroyDB(dbname_, options));
+    env_->DeleteDir(cold_path);
+}
+
+TEST(DBTest, TtlVlogs)
+{
+    Options options = CurrentOptions();
+    options.env = env_;
+    options.ttl_vlog_window = 100;
+    Reopen(&options);
+    ASSERT_OK(Put("k1", "v1"));
+    ASSERT_OK(Put("k2", "v2"));
+    WriteOptions ttl_options;
+    ttl_options.ttl = 50;
+    ASSERT_OK(db_->Put(ttl_options, "t1", "tv1"));
+    //ttl写入的值单独放在最新的vlog里
+    std::vector<std::string> filenames;
+    ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+    uint64_t number, ttl_vlog = 0;
+    FileType type;
+    for(size_t i = 0; i < filenames.size(); i++)
+    {
+        if(ParseFileName(filenames[i], &number, &type) && type == kVLogFile && number > ttl_vlog)
+            ttl_vlog = number;
+    }
+    WriteBatch batch;
+    batch.Put("t2", "tv2");
+    batch.Delete("k1");
+    batch.Put("t3", "tv3");
+    ASSERT_OK(db_->Write(ttl_options, &batch));
+    ASSERT_EQ("NOT_FOUND", Get("k1"));
+    ASSERT_EQ("tv1", Get("t1"));
+    ASSERT_EQ("tv3", Get("t3"));
+
+    Reopen(&options);//用户vlog里只有指向ttl vlog的引用，回放后还能读到值
+    ASSERT_EQ("tv2", Get("t2"));
+    Iterator* iter = db_->NewIterator(ReadOptions());
+    std::string result;
+    for(iter->SeekToFirst(); iter->Valid(); iter->Next())
+        result += iter->key().ToString() + "=" + iter->value().ToString() + ",";
+    delete iter;
+    ASSERT_EQ("k2=v2,t1=tv1,t2=tv2,t3=tv3,", result);
+
+    iter = db_->NewIterator(ReadOptions());
+    iter->Seek("t1");
+    env_->now_offset_micros_ = 60 * 1000000ULL;//迭代器创建后才过期，还按创建时的时间读
+    ASSERT_EQ("tv1", iter->value().ToString());
+    ASSERT_OK(iter->status());
+    delete iter;
+    ASSERT_EQ("NOT_FOUND", Get("t1"));
+
+    env_->now_offset_micros_ = 300 * 1000000ULL;//过期窗口和宽限期都过去了
+    ASSERT_EQ("NOT_FOUND", Get("t1"));
+    ASSERT_EQ("v2", Get("k2"));
+    iter = db_->NewIterator(ReadOptions());
+    result.clear();
+    for(iter->SeekToLast(); iter->Valid(); iter->Prev())
+        result += iter->key().ToString() + ",";
+    delete iter;
+    ASSERT_EQ("k2,", result);
+
+    //不用gc，整个ttl vlog直接删掉；合并丢掉过期的指针
+    db_->CompactRange(NULL, NULL);
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, ttl_vlog)));
+    iter = dbfull()->TEST_NewInternalIterator();
+    int entries = 0;
+    for(iter->SeekToFirst(); iter->Valid(); iter->Next())
+        entries++;
+    delete iter;
+    ASSERT_EQ(1, entries);
+    Reopen(&options);
+    ASSERT_EQ("NOT_FOUND", Get("t2"));
+    ASSERT_EQ("v2", Get("k2"));
+    env_->now_offset_micros_ = 0;
+}
+
+TEST(DBTest, TtlVlogWindowZero)
+{
+    Options options = CurrentOptions();
+    options.ttl_vlog_window = 0;//当成1秒
+    Reopen(&options);
+    WriteOptions ttl_options;
+    ttl_options.ttl = 50;
+    ASSERT_OK(db_->Put(ttl_options, "t1", "tv1"));
+    ASSERT_EQ("tv1", Get("t1"));
+    Reopen(&options);
+    ASSERT_EQ("tv1", Get("t1"));
+}
+
+TEST(DBTest, CompactionRelocatesLiveValues)
+{
+    Options options = CurrentOptions();
+    options.compaction_relocate = true;
+    options.min_clean_threshold = 1;
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    Reopen(&options);
+    std::string big(200, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + "v1"));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 5; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    db_->CompactRange(NULL, NULL);//丢弃vlog1里的前5个key，后5个key被搬到cold vlog
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+    //vlog1里已经没有被引用的kv了，不用gc直接删掉
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, 1)));
+    Reopen(&options);
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : big + "v1", Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, PtrCacheFollowsWritesAndRelocations)
+{
+    Options options = CurrentOptions();
+    options.ptr_cache_size = 1 << 20;
+    options.clean_threshold = 3;
+    options.min_clean_threshold = 1;
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    Reopen(&options);
+    std::string big(200, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + "v1"));
+    for(int i = 0; i < 10; i++)//指针进了缓存
+        ASSERT_EQ(big + "v1", Get("k" + NumberToString(i)));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 5; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    ASSERT_OK(Delete("k9"));
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : (i < 9 ? big + "v1" : "NOT_FOUND"),
+                  Get("k" + NumberToString(i)));
+    dbfull()->TEST_CompactMemTable();
+    db_->CompactRange(NULL, NULL);
+    dbfull()->CleanVlog();//缓存里指向vlog1的指针要换成搬迁后的
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, 1)));
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : (i < 9 ? big + "v1" : "NOT_FOUND"),
+                  Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, PunchHolesForDeadValues)
+{
+    Options options = CurrentOptions();
+    options.punch_hole_threshold = 1;
+    options.log_dropCount_threshold = 1;
+    options.min_clean_threshold = 1000000;//只打洞，不回收
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    Reopen(&options);
+    std::string big(40000, 'x');//打洞按页对齐，value大一些洞才接近value的大小
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + NumberToString(i)));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    struct stat st;
+    std::string vlog1 = VLogFileName(dbname_, 1);
+    ASSERT_EQ(0, stat(vlog1.c_str(), &st));
+    const uint64_t blocks = st.st_blocks;
+    for(int i = 0; i < 5; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    db_->CompactRange(NULL, NULL);//vlog1里前5个value失效
+    dbfull()->CleanVlog();//等打洞完成
+    ASSERT_EQ(0, stat(vlog1.c_str(), &st));
+    ASSERT_LT(static_cast<uint64_t>(st.st_blocks), blocks * 3 / 4);
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : big + NumberToString(i), Get("k" + NumberToString(i)));
+
+    options.min_clean_threshold = 1;//回收打过洞的vlog，要跳过洞
+    Reopen(&options);
+    dbfull()->CleanVlog();
+    ASSERT_TRUE(!env_->FileExists(vlog1));
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : big + NumberToString(i), Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, MigrateKeepsHoles)
+{
+    Options options = CurrentOptions();
+    const std::string cold_path = dbname_ + "_cold";
+    options.punch_hole_threshold = 1;
+    options.log_dropCount_threshold = 1;
+    options.min_clean_threshold = 1000000;//只打洞，不回收
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    Reopen(&options);
+    std::string big(40000, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + NumberToString(i)));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 5; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+    db_->CompactRange(NULL, NULL);//vlog1里前5个value失效
+    dbfull()->CleanVlog();//等打洞完成
+
+    //打过洞的vlog1搬到冷存储目录，洞还在
+    options.vlog_cold_paths.push_back(cold_path);
+    options.vlog_cold_read_threshold = 1000000;//不读也会搬
+    Reopen(&options);
+    const std::string cold_vlog1 = VLogFileName(cold_path, 1);
+    for(int i = 0; i < 100 && !env_->FileExists(cold_vlog1); i++)
+    {
+        dbfull()->TEST_RollVlog();
+        dbfull()->TEST_CompactMemTable();
+        env_->SleepForMicroseconds(100000);
+    }
+    ASSERT_TRUE(env_->FileExists(cold_vlog1));
+    struct stat st;
+    ASSERT_EQ(0, stat(cold_vlog1.c_str(), &st));
+    ASSERT_LT(static_cast<uint64_t>(st.st_blocks) * 512, static_cast<uint64_t>(st.st_size) * 3 / 4);
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i < 5 ? "v2" : big + NumberToString(i), Get("k" + NumberToString(i)));
+
+    Close();
+    ASSERT_OK(DestroyDB(dbname_, options));
+    env_->DeleteDir(cold_path);
+}
+
+TEST(DBTest, VlogStateKeysAreUserKeys)
+{
+    //重启点、回收位置和垃圾统计都在manifest里，这些key名留给用户
+    Options options = CurrentOptions();
+    options.log_dropCount_threshold = 1;
+    Reopen(&options);
+    ASSERT_OK(Put("head", "v1"));
+    ASSERT_OK(Put("tail", "v2"));
+    ASSERT_OK(Put("vloginfo", "v3"));
+    ASSERT_OK(Put("vloginfo", "v4"));
+    dbfull()->TEST_CompactMemTable();
+    db_->CompactRange(NULL, NULL);
+    ASSERT_EQ("(head->v1)(tail->v2)(vloginfo->v4)", Contents());
+    Reopen(&options);
+    ASSERT_EQ("v1", Get("head"));
+    ASSERT_EQ("v2", Get("tail"));
+    ASSERT_EQ("v4", Get("vloginfo"));
+    ASSERT_EQ("(head->v1)(tail->v2)(vloginfo->v4)", Contents());
+}
+
+TEST(DBTest, DeleteDeadVlogWithoutClean)
+{
+    Options options = CurrentOptions();
+    options.min_clean_threshold = 1000000;//不回收
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    Reopen(&options);
+    std::string big(10000, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + NumberToString(i)));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    std::string vlog1 = VLogFileName(dbname_, 1);
+    ASSERT_TRUE(env_->FileExists(vlog1));
+    for(int i = 0; i < 10; i++)
+    {
+        if(i % 2 == 0)
+            ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+        else
+            ASSERT_OK(Delete("k" + NumberToString(i)));
+    }
+    ASSERT_TRUE(env_->FileExists(vlog1));
+    db_->CompactRange(NULL, NULL);//sst里已经没有指向vlog1的指针了
+    ASSERT_TRUE(!env_->FileExists(vlog1));
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i % 2 == 0 ? "v2" : "NOT_FOUND", Get("k" + NumberToString(i)));
+
+    Reopen(&options);
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i % 2 == 0 ? "v2" : "NOT_FOUND", Get("k" + NumberToString(i)));
+}
+
+TEST(DBTest, RecycleVlogFiles)
+{
+    Options options = CurrentOptions();
+    options.min_clean_threshold = 1000000;//不回收
+    options.max_vlog_size = 1000000;
+    options.write_buffer_size = 100000;
+    options.recycle_vlog_num = 2;
+    options.vlog_preallocate_size = 4096;
+    Reopen(&options);
+    std::string big(10000, 'x');
+    for(int i = 0; i < 10; i++)
+        ASSERT_OK(Put("k" + NumberToString(i), big + NumberToString(i)));
+    dbfull()->TEST_RollVlog();//vlog1写完，之后写到vlog2
+    dbfull()->TEST_CompactMemTable();
+    for(int i = 0; i < 10; i++)
+    {
+        if(i % 2 == 0)
+            ASSERT_OK(Put("k" + NumberToString(i), "v2"));
+        else
+            ASSERT_OK(Delete("k" + NumberToString(i)));
+    }
+    db_->CompactRange(NULL, NULL);//vlog1没用了，留着重用
+    ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, 1)));
+    ASSERT_TRUE(env_->FileExists(VFreeFileName(dbname_, 1)));
+
+    Reopen(&options);//重用的文件重启后还在
+    ASSERT_TRUE(env_->FileExists(VFreeFileName(dbname_, 1)));
+    dbfull()->TEST_RollVlog();
+    ASSERT_TRUE(!env_->FileExists(VFreeFileName(dbname_, 1)));
+    for(int i = 0; i < 10; i += 2)
+        ASSERT_OK(Put("k" + NumberToString(i), "v3"));
+
+    //之后的vlog都只有小值，重用的文件还开着时大小也是写到的位置，旧空间和预分配的空间不算在里面
+    std::vector<std::string> filenames;
+    ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+    uint64_t number, size;
+    FileType type;
+    for(size_t i = 0; i < filenames.size(); i++)
+    {
+        if(ParseFileName(filenames[i], &number, &type) && type == kVLogFile)
+        {
+            ASSERT_OK(env_->GetFileSize(VLogFileName(dbname_, number), &size));
+            ASSERT_LT(size, big.size());
+        }
+    }
+
+    //新vlog回放时不能读到文件里原来vlog1的记录，否则删掉的key会复活
+    Reopen(&options);
+    for(int i = 0; i < 10; i++)
+        ASSERT_EQ(i % 2 == 0 ? "v3" : "NOT_FOUND", Get("k" + NumberToString(i)));
+
+    options.recycle_vlog_num = 0;
+    Reopen(&options);
+    ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+    for(size_t i = 0; i < filenames.size(); i++)
+        ASSERT_TRUE(!ParseFileName(filenames[i], &number, &type) || type != kVFreeFile);
+}
+
+TEST(DBTest, RecoverKeepsCorruptVlogTail)
+{
+    Options options = CurrentOptions();
+    Reopen(&options);
+    ASSERT_OK(Put("k1", "v1"));
+    ASSERT_OK(Put("k2", "v2"));
+    ASSERT_OK(Put("k3", "v3"));
+    Close();
+    std::vector<std::string> filenames;
+    ASSERT_OK(env_->GetChildren(dbname_, &filenames));
+    uint64_t number, last = 0;
+    FileType type;
+    for(size_t i = 0; i < filenames.size(); i++)
+    {
+        if(ParseFileName(filenames[i], &number, &type) && type == kVLogFile)
+            last = std::max(last, number);
+    }
+    //改掉最后一条记录的最后一个字节，回放停在crc不对的记录上
+    const std::string fname = VLogFileName(dbname_, last);
+    std::string contents;
+    ASSERT_OK(ReadFileToString(env_, fname, &contents));
+    contents[contents.size() - 1] ^= 0x55;
+    ASSERT_OK(WriteStringToFile(env_, contents, fname));
+
+    //坏掉的记录和它后面的字节都留着，新写的记录在新vlog里
+    for(int i = 0; i < 2; i++)
+    {
+        Reopen(&options);
+        ASSERT_EQ("v1", Get("k1"));
+        ASSERT_EQ("v2", Get("k2"));
+        ASSERT_EQ("NOT_FOUND", Get("k3"));
+        uint64_t size;
+        ASSERT_OK(env_->GetFileSize(fname, &size));
+        ASSERT_EQ(contents.size(), size);
+        ASSERT_OK(Put("k4", "v4"));
+        ASSERT_EQ("v4", Get("k4"));
+    }
+}
+
+TEST(DBTest, MigrateLegacyCheckpoint)
+{
+    //老版本的数据库：tail和vloginfo是普通的Put，head直接写在sst里，manifest里没有这些字段
+    Options options = CurrentOptions();
+    options.create_if_missing = true;
+    DestroyAndReopen(&options);
+    ASSERT_OK(Put("k", "v"));
+    char buf[8];
+    EncodeFixed64(buf, (5 << 24) | 999);//(pos << 24) | vlog编号
+    ASSERT_OK(Put("tail", std::string(buf, 8)));
+    EncodeFixed64(buf, (2 << 16) | 1);//旧格式的vloginfo，vlog1有2个垃圾
+    ASSERT_OK(Put("vloginfo", std::string(buf, 8)));
+    Close();
+
+    InternalKeyComparator icmp(BytewiseComparator());
+    Options vopts = options;
+    vopts.comparator = &icmp;
+    TableCache table_cache(dbname_, &vopts, 10);
+    port::Mutex mu;
+    {
+        VersionSet vset(dbname_, &vopts, &table_cache, &icmp);
+        bool save_manifest;
+        ASSERT_OK(vset.Recover(&save_manifest));
+        ASSERT_EQ(0, vset.VlogHeadNumber());
+        const uint64_t vlog = vset.LogNumber();
+        const uint64_t number = vset.NewFileNumber();
+        WritableFile* file;
+        ASSERT_OK(env_->NewWritableFile(TableFileName(dbname_, number), &file));
+        TableBuilder builder(vopts, file);
+        InternalKey head("head", 0, kTypeValue);
+        EncodeFixed64(buf, vlog);//重启点在vlog开头，k和tail都要回放
+        builder.Add(head.Encode(), Slice(buf, 8));
+        ASSERT_OK(builder.Finish());
+        ASSERT_OK(file->Sync());
+        ASSERT_OK(file->Close());
+        delete file;
+        VersionEdit edit;
+        edit.AddFile(0, number, builder.FileSize(), head, head);
+        MutexLock l(&mu);
+        ASSERT_OK(vset.LogAndApply(&edit, &mu));
+    }
+
+    Reopen(&options);
+    ASSERT_OK(Put("vloginfo", "user value"));//key名已经还给用户
+    ASSERT_EQ("v", Get("k"));
+    ASSERT_EQ("NOT_FOUND", Get("head"));
+    ASSERT_EQ("NOT_FOUND", Get("tail"));
+    ASSERT_EQ("user value", Get("vloginfo"));
+    Close();
+    {
+        VersionSet vset(dbname_, &vopts, &table_cache, &icmp);
+        bool save_manifest;
+        ASSERT_OK(vset.Recover(&save_manifest));
+        ASSERT_NE(0, vset.VlogHeadNumber());
+        ASSERT_EQ(999, vset.CleanTailNumber());
+        ASSERT_EQ(5, vset.CleanTailPos());
+        ASSERT_TRUE(!vset.VlogInfo().empty());
+        ASSERT_TRUE(!VlogManager::IsLegacyFormat(vset.VlogInfo()));
+    }
+    Reopen(&options);//不会再迁移一次
+    ASSERT_EQ("user value", Get("vloginfo"));
+    ASSERT_EQ("v", Get("k"));
+}
+
 TEST(DBTest, VlogManager)
 {
     VlogManager vlog_manager(3);
-    Env* env = Env::Default();
-    log::VReader* vlog_reader[10];
     for(uint32_t i = 0; i < 10; i++)
-    {
-    std::string vlog_name = VLogFileName("db", i);
-    SequentialFile* vlr_file;
-    env->NewSequentialFile(vlog_name, &vlr_file);
-    vlog_reader[i] = new log::VReader(vlr_file, true,0);
-    vlog_manager.AddVlog(i, vlog_reader[i]);
-    }
+        vlog_manager.AddVlog(i);
         vlog_manager.AddDropCount(7);
     for(int i = 0; i< 4; i++)
     {
@@ -788,15 +2025,8 @@ TEST(DBTest, VlogManager)
     ASSERT_TRUE(vlog_manager.Serialize(str));
 
     VlogManager vlog_manager1(3);
-    log::VReader* vlog_reader1[10];
     for(uint32_t i = 0; i < 10; i++)
-    {
-    std::string vlog_name = VLogFileName("db", i);
-    SequentialFile* vlr_file;
-    env->NewSequentialFile(vlog_name, &vlr_file);
-    vlog_reader1[i] = new log::VReader(vlr_file, true,0);
-    vlog_manager1.AddVlog(i, vlog_reader1[i]);
-    }
+        vlog_manager1.AddVlog(i);
     ASSERT_TRUE(vlog_manager1.Deserialize(str));
     for(uint32_t i = 0; i < 10; i++)
     {
@@ -817,6 +2047,86 @@ TEST(DBTest, VlogManager)
         ASSERT_TRUE(!vlog_manager1.HasVlogToClean());
 }
 
+TEST(DBTest, VlogManagerWideNumbers)
+{
+    const uint64_t numbs[3] = {3, 70000, 1ull << 40};//后两个旧格式存不下
+    VlogManager vlog_manager(3);
+    for(int i = 0; i < 3; i++)
+        vlog_manager.AddVlog(numbs[i], false);
+    for(int i = 0; i < 5; i++)
+    {
+        vlog_manager.AddDropCount(numbs[1]);
+        vlog_manager.AddDropCount(numbs[2]);
+    }
+    vlog_manager.AddDeadExtent(numbs[2], 100, 50);
+    std::string str;
+    ASSERT_TRUE(vlog_manager.Serialize(str));
+    ASSERT_TRUE(!VlogManager::IsLegacyFormat(str));
+
+    VlogManager vlog_manager1(3);
+    for(int i = 0; i < 3; i++)
+        vlog_manager1.AddVlog(numbs[i], false);
+    ASSERT_TRUE(vlog_manager1.Deserialize(str));
+    for(int i = 0; i < 3; i++)
+        ASSERT_EQ(vlog_manager.GetDropCount(numbs[i]), vlog_manager1.GetDropCount(numbs[i]));
+    std::map<uint64_t, uint64_t> extents;
+    vlog_manager1.GetDeadExtents(numbs[2], &extents);
+    ASSERT_EQ(1, extents.size());
+    ASSERT_EQ(150, extents[100]);
+
+    //旧格式：(垃圾数 << 16) | vlog编号，打开数据库时会换成新格式
+    std::string legacy;
+    char buf[8];
+    EncodeFixed64(buf, (7ull << 16) | numbs[0]);
+    legacy.append(buf, 8);
+    ASSERT_TRUE(VlogManager::IsLegacyFormat(legacy));
+    VlogManager vlog_manager2(3);
+    vlog_manager2.AddVlog(numbs[0], false);
+    ASSERT_TRUE(vlog_manager2.Deserialize(legacy));
+    ASSERT_EQ(7, vlog_manager2.GetDropCount(numbs[0]));
+}
+
+TEST(DBTest, VlogManagerEstimatedDropCount)
+{
+    VlogManager vlog_manager(5);
+    for(uint32_t i = 1; i <= 3; i++)
+        vlog_manager.AddVlog(i, i == 3);
+    //估计值里已经包含了确切知道的垃圾，两者取大的，不能加起来
+    vlog_manager.AddDropCount(1);
+    vlog_manager.AddDropCount(1);
+    vlog_manager.SetEstimatedDropCount(1, 3);
+    ASSERT_EQ(2, vlog_manager.GetDropCount(1));
+    ASSERT_TRUE(!vlog_manager.HasVlogToClean());
+    ASSERT_TRUE(vlog_manager.GetVlogsToClean(4).empty());
+    ASSERT_EQ(1, vlog_manager.GetVlogsToClean(3).size());
+    vlog_manager.SetEstimatedDropCount(1, 5);
+    ASSERT_TRUE(vlog_manager.HasVlogToClean());
+    ASSERT_EQ(1, vlog_manager.GetVlogToClean());
+    std::string str;
+    ASSERT_TRUE(vlog_manager.Serialize(str));//只持久化确切的垃圾数
+    VlogManager vlog_manager1(5);
+    for(uint32_t i = 1; i <= 3; i++)
+        vlog_manager1.AddVlog(i, i == 3);
+    ASSERT_TRUE(vlog_manager1.Deserialize(str));
+    ASSERT_EQ(2, vlog_manager1.GetDropCount(1));
+    ASSERT_TRUE(!vlog_manager1.HasVlogToClean());
+}
+
+TEST(DBTest, VlogManagerSkipsColdVlog)
+{
+    VlogManager vlog_manager(3);
+    for(uint32_t i = 1; i <= 3; i++)
+        vlog_manager.AddVlog(i, i == 1);
+    vlog_manager.SetColdVlog(2);
+    for(int i = 0; i < 3; i++)
+        vlog_manager.AddDropCount(2);
+    ASSERT_TRUE(!vlog_manager.HasVlogToClean());//gc正在写的cold vlog不能回收
+    ASSERT_TRUE(vlog_manager.GetVlogsToClean(1).empty());
+    vlog_manager.SetColdVlog(3);//换下来后才能回收
+    ASSERT_TRUE(vlog_manager.HasVlogToClean());
+    ASSERT_EQ(2, vlog_manager.GetVlogToClean());
+}
+
 /*
 TEST(DBTest,garbage)
 {
@@ -1325,6 +2635,61 @@ static std::string Key(int i) {
   return std::string(buf);
 }
 
+namespace {
+struct CompactLevel1State {
+  DBImpl* db;
+  port::AtomicPointer done;
+};
+
+static void CompactLevel1(void* arg) {
+  CompactLevel1State* state = reinterpret_cast<CompactLevel1State*>(arg);
+  state->db->TEST_CompactRange(1, NULL, NULL);
+  state->done.Release_Store(state);
+}
+}  // namespace
+
+TEST(DBTest, FlushDuringCompaction) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  Reopen(&options);
+  ASSERT_OK(Put("a", "v1"));
+  ASSERT_OK(Put("z", "v1"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("a", "v2"));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("0,1,1", FilesPerLevel());
+
+  // Hold the level-1 compaction while it creates its output table
+  env_->block_table_creation_.Release_Store(env_);
+  CompactLevel1State state;
+  state.db = dbfull();
+  state.done.Release_Store(NULL);
+  env_->StartThread(&CompactLevel1, &state);
+  for (int i = 0; i < 500 && env_->table_creation_blocked_.Acquire_Load() == NULL; i++) {
+    DelayMilliseconds(10);
+  }
+  ASSERT_TRUE(env_->table_creation_blocked_.Acquire_Load() != NULL);
+
+  // The memtable is flushed on its own pool without waiting for it
+  ASSERT_OK(Put("m", "v3"));
+  ASSERT_OK(Put("z", "v3"));
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  ASSERT_TRUE(state.done.Acquire_Load() == NULL);
+  ASSERT_EQ(3, TotalTableFiles());
+
+  env_->block_table_creation_.Release_Store(NULL);
+  while (state.done.Acquire_Load() == NULL) {
+    DelayMilliseconds(10);
+  }
+  env_->table_creation_blocked_.Release_Store(NULL);
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ("v2", Get("a"));
+    ASSERT_EQ("v3", Get("m"));
+    ASSERT_EQ("v3", Get("z"));
+    Reopen(&options);
+  }
+}
+
 TEST(DBTest, MinorCompactionsHappen) {
   Options options = CurrentOptions();
   options.write_buffer_size = 10000;
@@ -1808,8 +3173,6 @@ TEST(DBTest, CustomComparator) {
    private:
     static int ToNumber(const Slice& x) {
       // Check that there are no extra characters.
-      if(x.ToString() == "head" || x.ToString() == "vloginfo")//head转化为-1
-          return -1;
       ASSERT_TRUE(x.size() >= 2 && x[0] == '[' && x[x.size()-1] == ']')
           << EscapeString(x);
       int val;
@@ -1857,13 +3220,11 @@ TEST(DBTest, ManualCompaction) {
 
   // Compaction range falls before files
   Compact("", "c");
-//  ASSERT_EQ("1,1,1", FilesPerLevel());
-  ASSERT_EQ("2,1,1", FilesPerLevel());//0层多了个只包含head的文件
+  ASSERT_EQ("1,1,1", FilesPerLevel());
 
   // Compaction range falls after files
   Compact("r", "z");
-//  ASSERT_EQ("1,1,1", FilesPerLevel());
-  ASSERT_EQ("3,1,1", FilesPerLevel());//同上
+  ASSERT_EQ("1,1,1", FilesPerLevel());
 
   // Compaction range overlaps files
   Compact("p1", "p9");
@@ -1871,19 +3232,15 @@ TEST(DBTest, ManualCompaction) {
 
   // Populate a different range
   MakeTables(3, "c", "e");
-//  ASSERT_EQ("1,1,2", FilesPerLevel());
-//  因为第2层的文件含有head，所以会和2层文件有冲突，因此第一个产生的ce文件会放在第一层，第二个ce会在
-//  0层，第三个也在0层
-  ASSERT_EQ("2,1,1", FilesPerLevel());
+  ASSERT_EQ("1,1,2", FilesPerLevel());
 
   // Compact just the new range
   Compact("b", "f");
-//  ASSERT_EQ("0,0,2", FilesPerLevel());//因为第二层不包含ce文件，所以不会进行合并
-  ASSERT_EQ("0,1,1", FilesPerLevel());
+  ASSERT_EQ("0,0,2", FilesPerLevel());
+
   // Compact all
   MakeTables(1, "a", "z");
-//  ASSERT_EQ("0,1,2", FilesPerLevel());
-  ASSERT_EQ("1,1,1", FilesPerLevel());
+  ASSERT_EQ("0,1,2", FilesPerLevel());
   db_->CompactRange(NULL, NULL);
   ASSERT_EQ("0,0,1", FilesPerLevel());
 }
@@ -2236,6 +3593,86 @@ TEST(DBTest, MultiThreaded) {
   } while (ChangeOptions());
 }
 
+// Gets and puts race with compactions that drop garbage and relocate
+// values, and with GC that rewrites and deletes whole vlogs.
+TEST(DBTest, ConcurrentGarbageCollect) {
+  Options options = CurrentOptions();
+  options.clean_threshold = 30;
+  options.min_clean_threshold = 1;
+  options.max_vlog_size = 200000;
+  options.write_buffer_size = 100000;
+  Reopen(&options);
+
+  MTState mt;
+  mt.test = this;
+  mt.stop.Release_Store(0);
+  for (int id = 0; id < kNumThreads; id++) {
+    mt.counter[id].Release_Store(0);
+    mt.thread_done[id].Release_Store(0);
+  }
+  MTThread thread[kNumThreads];
+  for (int id = 0; id < kNumThreads; id++) {
+    thread[id].state = &mt;
+    thread[id].id = id;
+    env_->StartThread(MTThreadBody, &thread[id]);
+  }
+
+  // Background GC picks up vlogs as compactions count their garbage.
+  const uint64_t end = env_->NowMicros() + kTestSeconds * 1000000;
+  while (env_->NowMicros() < end) {
+    db_->CompactRange(NULL, NULL);
+    DelayMilliseconds(100);
+  }
+
+  mt.stop.Release_Store(&mt);
+  for (int id = 0; id < kNumThreads; id++) {
+    while (mt.thread_done[id].Acquire_Load() == NULL) {
+      DelayMilliseconds(100);
+    }
+  }
+  ASSERT_TRUE(!env_->FileExists(VLogFileName(dbname_, 1)));
+  std::string value;
+  for (int key = 0; key < kNumKeys; key++) {
+    char keybuf[20];
+    snprintf(keybuf, sizeof(keybuf), "%016d", key);
+    Status s = db_->Get(ReadOptions(), keybuf, &value);
+    if (!s.IsNotFound()) {
+      ASSERT_OK(s);
+      int k, w, c;
+      ASSERT_EQ(3, sscanf(value.c_str(), "%d.%d.%d", &k, &w, &c)) << value;
+      ASSERT_EQ(k, key);
+    }
+  }
+}
+
+TEST(DBTest, ReadViewFollowsFlushAndCompaction) {
+  for (int i = 0; i < 3; i++) {
+    ASSERT_OK(Put("foo", "v" + NumberToString(i)));
+    ASSERT_OK(Put("bar" + NumberToString(i), "b"));
+    dbfull()->TEST_CompactMemTable();
+    ASSERT_EQ("v" + NumberToString(i), Get("foo"));
+  }
+  ASSERT_OK(Put("foo", "v3"));
+  ASSERT_EQ("v3", Get("foo"));
+
+  // The view cached by the Get above must not keep the merged tables alive
+  dbfull()->TEST_CompactMemTable();
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ("v3", Get("foo"));
+  ASSERT_EQ("b", Get("bar1"));
+  std::vector<std::string> files;
+  env_->GetChildren(dbname_, &files);
+  uint64_t number;
+  FileType type;
+  int tables = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (ParseFileName(files[i], &number, &type) && type == kTableFile) {
+      tables++;
+    }
+  }
+  ASSERT_EQ(TotalTableFiles(), tables);
+}
+
 namespace {
 typedef std::map<std::string, std::string> KVMap;
 }
@@ -118,6 +118,43 @@ bool InternalFilterPolicy::KeyMayMatch(const Slice& key, const Slice& f) const {
   return user_policy_->KeyMayMatch(ExtractUserKey(key), f);
 }
 
+void EncodeValuePtr(std::string* dst, uint64_t size,
+                    uint64_t file_numb, uint64_t pos) {
+  PutVarint64(dst, size);
+  PutVarint64(dst, file_numb);
+  PutVarint64(dst, pos);
+}
+
+bool DecodeValuePtr(Slice ptr, uint64_t* size,
+                    uint64_t* file_numb, uint64_t* pos) {
+  return GetVarint64(&ptr, size) &&
+         GetVarint64(&ptr, file_numb) &&
+         GetVarint64(&ptr, pos);
+}
+
+uint64_t ValuePtrExpiration(Slice ptr) {
+  uint64_t size, file_numb, pos, expiration;
+  if (GetVarint64(&ptr, &size) && GetVarint64(&ptr, &file_numb) &&
+      GetVarint64(&ptr, &pos) && !ptr.empty() &&
+      GetVarint64(&ptr, &expiration)) {
+    return expiration;
+  }
+  return 0;
+}
+
+void AddVlogRef(const Slice& internal_key, const Slice& value,
+                std::map<uint64_t, uint64_t>* refs) {
+  ParsedInternalKey ikey;
+  if (!ParseInternalKey(internal_key, &ikey) || ikey.type != kTypeValue) {
+    // Deletions carry no value
+    return;
+  }
+  uint64_t size, file_numb, pos;
+  if (DecodeValuePtr(value, &size, &file_numb, &pos)) {
+    (*refs)[file_numb] += size;
+  }
+}
+
 LookupKey::LookupKey(const Slice& user_key, SequenceNumber s) {
   size_t usize = user_key.size();
   size_t needed = usize + 13;  // A conservative estimate
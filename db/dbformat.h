@@ -6,6 +6,7 @@
 #define STORAGE_LEVELDB_DB_DBFORMAT_H_
 
 #include <stdio.h>
+#include <map>
 #include "leveldb/comparator.h"
 #include "leveldb/db.h"
 #include "leveldb/filter_policy.h"
@@ -52,6 +53,10 @@ enum ValueType {
   kTypeDeletion = 0x0,
   kTypeValue = 0x1
 };
+// Tags that only appear in write batches stored in vlogs, never in
+// internal keys (see write_batch.cc).
+static const int kTypeExpiringValue = 0x2;  // value written with a TTL
+static const int kTypeValueRef = 0x3;       // pointer to an expiring value
 // kValueTypeForSeek defines the ValueType that should be passed when
 // constructing a ParsedInternalKey object for seeking to a particular
 // sequence number (since we sort sequence numbers in decreasing order
@@ -185,6 +190,35 @@ inline bool ParseInternalKey(const Slice& internal_key,
   return (c <= static_cast<unsigned char>(kTypeValue));
 }
 
+// Values kept in the LSM are pointers into a vlog file:
+//    size:  varint64   length of the vlog entry (tag + key + value)
+//    file:  varint64   number of the vlog holding the entry
+//    pos:   varint64   offset of the entry inside that vlog
+// Older releases wrote "file" as a varint32, which encodes every number
+// that fits in 32 bits to the same bytes, so their pointers still parse.
+extern void EncodeValuePtr(std::string* dst, uint64_t size,
+                           uint64_t file_numb, uint64_t pos);
+
+// Parse a value pointer produced by EncodeValuePtr().  Returns false
+// if "ptr" is not a well-formed pointer.
+extern bool DecodeValuePtr(Slice ptr, uint64_t* size,
+                           uint64_t* file_numb, uint64_t* pos);
+
+// Pointers to values written with a TTL carry one more field:
+//    expire: varint64   seconds since the epoch at which the value is gone
+// Returns the expiration of "ptr", or 0 if the value never expires.
+extern uint64_t ValuePtrExpiration(Slice ptr);
+
+inline bool ValuePtrExpired(const Slice& ptr, uint64_t now_seconds) {
+  const uint64_t expiration = ValuePtrExpiration(ptr);
+  return expiration != 0 && expiration <= now_seconds;
+}
+
+// If the table entry "internal_key" -> "value" points into a vlog, add
+// the size of the pointed-to record to (*refs)[vlog number].
+extern void AddVlogRef(const Slice& internal_key, const Slice& value,
+                       std::map<uint64_t, uint64_t>* refs);
+
 // A helper class useful for DBImpl::Get()
 class LookupKey {
  public:
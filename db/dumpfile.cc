@@ -6,6 +6,7 @@
 #include "db/dbformat.h"
 #include "db/filename.h"
 #include "db/log_reader.h"
+#include "db/vlog_reader.h"
 #include "db/version_edit.h"
 #include "db/write_batch_internal.h"
 #include "leveldb/env.h"
@@ -136,6 +137,41 @@ static void VersionEditPrinter(uint64_t pos, Slice record, WritableFile* dst) {
   dst->Append(r);
 }
 
+// Print contents of a value log, one WriteBatch per record.
+class VlogCorruptionReporter : public log::VReader::Reporter {
+ public:
+  WritableFile* dst_;
+  virtual void Corruption(size_t bytes, const Status& status) {
+    std::string r = "corruption: ";
+    AppendNumberTo(&r, bytes);
+    r += " bytes; ";
+    r += status.ToString();
+    r.push_back('\n');
+    dst_->Append(r);
+  }
+};
+
+Status DumpVlog(Env* env, const std::string& fname, WritableFile* dst) {
+  SequentialFile* file;
+  Status s = env->NewSequentialFile(fname, &file);
+  if (!s.ok()) {
+    return s;
+  }
+  VlogCorruptionReporter reporter;
+  reporter.dst_ = dst;
+  log::VReader reader(file, &reporter, true, 0);  // Takes ownership of file
+  reader.EnableReadahead(env, Options().vlog_readahead_size);
+  Slice record;
+  std::string scratch;
+  uint64_t pos = 0;
+  int head_size = 0;
+  while (reader.ReadRecord(&record, &scratch, head_size)) {
+    WriteBatchPrinter(pos, record, dst);
+    pos += head_size + record.size();
+  }
+  return Status::OK();
+}
+
 Status DumpDescriptor(Env* env, const std::string& fname, WritableFile* dst) {
   return PrintLogContents(env, fname, VersionEditPrinter, dst);
 }
@@ -214,6 +250,7 @@ Status DumpFile(Env* env, const std::string& fname, WritableFile* dst) {
   }
   switch (ftype) {
     case kLogFile:         return DumpLog(env, fname, dst);
+    case kVLogFile:        return DumpVlog(env, fname, dst);
     case kDescriptorFile:  return DumpDescriptor(env, fname, dst);
     case kTableFile:       return DumpTable(env, fname, dst);
     default:
@@ -547,6 +547,27 @@ TEST(FaultInjectionTest, FaultTestWithLogReuse) {
   DoTest();
 }
 
+// A synced write must also make durable the TTL values that earlier,
+// unsynced writes referenced.
+TEST(FaultInjectionTest, SyncCoversTtlValues) {
+  // The MANIFEST written by NewDB is never synced, open onto a fresh one.
+  ReuseLogs(false);
+  ASSERT_OK(OpenDB());
+  std::string key_space, value_space;
+  WriteOptions ttl_options;
+  ttl_options.ttl = 3600;
+  ASSERT_OK(db_->Put(ttl_options, Key(0, &key_space), Value(0, &value_space)));
+  WriteOptions sync_options;
+  sync_options.sync = true;
+  ASSERT_OK(db_->Put(sync_options, Key(1, &key_space), Value(1, &value_space)));
+
+  env_->SetFilesystemActive(false);
+  CloseDB();
+  ResetDBState(RESET_DROP_UNSYNCED_DATA);
+  ASSERT_OK(OpenDB());
+  ASSERT_OK(Verify(0, 2, FaultInjectionTest::VAL_EXPECT_NO_ERROR));
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
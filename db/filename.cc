@@ -32,6 +32,12 @@ std::string VLogFileName(const std::string& name, uint64_t number) {
 //  assert(number > 0);
   return MakeFileName(name, number, "vlog");
 }
+std::string VFwdFileName(const std::string& name, uint64_t number) {
+  return MakeFileName(name, number, "vfwd");
+}
+std::string VFreeFileName(const std::string& name, uint64_t number) {
+  return MakeFileName(name, number, "vfree");
+}
 
 std::string TableFileName(const std::string& name, uint64_t number) {
   assert(number > 0);
@@ -119,6 +125,12 @@ bool ParseFileName(const std::string& fname,
     else if (suffix == Slice(".vlog")) {
       *type = kVLogFile;
     }
+    else if (suffix == Slice(".vfwd")) {
+      *type = kVFwdFile;
+    }
+    else if (suffix == Slice(".vfree")) {
+      *type = kVFreeFile;
+    }
     else if (suffix == Slice(".sst") || suffix == Slice(".ldb")) {
       *type = kTableFile;
     } else if (suffix == Slice(".dbtmp")) {
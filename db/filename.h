@@ -20,6 +20,8 @@ class Env;
 enum FileType {
   kLogFile,
   kVLogFile,
+  kVFwdFile,
+  kVFreeFile,
   kDBLockFile,
   kTableFile,
   kDescriptorFile,
@@ -33,6 +35,10 @@ enum FileType {
 // "dbname".
 extern std::string LogFileName(const std::string& dbname, uint64_t number);
 extern std::string VLogFileName(const std::string& dbname, uint64_t number);
+//vlog被gc搬走的值的转发表，编号和vlog相同
+extern std::string VFwdFileName(const std::string& dbname, uint64_t number);
+//回收后等待重用的vlog文件，编号是它原来作为vlog时的编号
+extern std::string VFreeFileName(const std::string& dbname, uint64_t number);
 
 // Return the name of the sstable with the specified number
 // in the db named by "dbname".  The result will be prefixed with
@@ -28,6 +28,8 @@ TEST(FileNameTest, Parse) {
     { "0.log",              0,     kLogFile },
     { "0.sst",              0,     kTableFile },
     { "0.ldb",              0,     kTableFile },
+    { "7.vfwd",             7,     kVFwdFile },
+    { "9.vfree",            9,     kVFreeFile },
     { "CURRENT",            0,     kCurrentFile },
     { "LOCK",               0,     kDBLockFile },
     { "MANIFEST-2",         2,     kDescriptorFile },
@@ -1,27 +1,191 @@
 #include "db/garbage_collector.h"
+#include <algorithm>
 #include "leveldb/slice.h"
 #include "db/write_batch_internal.h"
 #include "db/db_impl.h"
 #include "fcntl.h"
 #include "db/filename.h"
+#include "db/version_set.h"
 
 namespace leveldb{
 
+static const uint64_t kBatchHeader = 12;//batch的头部长
+
+GarbageCollector::GarbageCollector(DBImpl* db)
+    : vlog_number_(0),
+      garbage_pos_(0),
+      vlog_reader_(NULL),
+      db_(db),
+      forwarding_(db->options_.vlog_forwarding),
+      forward_file_(NULL),
+      forward_log_(NULL),
+      manual_(false),
+      bytes_per_second_(0),
+      start_micros_(0),
+      scanned_(0),
+      unreported_scanned_(0),
+      unreported_relocated_(0),
+      unreported_freed_(0)
+{
+}
+
+GarbageCollector::~GarbageCollector()
+{
+    delete vlog_reader_;
+    delete forward_log_;
+    delete forward_file_;
+}
+
 void GarbageCollector::SetVlog(uint64_t vlog_number, uint64_t garbage_beg_pos)
 {
+    db_->mutex_.Lock();
+    db_->vlog_manager_.GetDeadExtents(vlog_number, &dead_extents_);
+    std::string file_name = db_->VLogFilePath(vlog_number);
+    db_->mutex_.Unlock();
     SequentialFile* vlr_file;
-    db_->options_.env->NewSequentialFile(VLogFileName(db_->dbname_, vlog_number), &vlr_file);
-    vlog_reader_ = new log::VReader(vlr_file, true,0);
+    db_->options_.env->NewSequentialFile(file_name, &vlr_file);
+    //打过洞的记录校验和对不上
+    vlog_reader_ = new log::VReader(vlr_file, dead_extents_.empty(),0);
+    vlog_reader_->EnableReadahead(db_->env_, db_->options_.vlog_readahead_size);
     vlog_number_ = vlog_number;
     garbage_pos_ = garbage_beg_pos;
 }
 
-void GarbageCollector::BeginGarbageCollect()
+void GarbageCollector::SetManual(uint64_t bytes_per_second)
+{
+    manual_ = true;
+    bytes_per_second_ = bytes_per_second;
+    start_micros_ = db_->env_->NowMicros();
+}
+
+void GarbageCollector::ReportProgress()
+{
+    if(!manual_)
+        return;
+    db_->AddManualCleanProgress(unreported_scanned_, unreported_relocated_, unreported_freed_);
+    unreported_scanned_ = 0;
+    unreported_relocated_ = 0;
+    unreported_freed_ = 0;
+}
+
+void GarbageCollector::ManualTick(uint64_t record_size)
+{
+    scanned_ += record_size;
+    unreported_scanned_ += record_size;
+    if(unreported_scanned_ >= (1 << 20))
+        ReportProgress();
+    if(bytes_per_second_ > 0)
+    {//读得比限速快就睡一会儿，一次最多睡100ms，这样取消和关闭数据库不用等太久
+        uint64_t expect = scanned_ * 1000000 / bytes_per_second_;
+        uint64_t elapsed = db_->env_->NowMicros() - start_micros_;
+        if(expect > elapsed)
+            db_->env_->SleepForMicroseconds(static_cast<int>(std::min<uint64_t>(expect - elapsed, 100000)));
+    }
+}
+
+namespace {
+class PtrCollector : public WriteBatch::Handler {
+ public:
+  std::vector<std::string> ptrs_;
+  virtual void Put(const Slice& key, const Slice& value) {
+    ptrs_.push_back(value.ToString());
+  }
+  virtual void Delete(const Slice& key) { }
+};
+}  // namespace
+
+Status GarbageCollector::FlushRelocations()
+{
+    Status s;
+    if(WriteBatchInternal::Count(&relocate_batch_) == 0)
+        return s;
+    unreported_relocated_ += WriteBatchInternal::ByteSize(&relocate_batch_) - kBatchHeader;
+    //整个batch一次顺序追加到cold vlog，不经过用户的写队列和用户vlog
+    uint64_t pos, file_numb;
+    s = db_->AddColdRecord(&relocate_batch_, &pos, &file_numb);
+    if(s.ok())
+    {
+        if(forwarding_)
+            s = AddForwards(pos, file_numb);
+        else
+            s = db_->WriteRelocations(&relocate_batch_, old_ptrs_, pos, file_numb);
+    }
+    relocate_batch_.Clear();
+    old_ptrs_.clear();
+    old_pos_.clear();
+    return s;
+}
+
+Status GarbageCollector::AddForwards(uint64_t pos, uint64_t file_numb)
+{
+    PtrCollector collector;
+    Status s = relocate_batch_.Iterate(&collector, pos, file_numb);
+    if(!s.ok())
+        return s;
+    assert(collector.ptrs_.size() == old_pos_.size());
+    std::vector<VlogManager::Forward> forwards;
+    for(size_t i = 0; i < collector.ptrs_.size(); i++)
+    {
+        VlogManager::Forward f;
+        uint64_t size;
+        if(!DecodeValuePtr(collector.ptrs_[i], &size, &f.new_file_, &f.new_pos_))
+            return Status::Corruption("parse relocated value pointer false");
+        f.old_pos_ = old_pos_[i];
+        forwards.push_back(f);
+    }
+    if(forward_log_ == NULL)
+    {//转发文件只会追加，恢复时会把没有落盘的部分截掉
+        std::string fname = VFwdFileName(db_->dbname_, vlog_number_);
+        uint64_t file_size = 0;
+        if(db_->env_->FileExists(fname))
+            s = db_->env_->GetFileSize(fname, &file_size);
+        if(s.ok())
+            s = db_->env_->NewAppendableFile(fname, &forward_file_);
+        if(!s.ok())
+            return s;
+        forward_log_ = new log::Writer(forward_file_, file_size);
+    }
+    std::string record;
+    VlogManager::EncodeForwards(forwards, &record);
+    s = forward_log_->AddRecord(record);
+    if(s.ok())
+    {//cold vlog里的值已经写进去了，读路径马上就可以走转发
+        for(size_t i = 0; i < forwards.size(); i++)
+            db_->vlog_manager_.AddForward(vlog_number_, forwards[i]);
+    }
+    return s;
+}
+
+Status GarbageCollector::SyncForwards()
+{
+    if(forward_file_ == NULL)
+        return Status::OK();
+    return forward_file_->Sync();
+}
+
+Status GarbageCollector::Checkpoint()
+{
+    Status s = FlushRelocations();
+    if(s.ok())
+        s = db_->SyncColdVlog();//sst里的新指针指向cold vlog，cold vlog要先落盘
+    if(s.ok())
+        s = SyncForwards();//转发指向cold vlog，同样要在cold vlog之后落盘
+    if(s.ok())
+    {
+        db_->SetCleanTail(vlog_number_, garbage_pos_);
+        s = db_->FlushMemTable();
+    }
+    Log(db_->options_.info_log,"clean vlog %lu checkpoint at %lu: %s\n",
+        vlog_number_, garbage_pos_, s.ToString().c_str());
+    return s;
+}
+
+bool GarbageCollector::BeginGarbageCollect()
 {
     uint64_t garbage_pos = garbage_pos_;
+    uint64_t checkpoint_pos = garbage_pos_;//该位置之前搬迁的指针都已经刷到sst了
     Slice record;
     std::string str;
-    WriteOptions write_options;
     if(garbage_pos_ > 0)
     {
         if(!vlog_reader_->SkipToPos(garbage_pos_))//从指定位置开始回收
@@ -32,11 +196,15 @@ void GarbageCollector::BeginGarbageCollect()
     Log(db_->options_.info_log,"begin clean %lu in %lu\n", garbage_pos_, vlog_number_);
 
     Slice key,value;
-    WriteBatch batch, clean_valid_batch;
+    WriteBatch batch;
     std::string val;
     bool isEndOfFile = false;
-    while(!db_->IsShutDown())//db关了
+    Status s;
+    bool deleted = false;
+    while(!db_->IsShutDown() && s.ok())//db关了
     {
+        if(manual_ && db_->IsManualCleanCancelled())
+            break;
         int head_size = 0;
         if(!vlog_reader_->ReadRecord(&record, &str, head_size))//读日志记录读取失败了
         {
@@ -47,37 +215,71 @@ void GarbageCollector::BeginGarbageCollect()
         garbage_pos_ += head_size;
         WriteBatchInternal::SetContents(&batch, record);//会把record的内容拷贝到batch中去
         ReadOptions read_options;
+        read_options.fill_cache = false;//gc扫到的key大多是冷的，别挤掉缓存里的热点
         uint64_t size = record.size();//size是整个batch的长度，包括batch头
         uint64_t pos = 0;//是相对batch起始位置的偏移
         uint64_t old_garbage_pos = garbage_pos_;
+        if(WriteBatchInternal::Count(&batch) == 0)
+            pos = size;//cold vlog开头的空batch
         while(pos < size)//遍历batch看哪些kv有效
         {
+            if(!dead_extents_.empty())
+            {//失效区间可能已经被打洞了，内容全是0没法解析，直接跳过
+                if(pos < kBatchHeader)
+                    pos = kBatchHeader;
+                std::map<uint64_t, uint64_t>::const_iterator extent = dead_extents_.find(old_garbage_pos + pos);
+                if(extent != dead_extents_.end())
+                {
+                    pos = extent->second - old_garbage_pos;
+                    garbage_pos_ = old_garbage_pos + pos;
+                    continue;
+                }
+            }
             bool isDel = false;
-            Status s =WriteBatchInternal::ParseRecord(&batch, pos, key, value, isDel);//解析完一条kv后pos是下一条kv的pos
-            assert(s.ok());
+            Status ps = WriteBatchInternal::ParseRecord(&batch, pos, key, value, isDel);//解析完一条kv后pos是下一条kv的pos
+            if(!ps.ok())
+            {//不能确定后面的kv是否有效，不能删除该vlog
+                s = ps;
+                break;
+            }
             garbage_pos_ = old_garbage_pos + pos;
 
             //log文件里的delete记录可以直接丢掉，因为sst文件会记录
-            if(!isDel && db_->GetPtr(read_options, key, &val).ok())
+            //有key索引时直接查索引，不用到lsm里找
+            if(!isDel && (db_->key_index_ != NULL ? db_->key_index_->Get(key, &val) :
+                                                     db_->GetPtr(read_options, key, &val).ok()))
             {
-                uint64_t code = DecodeFixed64(val.data());
-                size_t size = code & 0xffffff;
-                code = code>>24;
-                uint64_t file_numb = code & 0xff;
-                uint64_t item_pos = code>>8;
-                if(item_pos + size == garbage_pos_ && file_numb == vlog_number_ )
-                {
-                    clean_valid_batch.Put(key, value);
+                uint64_t item_size, item_pos;
+                uint64_t file_numb;
+                if(DecodeValuePtr(val, &item_size, &file_numb, &item_pos))
+                {//lsm里的指针可能已经被转发到别的vlog了
+                    db_->vlog_manager_.ResolveForward(&file_numb, &item_pos);
+                    if(item_pos + item_size == garbage_pos_ && file_numb == vlog_number_)
+                    {
+                        relocate_batch_.Put(key, value);
+                        old_ptrs_.push_back(val);
+                        old_pos_.push_back(item_pos);
+                    }
                 }
             }
         }
+        if(!s.ok())
+            break;
         assert(pos == size);
-        if(WriteBatchInternal::ByteSize(&clean_valid_batch) > db_->options_.clean_write_buffer_size)
+        garbage_pos_ = old_garbage_pos + size;
+        if(WriteBatchInternal::ByteSize(&relocate_batch_) > db_->options_.clean_write_buffer_size)
         {//clean_write_buffer_size必须要大于12才行，12是batch的头部长，创建batch或者clear batch后的初始大小就是12
-            Status s = db_->Write(write_options, &clean_valid_batch);
-            assert(s.ok());
-            clean_valid_batch.Clear();
+            s = FlushRelocations();
         }
+        if(s.ok() && db_->options_.clean_checkpoint_size > 0 &&
+           garbage_pos_ - checkpoint_pos >= db_->options_.clean_checkpoint_size)
+        {
+            s = Checkpoint();
+            if(s.ok())
+                checkpoint_pos = garbage_pos_;
+        }
+        if(manual_)
+            ManualTick(head_size + size);
     }
 
 #ifndef NDEBUG
@@ -89,34 +291,51 @@ void GarbageCollector::BeginGarbageCollect()
     else
         Log(db_->options_.info_log," clean stop by unknown reason\n");
 #endif
-    if(WriteBatchInternal::Count(&clean_valid_batch) > 0)
-    {
-        Status s = db_->Write(write_options, &clean_valid_batch);
-        assert(s.ok());
-        clean_valid_batch.Clear();
-    }
+    if(s.ok())
+        s = FlushRelocations();
+    if(s.ok())
+        s = db_->SyncColdVlog();
+    if(s.ok())
+        s = SyncForwards();
 
     if(garbage_pos_ - garbage_pos > 0)
     {
-        if(isEndOfFile)
+        //搬迁后的新指针只在memtable里，必须先刷到sst文件才能删除旧vlog；
+        //转发模式下lsm没变，转发文件已经落盘，可以直接删，除非恢复时还要回放这个vlog
+        if(isEndOfFile && s.ok())
+        {
+            db_->SetCleanTail(0, 0);//该vlog回收完了，不用再接着回收
+            db_->mutex_.Lock();
+            const bool replayed = vlog_number_ >= db_->versions_->LogNumber();
+            db_->mutex_.Unlock();
+            if(!forwarding_ || replayed)
+                s = db_->FlushMemTable();
+        }
+        if(isEndOfFile && s.ok())
         {
-            std::string file_name = VLogFileName(db_->dbname_, vlog_number_);
-            db_->env_->DeleteFile(file_name);
+            db_->mutex_.Lock();
+            std::string file_name = db_->VLogFilePath(vlog_number_);
+            uint64_t file_size = 0;
+            db_->env_->GetFileSize(file_name, &file_size);
+            if(!db_->RecycleVlogFile(vlog_number_, file_name))//留着重用的文件空间没有释放
+                unreported_freed_ += file_size;
+            db_->mutex_.Unlock();
+            deleted = true;
             Log(db_->options_.info_log,"clean vlog %lu ok and delete it\n", vlog_number_);
         }
         else
         {
-            vlog_reader_->DeallocateDiskSpace(garbage_pos, garbage_pos_ - garbage_pos);
-            char buf[8];
-            Slice v(buf, 8);
-            EncodeFixed64(buf, (garbage_pos_ << 24) | vlog_number_ );
-            Log(db_->options_.info_log,"clean vlog %lu stop in %lu \n", vlog_number_, garbage_pos_);
-            Status s = db_->Put(write_options, "tail", v);//head不会出现在vlog中，但tail会
-            assert(s.ok());
-     //这里有个坑，put不一定成功如果是因为数据库正在关闭而退出上述循环，这时候插入tail会失败
-     //因为makeroom会返回失败，因为合并操作会将bg_error_设置为io error,为了填坑，我把因为数据库关闭而引起的bg_error
-     //设为特殊的error，详见db_impl.cc的MakeRoomForWrite函数
+            //新指针还在memtable里，回收位置随它一起刷到sst时才生效，在这之前重启会从上一个检查点重新回收，
+            //条件更新保证重复搬迁不会覆盖用户的新值
+            Log(db_->options_.info_log,"clean vlog %lu stop in %lu, resume from %lu: %s\n",
+                vlog_number_, garbage_pos_, checkpoint_pos, s.ToString().c_str());
+            if(s.ok() && manual_ && db_->IsManualCleanCancelled())
+                db_->SetCleanTail(0, 0);//取消了就不要重启后接着回收
+            else if(s.ok())
+                db_->SetCleanTail(vlog_number_, garbage_pos_);
         }
     }
+    ReportProgress();
+    return deleted;
 }
 }
@@ -1,27 +1,64 @@
-
 #ifndef STORAGE_LEVELDB_DB_GARBAGE_COLLECTOR_H_
 #define STORAGE_LEVELDB_DB_GARBAGE_COLLECTOR_H_
 
 #include "stdint.h"
+#include <map>
+#include <string>
+#include <vector>
+#include "db/log_writer.h"
 #include "db/vlog_reader.h"
+#include "leveldb/status.h"
+#include "leveldb/write_batch.h"
 
 namespace leveldb{
 class VReader;
 class DBImpl;
+class WritableFile;
 
 class GarbageCollector
 {
     public:
-        GarbageCollector(DBImpl* db):db_(db){}
-        ~GarbageCollector(){delete vlog_reader_;}
+        GarbageCollector(DBImpl* db);
+        ~GarbageCollector();
         void SetVlog(uint64_t vlog_number, uint64_t garbage_beg_pos=0);
-        void BeginGarbageCollect();
+        //手动gc：汇报进度，可以被取消，每秒最多读bytes_per_second字节的vlog，0代表不限速
+        void SetManual(uint64_t bytes_per_second);
+        //返回true代表整个vlog回收完并删掉了
+        bool BeginGarbageCollect();
 
     private:
+        //把relocate_batch_里的有效kv追加到cold vlog，然后有条件地更新lsm中的指针
+        Status FlushRelocations();
+        //转发模式下不改lsm，把relocate_batch_里每条kv的新位置追加到被回收vlog的转发表
+        Status AddForwards(uint64_t pos, uint64_t file_numb);
+        Status SyncForwards();
+        //把到garbage_pos_为止搬迁的指针刷到sst，同一个manifest记录里保存回收位置，重启后从这里接着回收
+        Status Checkpoint();
+        //手动gc每读一条vlog记录调用一次，汇报进度并限速
+        void ManualTick(uint64_t record_size);
+        void ReportProgress();
+
         uint64_t vlog_number_;
         uint64_t garbage_pos_;//vlog文件起始垃圾回收的地方
         log::VReader* vlog_reader_;
         DBImpl* db_;
+
+        WriteBatch relocate_batch_;//待搬迁的有效kv
+        std::vector<std::string> old_ptrs_;//relocate_batch_中每条kv搬迁前在lsm中的指针
+        std::vector<uint64_t> old_pos_;//relocate_batch_中每条kv在被回收vlog里的位置
+
+        bool forwarding_;//options.vlog_forwarding
+        WritableFile* forward_file_;//第一次有转发时才打开
+        log::Writer* forward_log_;
+        std::map<uint64_t, uint64_t> dead_extents_;//该vlog里已知的失效区间，可能已经打过洞
+
+        bool manual_;
+        uint64_t bytes_per_second_;
+        uint64_t start_micros_;
+        uint64_t scanned_;//本次一共读了多少字节
+        uint64_t unreported_scanned_;//还没有汇报的进度
+        uint64_t unreported_relocated_;
+        uint64_t unreported_freed_;
 };
 
 }
@@ -0,0 +1,220 @@
+#include "db/garbage_sampler.h"
+#include <math.h>
+#include <vector>
+#include "db/db_impl.h"
+#include "db/filename.h"
+#include "db/write_batch_internal.h"
+#include "leveldb/write_batch.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+#include "util/random.h"
+
+namespace leveldb{
+
+static const uint64_t kBatchHeader = 12;//batch的头部长
+static const size_t kSampleWindow = 64 << 10;//每次随机读这么多字节，在里面找记录头
+static const double kConfidenceZ = 1.96;//95%置信度
+
+GarbageSampler::GarbageSampler(DBImpl* db)
+    : db_(db)
+{
+}
+
+bool GarbageSampler::FindRecord(uint64_t vlog_numb, const Slice& window, uint64_t off,
+                                uint64_t file_size, uint64_t* record_pos,
+                                uint64_t* head_size, Slice* record, std::string* scratch)
+{
+    const char* limit = window.data() + window.size();
+    for(size_t i = 0; i + 4 < window.size(); i++)
+    {
+        const char* p = window.data() + i;
+        uint64_t length;
+        const char* q = GetVarint64Ptr(p + 4, limit, &length);
+        if(q == NULL)
+            continue;
+        uint64_t head = q - p;
+        //最短的一条kv也要tag加上key长两个字节
+        if(length < kBatchHeader + 2 || off + i + head + length > file_size)
+            continue;
+        if(q + kBatchHeader > limit)
+            continue;
+        uint32_t count = DecodeFixed32(q + 8);
+        if(count == 0 || count > length)
+            continue;
+        Slice contents;
+        if(q + length <= limit)
+        {
+            contents = Slice(q, length);
+        }
+        else
+        {//记录比窗口剩下的部分长，单独读一次
+            size_t n = 0;
+            scratch->resize(length);
+            if(!db_->ReadVlog(vlog_numb, off + i + head, length, &(*scratch)[0], &n).ok() ||
+               n != length)
+                continue;
+            contents = Slice(*scratch);
+        }
+        if(crc32c::Unmask(DecodeFixed32(p)) != crc32c::Value(contents.data(), contents.size()))
+            continue;
+        *record_pos = off + i;
+        *head_size = head;
+        *record = contents;
+        return true;
+    }
+    return false;
+}
+
+bool GarbageSampler::ReadHeader(uint64_t vlog_numb, uint64_t pos, uint64_t file_size,
+                                uint64_t* head_size, uint64_t* length)
+{
+    char buf[4 + 10];
+    size_t n = 0;
+    if(!db_->ReadVlog(vlog_numb, pos, sizeof(buf), buf, &n).ok())
+        return false;
+    const char* q = GetVarint64Ptr(buf + 4, buf + n, length);
+    if(q == NULL)
+        return false;
+    *head_size = q - buf;
+    return *length >= kBatchHeader && pos + *head_size + *length <= file_size;
+}
+
+bool GarbageSampler::FindContainingRecord(uint64_t vlog_numb, uint64_t off, uint64_t file_size,
+                                          uint64_t* record_pos, uint64_t* head_size,
+                                          Slice* record, std::string* scratch)
+{
+    //从off往前找一条crc对得上的记录，再按长度往后走到包含off的那条；
+    //off前面的窗口里找不到完整的记录头说明包含off的记录很长，窗口往前加倍
+    std::string window;
+    for(uint64_t back = kSampleWindow; ; back *= 2)
+    {
+        const uint64_t start = off > back ? off - back : 0;
+        window.resize(off - start + 4 + 10 + kBatchHeader);//off处开始的记录头也要在窗口里
+        size_t n = 0;
+        if(!db_->ReadVlog(vlog_numb, start, window.size(), &window[0], &n).ok())
+            return false;
+        uint64_t pos, head, length;
+        Slice anchor;
+        if(FindRecord(vlog_numb, Slice(window.data(), n), start, file_size,
+                      &pos, &head, &anchor, scratch) && pos <= off)
+        {
+            length = anchor.size();
+            while(pos + head + length <= off)
+            {//记录是首尾相接的，按长度走不用再校验crc
+                pos += head + length;
+                if(!ReadHeader(vlog_numb, pos, file_size, &head, &length))
+                    return false;
+            }
+            //打过洞的记录crc对不上，但洞只在value里，kv的结构还在
+            scratch->resize(length);
+            if(!db_->ReadVlog(vlog_numb, pos + head, length, &(*scratch)[0], &n).ok() ||
+               n != length)
+                return false;
+            *record_pos = pos;
+            *head_size = head;
+            *record = Slice(*scratch);
+            return true;
+        }
+        if(start == 0)
+            return false;
+    }
+}
+
+uint64_t GarbageSampler::CheckRecord(uint64_t vlog_numb, uint64_t batch_pos,
+                                     const Slice& record, uint64_t* dead)
+{//和gc判断有效性的方法一样：lsm里这个key最新的指针还指着这里
+    WriteBatch batch;
+    WriteBatchInternal::SetContents(&batch, record);
+    ReadOptions read_options;
+    read_options.fill_cache = false;
+    Slice key, value;
+    std::string val;
+    uint64_t pos = 0;
+    uint64_t records = 0;
+    while(pos < record.size())
+    {
+        bool isDel = false;
+        if(!WriteBatchInternal::ParseRecord(&batch, pos, key, value, isDel).ok())
+            break;
+        records++;
+        bool live = false;
+        if(!isDel && (db_->key_index_ != NULL ? db_->key_index_->Get(key, &val) :
+                                                db_->GetPtr(read_options, key, &val).ok()))
+        {
+            uint64_t item_size, item_pos;
+            uint64_t file_numb;
+            if(DecodeValuePtr(val, &item_size, &file_numb, &item_pos))
+            {
+                db_->vlog_manager_.ResolveForward(&file_numb, &item_pos);
+                live = file_numb == vlog_numb && item_pos + item_size == batch_pos + pos;
+            }
+        }
+        if(!live)
+            (*dead)++;
+    }
+    return records;
+}
+
+Status GarbageSampler::Sample(uint64_t vlog_numb, int samples, Estimate* est)
+{
+    *est = Estimate();
+    uint64_t file_size = 0;
+    Status s = db_->env_->GetFileSize(db_->VLogFilePath(vlog_numb), &file_size);
+    if(!s.ok())
+        return s;
+    if(!db_->vlog_manager_.HasVlog(vlog_numb) || file_size == 0)
+        return Status::NotFound("vlog to sample is gone");
+
+    Random rnd(static_cast<uint32_t>(vlog_numb));
+    std::string scratch;
+    //每条抽到的记录是一个样本：x是kv数、y是失效kv数，都除以记录长度抵消长记录更容易抽到
+    std::vector<std::pair<double, double> > units;
+    double sum_x = 0, sum_y = 0;
+    for(int attempt = 0; attempt < samples; attempt++)
+    {
+        if(db_->IsShutDown())
+            return Status::IOError("Deleting DB during garbage sampling");
+        uint64_t off = ((static_cast<uint64_t>(rnd.Next()) << 31) | rnd.Next()) % file_size;
+        uint64_t record_pos, head_size;
+        Slice record;
+        if(!FindContainingRecord(vlog_numb, off, file_size, &record_pos, &head_size,
+                                 &record, &scratch))
+            continue;
+        uint64_t dead = 0;
+        const uint64_t records = CheckRecord(vlog_numb, record_pos + head_size, record, &dead);
+        if(records == 0)
+            continue;
+        const double bytes = static_cast<double>(head_size + record.size());
+        units.push_back(std::make_pair(records / bytes, dead / bytes));
+        sum_x += records / bytes;
+        sum_y += dead / bytes;
+        est->batches++;
+        est->records += records;
+        est->dead += dead;
+    }
+
+    if(!units.empty())
+    {//比例估计量的置信区间，以batch为单位算方差；只有一个batch时没法估计方差，下界取0
+        const double n = units.size();
+        const double r = sum_y / sum_x;
+        est->ratio = r;
+        est->entries = static_cast<uint64_t>(static_cast<double>(file_size) * sum_x / n);
+        if(units.size() > 1)
+        {
+            double s2 = 0;
+            for(size_t i = 0; i < units.size(); i++)
+            {
+                const double d = units[i].second - r * units[i].first;
+                s2 += d * d;
+            }
+            s2 /= n - 1;
+            const double mean_x = sum_x / n;
+            est->lower = r - kConfidenceZ * sqrt(s2 / n) / mean_x;
+        }
+        if(est->lower < 0)
+            est->lower = 0;
+    }
+    return s;
+}
+
+}
@@ -0,0 +1,53 @@
+#ifndef STORAGE_LEVELDB_DB_GARBAGE_SAMPLER_H_
+#define STORAGE_LEVELDB_DB_GARBAGE_SAMPLER_H_
+
+#include <stdint.h>
+#include <string>
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb{
+class DBImpl;
+
+//从vlog里随机抽一些记录到lsm里查有效性，估计该vlog的垃圾比例，不用像gc那样整个扫一遍。
+//重启后持久化的垃圾数可能少了最多log_dropCount_threshold条，老格式的vlog更是没有垃圾数，
+//用估计值让gc一开始就能挑对vlog
+class GarbageSampler
+{
+    public:
+        struct Estimate{
+            uint64_t batches;//抽到的vlog记录数，一条记录是一个batch
+            uint64_t records;//抽到的batch里一共有多少条kv
+            uint64_t dead;//其中已经失效的
+            double ratio;//按记录长度加权估计的垃圾kv比例
+            double lower;//ratio的95%置信下界，同一个batch里的kv不当成独立的样本
+            uint64_t entries;//估计的vlog里kv总数
+            Estimate() : batches(0), records(0), dead(0), ratio(0), lower(0), entries(0) { }
+        };
+
+        explicit GarbageSampler(DBImpl* db);
+        //随机抽samples个字节，检查包含它的vlog记录。长的记录更容易抽到，按长度的倒数加权
+        Status Sample(uint64_t vlog_numb, int samples, Estimate* est);
+
+    private:
+        //从off处读到的window里找第一条crc对得上的vlog记录，record_pos是记录头的位置
+        bool FindRecord(uint64_t vlog_numb, const Slice& window, uint64_t off,
+                        uint64_t file_size, uint64_t* record_pos,
+                        uint64_t* head_size, Slice* record, std::string* scratch);
+        //读pos处的记录头
+        bool ReadHeader(uint64_t vlog_numb, uint64_t pos, uint64_t file_size,
+                        uint64_t* head_size, uint64_t* length);
+        //找到包含off处字节的记录，读出内容放到*record里
+        bool FindContainingRecord(uint64_t vlog_numb, uint64_t off, uint64_t file_size,
+                                  uint64_t* record_pos, uint64_t* head_size,
+                                  Slice* record, std::string* scratch);
+        //返回batch里kv的条数，失效的条数加到*dead上
+        uint64_t CheckRecord(uint64_t vlog_numb, uint64_t batch_pos,
+                             const Slice& record, uint64_t* dead);
+
+        DBImpl* db_;
+};
+
+}
+
+#endif
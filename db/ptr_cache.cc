@@ -0,0 +1,94 @@
+#include "db/ptr_cache.h"
+
+#include "util/hash.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+static void DeleteEntry(const Slice& key, void* value) {
+  std::string* ptr = reinterpret_cast<std::string*>(value);
+  delete ptr;
+}
+
+PtrCache::PtrCache(size_t capacity)
+    : cache_(NewLRUCache(capacity)) {
+}
+
+PtrCache::~PtrCache() {
+  delete cache_;
+}
+
+PtrCache::Stripe* PtrCache::GetStripe(const Slice& key) {
+  //和LRUCache分shard用的hash错开种子，免得一个stripe的key都挤在一个shard里
+  return &stripes_[Hash(key.data(), key.size(), 0x9e3779b9) % kNumStripes];
+}
+
+bool PtrCache::Get(const Slice& key, std::string* ptr) {
+  Cache::Handle* handle = cache_->Lookup(key);
+  if (handle == NULL) {
+    return false;
+  }
+  ptr->assign(*reinterpret_cast<std::string*>(cache_->Value(handle)));
+  cache_->Release(handle);
+  return true;
+}
+
+void PtrCache::Insert(const Slice& key, const Slice& ptr) {
+  std::string* value = new std::string(ptr.data(), ptr.size());
+  cache_->Release(cache_->Insert(key, value, key.size() + ptr.size(),
+                                 &DeleteEntry));
+}
+
+void PtrCache::Replace(const Slice& key, const Slice& old_ptr,
+                       const Slice& new_ptr) {
+  Cache::Handle* handle = cache_->Lookup(key);
+  if (handle != NULL) {
+    //缓存里已经是更新的指针时不动它
+    const bool match =
+        Slice(*reinterpret_cast<std::string*>(cache_->Value(handle))) == old_ptr;
+    cache_->Release(handle);
+    if (match) {
+      Insert(key, new_ptr);
+    }
+  }
+}
+
+void PtrCache::Fill(const Slice& key, const Slice& ptr,
+                    SequenceNumber snapshot, uint64_t view_gen) {
+  Stripe* stripe = GetStripe(key);
+  MutexLock l(&stripe->mutex_);
+  if (stripe->seq_ <= snapshot && stripe->view_gen_ <= view_gen) {
+    Insert(key, ptr);
+  }
+}
+
+void PtrCache::Invalidate(const Slice& key, SequenceNumber seq) {
+  Stripe* stripe = GetStripe(key);
+  MutexLock l(&stripe->mutex_);
+  if (seq > stripe->seq_) {
+    stripe->seq_ = seq;
+  }
+  cache_->Erase(key);
+}
+
+void PtrCache::Relocate(const Slice& key, const Slice& old_ptr,
+                        const Slice& new_ptr, SequenceNumber seq) {
+  Stripe* stripe = GetStripe(key);
+  MutexLock l(&stripe->mutex_);
+  if (seq > stripe->seq_) {
+    stripe->seq_ = seq;
+  }
+  Replace(key, old_ptr, new_ptr);
+}
+
+void PtrCache::RelocateInView(const Slice& key, const Slice& old_ptr,
+                              const Slice& new_ptr, uint64_t view_gen) {
+  Stripe* stripe = GetStripe(key);
+  MutexLock l(&stripe->mutex_);
+  if (view_gen > stripe->view_gen_) {
+    stripe->view_gen_ = view_gen;
+  }
+  Replace(key, old_ptr, new_ptr);
+}
+
+}  // namespace leveldb
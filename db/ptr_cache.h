@@ -0,0 +1,69 @@
+// Thread-safe (provides internal synchronization)
+
+#ifndef STORAGE_LEVELDB_DB_PTR_CACHE_H_
+#define STORAGE_LEVELDB_DB_PTR_CACHE_H_
+
+#include <stdint.h>
+#include <string>
+#include "db/dbformat.h"
+#include "leveldb/cache.h"
+#include "leveldb/slice.h"
+#include "port/port.h"
+
+namespace leveldb {
+
+//热点key到它最新值指针的缓存，GetPtr命中时不用再查memtable、imm和sst。
+//GetPtr查完lsm后Fill进来；用户写入在MemTableInserter里让缓存失效，
+//gc和合并搬迁在这里换成新指针。
+//key按hash分到各个stripe，stripe记着落在它上面的最后一次写入的sequence和最后一次
+//合并搬迁对应的read view代数，Fill时查lsm用的snapshot或者view比它们旧就不插，
+//以免把查的期间被改掉的旧指针放回缓存
+class PtrCache {
+ public:
+  //capacity是缓存的key和指针的总字节数
+  explicit PtrCache(size_t capacity);
+  ~PtrCache();
+
+  //命中时把指针放进*ptr并返回true
+  bool Get(const Slice& key, std::string* ptr);
+
+  //GetPtr在snapshot和第view_gen代read view上查到key的指针是ptr
+  void Fill(const Slice& key, const Slice& ptr,
+            SequenceNumber snapshot, uint64_t view_gen);
+
+  //用户在sequence为seq处写入或删除了key
+  void Invalidate(const Slice& key, SequenceNumber seq);
+
+  //gc把key的值从old_ptr搬到new_ptr，新指针的sequence为seq
+  void Relocate(const Slice& key, const Slice& old_ptr, const Slice& new_ptr,
+                SequenceNumber seq);
+
+  //合并把key的值从old_ptr搬到new_ptr，新指针从第view_gen代read view起可见
+  void RelocateInView(const Slice& key, const Slice& old_ptr,
+                      const Slice& new_ptr, uint64_t view_gen);
+
+ private:
+  struct Stripe {
+    port::Mutex mutex_;
+    SequenceNumber seq_;//以下受mutex_保护
+    uint64_t view_gen_;
+    Stripe() : seq_(0), view_gen_(0) { }
+  };
+  enum { kNumStripes = 256 };
+
+  Stripe* GetStripe(const Slice& key);
+  //REQUIRES: 持有key所在stripe的mutex_
+  void Replace(const Slice& key, const Slice& old_ptr, const Slice& new_ptr);
+  void Insert(const Slice& key, const Slice& ptr);
+
+  Cache* cache_;
+  Stripe stripes_[kNumStripes];
+
+  // No copying allowed
+  PtrCache(const PtrCache&);
+  void operator=(const PtrCache&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_PTR_CACHE_H_
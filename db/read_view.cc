@@ -0,0 +1,95 @@
+#include "db/read_view.h"
+
+#include "db/memtable.h"
+#include "util/hash.h"
+
+namespace leveldb {
+
+namespace {
+//槽位的两个标记：kInUse表示有线程占着，kObsolete表示占着的时候被Scrape了，
+//占用者处理完之前谁也不能再占
+char in_use_marker;
+char obsolete_marker;
+void* const kInUse = &in_use_marker;
+void* const kObsolete = &obsolete_marker;
+}  // namespace
+
+ReadView::ReadView(MemTable* m, MemTable* i, Version* v, uint64_t gen)
+    : mem(m), imm(i), current(v), generation(gen), refs(1) {
+  mem->Ref();
+  if (imm != NULL) imm->Ref();
+  current->Ref();
+}
+
+ReadView::~ReadView() {
+  mem->Unref();
+  if (imm != NULL) imm->Unref();
+  current->Unref();
+}
+
+void ReadView::Unref() {
+  assert(refs > 0);
+  if (--refs == 0) {
+    delete this;
+  }
+}
+
+ReadViewCache::ReadViewCache() {
+  for (int i = 0; i < kNumSlots; i++) {
+    slots_[i].view.NoBarrier_Store(NULL);
+    slots_[i].num_pending = 0;
+  }
+}
+
+ReadViewCache::Slot* ReadViewCache::Acquire(ReadView** view) {
+  //各线程的栈离得很远，同一线程每次的栈地址又差不多，散列后当成线程的槽位号
+  const uintptr_t addr = reinterpret_cast<uintptr_t>(view) >> 16;
+  const uint32_t start =
+      Hash(reinterpret_cast<const char*>(&addr), sizeof(addr), 0) % kNumSlots;
+  for (int i = 0; i < kNumSlots; i++) {
+    Slot* slot = &slots_[(start + i) % kNumSlots];
+    void* v = slot->view.Acquire_Load();
+    if (v == kInUse || v == kObsolete) {
+      continue;
+    }
+    if (slot->view.CompareAndSwap(v, kInUse)) {
+      *view = reinterpret_cast<ReadView*>(v);
+      return slot;
+    }
+  }
+  *view = NULL;
+  return NULL;
+}
+
+bool ReadViewCache::Release(Slot* slot, ReadView* view) {
+  return slot->view.CompareAndSwap(kInUse, view);
+}
+
+void ReadViewCache::Free(Slot* slot) {
+  assert(slot->view.NoBarrier_Load() == kObsolete);
+  assert(slot->num_pending == 0);
+  slot->view.Release_Store(NULL);
+}
+
+void ReadViewCache::Scrape(std::vector<Slot*>* slots,
+                           std::vector<ReadView*>* views) {
+  for (int i = 0; i < kNumSlots; i++) {
+    Slot* slot = &slots_[i];
+    while (true) {
+      void* v = slot->view.Acquire_Load();
+      if (v == NULL || v == kObsolete) {
+        break;
+      }
+      if (slot->view.CompareAndSwap(v, v == kInUse ? kObsolete : NULL)) {
+        if (v != kInUse) {
+          //槽位已经是NULL，新占用者拿到NULL会先去等mutex_，不会和调用者同时碰pending
+          slots->push_back(slot);
+          views->push_back(reinterpret_cast<ReadView*>(v));
+        }
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace leveldb
@@ -0,0 +1,76 @@
+// Thread-safe (provides internal synchronization)
+
+#ifndef STORAGE_LEVELDB_DB_READ_VIEW_H_
+#define STORAGE_LEVELDB_DB_READ_VIEW_H_
+
+#include <stdint.h>
+#include <vector>
+#include "db/version_set.h"
+#include "port/port.h"
+
+namespace leveldb {
+
+class MemTable;
+
+//Get用到的mem、imm和current，换memtable或者换版本时整个换成新的。
+//refs以及各部分的Ref/Unref都要在DB的mutex_下做
+struct ReadView {
+  MemTable* const mem;
+  MemTable* const imm;
+  Version* const current;
+  const uint64_t generation;//每换一次view加一
+  int refs;
+
+  //引用三个部分，refs初始为1
+  ReadView(MemTable* m, MemTable* i, Version* v, uint64_t gen);
+
+  void Ref() { ++refs; }
+  //引用数归零时释放三个部分并delete自己
+  void Unref();
+
+ private:
+  ~ReadView();
+};
+
+//缓存ReadView的一组槽位。Get用CAS占一个槽位，直接用里面的view，不拿DB的mutex_；
+//换view时Scrape把所有槽位清空。port里没有线程局部存储，按栈地址散列选起始槽位，
+//同时读的线程一般占不同的槽位，槽位都被占时调用者退回到拿mutex_的老路
+class ReadViewCache {
+ public:
+  enum { kMaxPendingStats = 16 };
+
+  struct Slot {
+    //NULL、占用标记，或者槽位缓存的view，槽位持有它的一个引用
+    port::AtomicPointer view;
+    //还没算进view->current的seek统计，只有占着槽位的线程或者拿着mutex_的Scrape者能碰
+    Version::GetStats pending[kMaxPendingStats];
+    int num_pending;
+  };
+
+  ReadViewCache();
+
+  //占一个空闲槽位，*view是槽位里缓存的view，NULL表示要调用者自己在mutex_下拿一个。
+  //所有槽位都被占时返回NULL
+  Slot* Acquire(ReadView** view);
+
+  //读完后把view放回槽位，槽位接管调用者对view的这个引用。
+  //读的期间被Scrape过时返回false，调用者在mutex_下处理pending、Unref view，再调Free
+  bool Release(Slot* slot, ReadView* view);
+  void Free(Slot* slot);
+
+  //换view时在DB的mutex_下调用，清空所有槽位。空闲槽位和它缓存的view放进slots和views，
+  //调用者处理pending并Unref view；正在用的槽位由占用者在Release失败后处理
+  void Scrape(std::vector<Slot*>* slots, std::vector<ReadView*>* views);
+
+ private:
+  enum { kNumSlots = 64 };
+  Slot slots_[kNumSlots];
+
+  // No copying allowed
+  ReadViewCache(const ReadViewCache&);
+  void operator=(const ReadViewCache&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_READ_VIEW_H_
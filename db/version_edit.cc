@@ -20,7 +20,13 @@ enum Tag {
   kDeletedFile          = 6,
   kNewFile              = 7,
   // 8 was used for large value refs
-  kPrevLogNumber        = 9
+  kPrevLogNumber        = 9,
+  kNextVlogNumber       = 10,
+  kVlogRefs             = 11,  // vlog references of the preceding new file
+  kVlogHead             = 12,
+  kCleanTail            = 13,
+  kVlogInfo             = 14,
+  kVlogPath             = 15
 };
 
 void VersionEdit::Clear() {
@@ -29,11 +35,22 @@ void VersionEdit::Clear() {
   prev_log_number_ = 0;
   last_sequence_ = 0;
   next_file_number_ = 0;
+  next_vlog_number_ = 0;
+  vlog_head_number_ = 0;
+  vlog_head_pos_ = 0;
+  clean_tail_number_ = 0;
+  clean_tail_pos_ = 0;
+  vlog_info_.clear();
   has_comparator_ = false;
   has_log_number_ = false;
   has_prev_log_number_ = false;
   has_next_file_number_ = false;
+  has_next_vlog_number_ = false;
+  has_vlog_head_ = false;
+  has_clean_tail_ = false;
+  has_vlog_info_ = false;
   has_last_sequence_ = false;
+  vlog_paths_.clear();
   deleted_files_.clear();
   new_files_.clear();
 }
@@ -59,6 +76,29 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutVarint32(dst, kLastSequence);
     PutVarint64(dst, last_sequence_);
   }
+  if (has_next_vlog_number_) {
+    PutVarint32(dst, kNextVlogNumber);
+    PutVarint64(dst, next_vlog_number_);
+  }
+  if (has_vlog_head_) {
+    PutVarint32(dst, kVlogHead);
+    PutVarint64(dst, vlog_head_number_);
+    PutVarint64(dst, vlog_head_pos_);
+  }
+  if (has_clean_tail_) {
+    PutVarint32(dst, kCleanTail);
+    PutVarint64(dst, clean_tail_number_);
+    PutVarint64(dst, clean_tail_pos_);
+  }
+  if (has_vlog_info_) {
+    PutVarint32(dst, kVlogInfo);
+    PutLengthPrefixedSlice(dst, vlog_info_);
+  }
+  for (size_t i = 0; i < vlog_paths_.size(); i++) {
+    PutVarint32(dst, kVlogPath);
+    PutVarint64(dst, vlog_paths_[i].first);
+    PutVarint32(dst, vlog_paths_[i].second);
+  }
 
   for (size_t i = 0; i < compact_pointers_.size(); i++) {
     PutVarint32(dst, kCompactPointer);
@@ -82,6 +122,16 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutVarint64(dst, f.file_size);
     PutLengthPrefixedSlice(dst, f.smallest.Encode());
     PutLengthPrefixedSlice(dst, f.largest.Encode());
+    if (f.has_vlog_refs) {
+      PutVarint32(dst, kVlogRefs);
+      PutVarint32(dst, f.vlog_refs.size());
+      for (std::map<uint64_t, uint64_t>::const_iterator iter =
+               f.vlog_refs.begin();
+           iter != f.vlog_refs.end(); ++iter) {
+        PutVarint64(dst, iter->first);   // vlog number
+        PutVarint64(dst, iter->second);  // referenced bytes
+      }
+    }
   }
 }
 
@@ -162,6 +212,52 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      case kNextVlogNumber:
+        if (GetVarint64(&input, &next_vlog_number_)) {
+          has_next_vlog_number_ = true;
+        } else {
+          msg = "next vlog number";
+        }
+        break;
+
+      case kVlogHead:
+        if (GetVarint64(&input, &vlog_head_number_) &&
+            GetVarint64(&input, &vlog_head_pos_)) {
+          has_vlog_head_ = true;
+        } else {
+          msg = "vlog head";
+        }
+        break;
+
+      case kCleanTail:
+        if (GetVarint64(&input, &clean_tail_number_) &&
+            GetVarint64(&input, &clean_tail_pos_)) {
+          has_clean_tail_ = true;
+        } else {
+          msg = "clean tail";
+        }
+        break;
+
+      case kVlogInfo:
+        if (GetLengthPrefixedSlice(&input, &str)) {
+          vlog_info_ = str.ToString();
+          has_vlog_info_ = true;
+        } else {
+          msg = "vlog info";
+        }
+        break;
+
+      case kVlogPath: {
+        uint32_t path;
+        if (GetVarint64(&input, &number) &&
+            GetVarint32(&input, &path)) {
+          vlog_paths_.push_back(std::make_pair(number, static_cast<int>(path)));
+        } else {
+          msg = "vlog path";
+        }
+        break;
+      }
+
       case kCompactPointer:
         if (GetLevel(&input, &level) &&
             GetInternalKey(&input, &key)) {
@@ -192,6 +288,25 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      case kVlogRefs: {
+        uint32_t n;
+        if (!new_files_.empty() && GetVarint32(&input, &n)) {
+          FileMetaData& nf = new_files_.back().second;
+          nf.has_vlog_refs = true;
+          for (uint32_t i = 0; i < n && msg == NULL; i++) {
+            uint64_t vlog, bytes;
+            if (GetVarint64(&input, &vlog) && GetVarint64(&input, &bytes)) {
+              nf.vlog_refs[vlog] = bytes;
+            } else {
+              msg = "vlog refs";
+            }
+          }
+        } else {
+          msg = "vlog refs";
+        }
+        break;
+      }
+
       default:
         msg = "unknown tag";
         break;
@@ -232,6 +347,33 @@ std::string VersionEdit::DebugString() const {
     r.append("\n  LastSeq: ");
     AppendNumberTo(&r, last_sequence_);
   }
+  if (has_next_vlog_number_) {
+    r.append("\n  NextVlog: ");
+    AppendNumberTo(&r, next_vlog_number_);
+  }
+  if (has_vlog_head_) {
+    r.append("\n  VlogHead: ");
+    AppendNumberTo(&r, vlog_head_number_);
+    r.append(" ");
+    AppendNumberTo(&r, vlog_head_pos_);
+  }
+  if (has_clean_tail_) {
+    r.append("\n  CleanTail: ");
+    AppendNumberTo(&r, clean_tail_number_);
+    r.append(" ");
+    AppendNumberTo(&r, clean_tail_pos_);
+  }
+  if (has_vlog_info_) {
+    r.append("\n  VlogInfo: ");
+    AppendNumberTo(&r, vlog_info_.size());
+    r.append(" bytes");
+  }
+  for (size_t i = 0; i < vlog_paths_.size(); i++) {
+    r.append("\n  VlogPath: ");
+    AppendNumberTo(&r, vlog_paths_[i].first);
+    r.append(" ");
+    AppendNumberTo(&r, vlog_paths_[i].second);
+  }
   for (size_t i = 0; i < compact_pointers_.size(); i++) {
     r.append("\n  CompactPointer: ");
     AppendNumberTo(&r, compact_pointers_[i].first);
@@ -258,6 +400,14 @@ std::string VersionEdit::DebugString() const {
     r.append(f.smallest.DebugString());
     r.append(" .. ");
     r.append(f.largest.DebugString());
+    for (std::map<uint64_t, uint64_t>::const_iterator iter =
+             f.vlog_refs.begin();
+         iter != f.vlog_refs.end(); ++iter) {
+      r.append("\n    VlogRef: ");
+      AppendNumberTo(&r, iter->first);
+      r.append(" ");
+      AppendNumberTo(&r, iter->second);
+    }
   }
   r.append("\n}\n");
   return r;
@@ -5,6 +5,7 @@
 #ifndef STORAGE_LEVELDB_DB_VERSION_EDIT_H_
 #define STORAGE_LEVELDB_DB_VERSION_EDIT_H_
 
+#include <map>
 #include <set>
 #include <utility>
 #include <vector>
@@ -22,7 +23,13 @@ struct FileMetaData {
   InternalKey smallest;       // Smallest internal key served by table
   InternalKey largest;        // Largest internal key served by table
 
-  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0) { }
+  // Bytes of values the table points to, keyed by vlog number.  Tables
+  // written before this was tracked do not know their references.
+  bool has_vlog_refs;
+  std::map<uint64_t, uint64_t> vlog_refs;
+
+  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0),
+                   has_vlog_refs(false) { }
 };
 
 class VersionEdit {
@@ -48,6 +55,33 @@ class VersionEdit {
     has_next_file_number_ = true;
     next_file_number_ = num;
   }
+  void SetNextVlog(uint64_t num) {
+    has_next_vlog_number_ = true;
+    next_vlog_number_ = num;
+  }
+  // Recovery replays vlogs into the memtable starting at "pos" of "vlog".
+  void SetVlogHead(uint64_t vlog, uint64_t pos) {
+    has_vlog_head_ = true;
+    vlog_head_number_ = vlog;
+    vlog_head_pos_ = pos;
+  }
+  // GC resumes cleaning "vlog" at "pos" after a restart.  A zero "vlog"
+  // means there is nothing to resume.
+  void SetCleanTail(uint64_t vlog, uint64_t pos) {
+    has_clean_tail_ = true;
+    clean_tail_number_ = vlog;
+    clean_tail_pos_ = pos;
+  }
+  // Garbage statistics of the vlogs, see VlogManager::Serialize.
+  void SetVlogInfo(const Slice& info) {
+    has_vlog_info_ = true;
+    vlog_info_ = info.ToString();
+  }
+  // Vlog "vlog" now lives in vlog_cold_paths[path - 1], or back in the
+  // db directory if "path" is zero.
+  void SetVlogPath(uint64_t vlog, int path) {
+    vlog_paths_.push_back(std::make_pair(vlog, path));
+  }
   void SetLastSequence(SequenceNumber seq) {
     has_last_sequence_ = true;
     last_sequence_ = seq;
@@ -71,6 +105,11 @@ class VersionEdit {
     new_files_.push_back(std::make_pair(level, f));
   }
 
+  // Same as above, but keeps the vlog references of "f".
+  void AddFile(int level, const FileMetaData& f) {
+    new_files_.push_back(std::make_pair(level, f));
+  }
+
   // Delete the specified "file" from the specified "level".
   void DeleteFile(int level, uint64_t file) {
     deleted_files_.insert(std::make_pair(level, file));
@@ -90,14 +129,25 @@ class VersionEdit {
   uint64_t log_number_;
   uint64_t prev_log_number_;
   uint64_t next_file_number_;
+  uint64_t next_vlog_number_;
+  uint64_t vlog_head_number_;
+  uint64_t vlog_head_pos_;
+  uint64_t clean_tail_number_;
+  uint64_t clean_tail_pos_;
+  std::string vlog_info_;
   SequenceNumber last_sequence_;
   bool has_comparator_;
   bool has_log_number_;
   bool has_prev_log_number_;
   bool has_next_file_number_;
+  bool has_next_vlog_number_;
+  bool has_vlog_head_;
+  bool has_clean_tail_;
+  bool has_vlog_info_;
   bool has_last_sequence_;
 
   std::vector< std::pair<int, InternalKey> > compact_pointers_;
+  std::vector< std::pair<uint64_t, int> > vlog_paths_;
   DeletedFileSet deleted_files_;
   std::vector< std::pair<int, FileMetaData> > new_files_;
 };
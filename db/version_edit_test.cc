@@ -28,6 +28,15 @@ TEST(VersionEditTest, EncodeDecode) {
     edit.AddFile(3, kBig + 300 + i, kBig + 400 + i,
                  InternalKey("foo", kBig + 500 + i, kTypeValue),
                  InternalKey("zoo", kBig + 600 + i, kTypeDeletion));
+    FileMetaData f;
+    f.number = kBig + 800 + i;
+    f.file_size = kBig + 850 + i;
+    f.smallest = InternalKey("bar", kBig + 500 + i, kTypeValue);
+    f.largest = InternalKey("baz", kBig + 600 + i, kTypeValue);
+    f.has_vlog_refs = true;
+    f.vlog_refs[i] = kBig + i;
+    f.vlog_refs[kBig] = 1;
+    edit.AddFile(2, f);
     edit.DeleteFile(4, kBig + 700 + i);
     edit.SetCompactPointer(i, InternalKey("x", kBig + 900 + i, kTypeValue));
   }
@@ -35,6 +44,12 @@ TEST(VersionEditTest, EncodeDecode) {
   edit.SetComparatorName("foo");
   edit.SetLogNumber(kBig + 100);
   edit.SetNextFile(kBig + 200);
+  edit.SetNextVlog(kBig + 250);
+  edit.SetVlogHead(kBig + 260, kBig + 270);
+  edit.SetCleanTail(kBig + 280, kBig + 290);
+  edit.SetVlogInfo(std::string("vlog\0info", 9));
+  edit.SetVlogPath(kBig + 300, 2);
+  edit.SetVlogPath(kBig + 310, 0);
   edit.SetLastSequence(kBig + 1000);
   TestEncodeDecode(edit);
 }
@@ -784,8 +784,16 @@ VersionSet::VersionSet(const std::string& dbname,
       next_file_number_(2),
       manifest_file_number_(0),  // Filled by Recover()
       last_sequence_(0),
+      seq_version_(NULL),
+      seq_lo_(NULL),
+      seq_hi_(NULL),
       log_number_(0),//初识时vlog_number为0
       prev_log_number_(0),
+      next_vlog_number_(1),
+      vlog_head_number_(0),
+      vlog_head_pos_(0),
+      clean_tail_number_(0),
+      clean_tail_pos_(0),
       descriptor_file_(NULL),
       descriptor_log_(NULL),
       dummy_versions_(this),
@@ -817,6 +825,33 @@ void VersionSet::AppendVersion(Version* v) {
   v->next_->prev_ = v;
 }
 
+void VersionSet::PublishLastSequence() {
+  // Seqlock: readers retry if they overlap a store, so they never see the
+  // low word of one value and the high word of another.
+  const uintptr_t version =
+      reinterpret_cast<uintptr_t>(seq_version_.NoBarrier_Load());
+  seq_version_.Release_Store(reinterpret_cast<void*>(version + 1));
+  seq_lo_.Release_Store(reinterpret_cast<void*>(
+      static_cast<uintptr_t>(last_sequence_ & 0xffffffffu)));
+  seq_hi_.Release_Store(reinterpret_cast<void*>(
+      static_cast<uintptr_t>(last_sequence_ >> 32)));
+  seq_version_.Release_Store(reinterpret_cast<void*>(version + 2));
+}
+
+uint64_t VersionSet::PublishedLastSequence() const {
+  while (true) {
+    const void* version = seq_version_.Acquire_Load();
+    if (reinterpret_cast<uintptr_t>(version) & 1) {
+      continue;
+    }
+    const uint64_t lo = reinterpret_cast<uintptr_t>(seq_lo_.Acquire_Load());
+    const uint64_t hi = reinterpret_cast<uintptr_t>(seq_hi_.Acquire_Load());
+    if (seq_version_.Acquire_Load() == version) {
+      return (hi << 32) | lo;
+    }
+  }
+}
+
 Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   if (edit->has_log_number_) {
       assert(edit->log_number_ >= log_number_);
@@ -830,6 +865,7 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   }
 
   edit->SetNextFile(next_file_number_);
+  edit->SetNextVlog(next_vlog_number_);
   edit->SetLastSequence(last_sequence_);
 
   Version* v = new Version(this);
@@ -888,6 +924,7 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
     AppendVersion(v);
     log_number_ = edit->log_number_;
     prev_log_number_ = edit->prev_log_number_;
+    ApplyVlogState(edit);
   } else {
     delete v;
     if (!new_manifest_file.empty()) {
@@ -936,10 +973,13 @@ Status VersionSet::Recover(bool *save_manifest) {
   bool have_prev_log_number = false;
   bool have_next_file = false;
   bool have_last_sequence = false;
+  bool have_next_vlog = false;
   uint64_t next_file = 0;
+  uint64_t next_vlog = 0;
   uint64_t last_sequence = 0;
   uint64_t log_number = 0;
   uint64_t prev_log_number = 0;
+  VersionEdit vlog_state;
   Builder builder(this, current_);
 
   {
@@ -983,6 +1023,26 @@ Status VersionSet::Recover(bool *save_manifest) {
         last_sequence = edit.last_sequence_;
         have_last_sequence = true;
       }
+
+      if (edit.has_next_vlog_number_) {
+        next_vlog = edit.next_vlog_number_;
+        have_next_vlog = true;
+      }
+
+      if (edit.has_vlog_head_) {
+        vlog_state.SetVlogHead(edit.vlog_head_number_, edit.vlog_head_pos_);
+      }
+      if (edit.has_clean_tail_) {
+        vlog_state.SetCleanTail(edit.clean_tail_number_,
+                                edit.clean_tail_pos_);
+      }
+      if (edit.has_vlog_info_) {
+        vlog_state.SetVlogInfo(edit.vlog_info_);
+      }
+      for (size_t i = 0; i < edit.vlog_paths_.size(); i++) {
+        vlog_state.SetVlogPath(edit.vlog_paths_[i].first,
+                               edit.vlog_paths_[i].second);
+      }
     }
   }
   delete file;
@@ -1001,6 +1061,12 @@ Status VersionSet::Recover(bool *save_manifest) {
       prev_log_number = 0;
     }
 
+    // Descriptors written before vlog numbers had their own counter
+    // allocated them from the log number.
+    if (!have_next_vlog) {
+      next_vlog = log_number + 1;
+    }
+
     MarkFileNumberUsed(prev_log_number);
     MarkFileNumberUsed(log_number);
   }
@@ -1014,8 +1080,12 @@ Status VersionSet::Recover(bool *save_manifest) {
     manifest_file_number_ = next_file;
     next_file_number_ = next_file + 1;
     last_sequence_ = last_sequence;
+    PublishLastSequence();
     log_number_ = log_number;
     prev_log_number_ = prev_log_number;
+    next_vlog_number_ = next_vlog;
+    MarkVlogNumberUsed(log_number);
+    ApplyVlogState(&vlog_state);
 
     // See if we can reuse the existing MANIFEST file.
     if (ReuseManifest(dscname, current)) {
@@ -1028,6 +1098,27 @@ Status VersionSet::Recover(bool *save_manifest) {
   return s;
 }
 
+void VersionSet::ApplyVlogState(const VersionEdit* edit) {
+  if (edit->has_vlog_head_) {
+    vlog_head_number_ = edit->vlog_head_number_;
+    vlog_head_pos_ = edit->vlog_head_pos_;
+  }
+  if (edit->has_clean_tail_) {
+    clean_tail_number_ = edit->clean_tail_number_;
+    clean_tail_pos_ = edit->clean_tail_pos_;
+  }
+  if (edit->has_vlog_info_) {
+    vlog_info_ = edit->vlog_info_;
+  }
+  for (size_t i = 0; i < edit->vlog_paths_.size(); i++) {
+    if (edit->vlog_paths_[i].second == 0) {
+      vlog_paths_.erase(edit->vlog_paths_[i].first);
+    } else {
+      vlog_paths_[edit->vlog_paths_[i].first] = edit->vlog_paths_[i].second;
+    }
+  }
+}
+
 bool VersionSet::ReuseManifest(const std::string& dscname,
                                const std::string& dscbase) {
   if (!options_->reuse_logs) {
@@ -1065,8 +1156,8 @@ void VersionSet::MarkFileNumberUsed(uint64_t number) {
   }
 }
 void VersionSet::MarkVlogNumberUsed(uint64_t number) {
-  if (log_number_ < number) {
-     log_number_ = number;
+  if (next_vlog_number_ <= number) {
+    next_vlog_number_ = number + 1;
   }
 }
 
@@ -1114,6 +1205,19 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
   // Save metadata
   VersionEdit edit;
   edit.SetComparatorName(icmp_.user_comparator()->Name());
+  if (vlog_head_number_ != 0) {
+    edit.SetVlogHead(vlog_head_number_, vlog_head_pos_);
+  }
+  if (clean_tail_number_ != 0) {
+    edit.SetCleanTail(clean_tail_number_, clean_tail_pos_);
+  }
+  if (!vlog_info_.empty()) {
+    edit.SetVlogInfo(vlog_info_);
+  }
+  for (std::map<uint64_t, int>::const_iterator iter = vlog_paths_.begin();
+       iter != vlog_paths_.end(); ++iter) {
+    edit.SetVlogPath(iter->first, iter->second);
+  }
 
   // Save compaction pointers
   for (int level = 0; level < config::kNumLevels; level++) {
@@ -1129,7 +1233,7 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     const std::vector<FileMetaData*>& files = current_->files_[level];
     for (size_t i = 0; i < files.size(); i++) {
       const FileMetaData* f = files[i];
-      edit.AddFile(level, f->number, f->file_size, f->smallest, f->largest);
+      edit.AddFile(level, *f);
     }
   }
 
@@ -1204,6 +1308,27 @@ void VersionSet::AddLiveFiles(std::set<uint64_t>* live) {
   }
 }
 
+bool VersionSet::AddLiveVlogs(std::set<uint64_t>* live) {
+  for (Version* v = dummy_versions_.next_;
+       v != &dummy_versions_;
+       v = v->next_) {
+    for (int level = 0; level < config::kNumLevels; level++) {
+      const std::vector<FileMetaData*>& files = v->files_[level];
+      for (size_t i = 0; i < files.size(); i++) {
+        if (!files[i]->has_vlog_refs) {
+          return false;
+        }
+        for (std::map<uint64_t, uint64_t>::const_iterator iter =
+                 files[i]->vlog_refs.begin();
+             iter != files[i]->vlog_refs.end(); ++iter) {
+          live->insert(iter->first);
+        }
+      }
+    }
+  }
+  return true;
+}
+
 int64_t VersionSet::NumLevelBytes(int level) const {
   assert(level >= 0);
   assert(level < config::kNumLevels);
@@ -189,7 +189,10 @@ class VersionSet {
 
   // Allocate and return a new file number
   uint64_t NewFileNumber() { return next_file_number_++; }
-  uint64_t NewVlogNumber() { return ++log_number_; }
+
+  // Allocate and return a new vlog number.  User vlogs and the vlogs
+  // written by garbage collection share this sequence.
+  uint64_t NewVlogNumber() { return next_vlog_number_++; }
 
   // Arrange to reuse "file_number" unless a newer file number has
   // already been allocated.
@@ -200,8 +203,8 @@ class VersionSet {
     }
   }
   void ReuseVlogNumber(uint64_t file_number) {
-    if (log_number_ == file_number) {
-      log_number_ = file_number - 1;
+    if (next_vlog_number_ == file_number + 1) {
+      next_vlog_number_ = file_number;
     }
   }
 
@@ -214,10 +217,15 @@ class VersionSet {
   // Return the last sequence number.
   uint64_t LastSequence() const { return last_sequence_; }
 
+  // Return the last sequence number without holding the DB mutex.
+  // Readers use it to pick their lookup sequence.
+  uint64_t PublishedLastSequence() const;
+
   // Set the last sequence number to s.
   void SetLastSequence(uint64_t s) {
     assert(s >= last_sequence_);
     last_sequence_ = s;
+    PublishLastSequence();
   }
 
   // Mark the specified file number as used.
@@ -231,6 +239,22 @@ class VersionSet {
   // being compacted, or zero if there is no such log file.
   uint64_t PrevLogNumber() const { return prev_log_number_; }
 
+  // Return the vlog position recovery replays from.  The vlog number is
+  // zero if no memtable has been flushed yet.
+  uint64_t VlogHeadNumber() const { return vlog_head_number_; }
+  uint64_t VlogHeadPos() const { return vlog_head_pos_; }
+
+  // Return where GC resumes after a restart, or zero if there is nothing
+  // to resume.
+  uint64_t CleanTailNumber() const { return clean_tail_number_; }
+  uint64_t CleanTailPos() const { return clean_tail_pos_; }
+
+  // Return the last persisted garbage statistics of the vlogs.
+  const std::string& VlogInfo() const { return vlog_info_; }
+
+  // Return the cold path index of every migrated vlog.
+  const std::map<uint64_t, int>& VlogPaths() const { return vlog_paths_; }
+
   // Pick level and inputs for a new compaction.
   // Returns NULL if there is no compaction to be done.
   // Otherwise returns a pointer to a heap-allocated object that
@@ -264,6 +288,11 @@ class VersionSet {
   // May also mutate some internal state.
   void AddLiveFiles(std::set<uint64_t>* live);
 
+  // Add all vlogs referenced by files listed in any live version to
+  // *live.  Returns false if some live file does not know its vlog
+  // references, in which case no vlog may be considered dead.
+  bool AddLiveVlogs(std::set<uint64_t>* live);
+
   // Return the approximate offset in the database of the data for
   // "key" as of version "v".
   uint64_t ApproximateOffsetOf(Version* v, const InternalKey& key);
@@ -283,6 +312,9 @@ class VersionSet {
 
   bool ReuseManifest(const std::string& dscname, const std::string& dscbase);
 
+  // Take over the vlog head, clean tail and vlog info recorded in *edit
+  void ApplyVlogState(const VersionEdit* edit);
+
   void Finalize(Version* v);
 
   void GetRange(const std::vector<FileMetaData*>& inputs,
@@ -301,6 +333,8 @@ class VersionSet {
 
   void AppendVersion(Version* v);
 
+  void PublishLastSequence();
+
   Env* const env_;
   const std::string dbname_;
   const Options* const options_;
@@ -309,8 +343,21 @@ class VersionSet {
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
   uint64_t last_sequence_;
+  // Copy of last_sequence_ for lock-free readers, split into two words so
+  // it also works where a pointer is 32 bits.  seq_version_ is odd while a
+  // new value is being stored.
+  port::AtomicPointer seq_version_;
+  port::AtomicPointer seq_lo_;
+  port::AtomicPointer seq_hi_;
   uint64_t log_number_;
   uint64_t prev_log_number_;  // 0 or backing store for memtable being compacted
+  uint64_t next_vlog_number_;
+  uint64_t vlog_head_number_;
+  uint64_t vlog_head_pos_;
+  uint64_t clean_tail_number_;
+  uint64_t clean_tail_pos_;
+  std::string vlog_info_;
+  std::map<uint64_t, int> vlog_paths_;
 
   // Opened lazily
   WritableFile* descriptor_file_;
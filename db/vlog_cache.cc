@@ -0,0 +1,78 @@
+#include "db/vlog_cache.h"
+
+#include "db/vlog_reader.h"
+#include "leveldb/env.h"
+#include "util/coding.h"
+
+namespace leveldb {
+
+static void DeleteEntry(const Slice& key, void* value) {
+  log::VReader* reader = reinterpret_cast<log::VReader*>(value);
+  delete reader;//reader析构时会delete掉file
+}
+
+VlogCache::VlogCache(Env* env, int entries)
+    : env_(env),
+      cache_(NewLRUCache(entries)) {
+}
+
+VlogCache::~VlogCache() {
+  delete cache_;
+}
+
+Status VlogCache::FindVlog(uint64_t number, const std::string& fname,
+                           Cache::Handle** handle) {
+  Status s;
+  char buf[sizeof(number)];
+  EncodeFixed64(buf, number);
+  Slice key(buf, sizeof(buf));
+  *handle = cache_->Lookup(key);
+  if (*handle == NULL) {
+    SequentialFile* file = NULL;
+    s = env_->NewSequentialFile(fname, &file);
+    if (s.ok()) {
+      //两个线程同时打开同一个vlog时后插入的替换先插入的，先插入的用完就关闭
+      log::VReader* reader = new log::VReader(file, true, 0);
+      *handle = cache_->Insert(key, reader, 1, &DeleteEntry);
+    }
+    // We do not cache error results so that if the error is transient,
+    // or somebody repairs the file, we recover automatically.
+  }
+  return s;
+}
+
+Status VlogCache::Read(uint64_t number, const std::string& fname, uint64_t pos,
+                       size_t size, char* scratch, size_t* n) {
+  Cache::Handle* handle = NULL;
+  Status s = FindVlog(number, fname, &handle);
+  if (s.ok()) {
+    log::VReader* reader = reinterpret_cast<log::VReader*>(cache_->Value(handle));
+    if (!reader->ReadUpTo(scratch, size, pos, n)) {
+      s = Status::IOError("read vlog failed", fname);
+    }
+    cache_->Release(handle);
+  }
+  return s;
+}
+
+Status VlogCache::DeallocateDiskSpace(uint64_t number, const std::string& fname,
+                                      uint64_t offset, uint64_t len) {
+  Cache::Handle* handle = NULL;
+  Status s = FindVlog(number, fname, &handle);
+  if (s.ok()) {
+    log::VReader* reader = reinterpret_cast<log::VReader*>(cache_->Value(handle));
+    if (!reader->DeallocateDiskSpace(offset, len)) {
+      s = Status::IOError("deallocate vlog space failed", fname);
+    }
+    cache_->Release(handle);
+  }
+  return s;
+}
+
+void VlogCache::Evict(uint64_t number) {
+  char buf[sizeof(number)];
+  EncodeFixed64(buf, number);
+  cache_->Erase(Slice(buf, sizeof(buf)));
+}
+
+}  // namespace leveldb
@@ -0,0 +1,48 @@
+// Thread-safe (provides internal synchronization)
+
+#ifndef STORAGE_LEVELDB_DB_VLOG_CACHE_H_
+#define STORAGE_LEVELDB_DB_VLOG_CACHE_H_
+
+#include <string>
+#include <stdint.h>
+#include "leveldb/cache.h"
+#include "leveldb/status.h"
+#include "port/port.h"
+
+namespace leveldb {
+
+class Env;
+
+//按vlog编号缓存读vlog用的reader，第一次读某个vlog时才打开文件，
+//打开的vlog超过entries个时关掉最久没用的。正在读的reader被淘汰后，读完才关闭
+class VlogCache {
+ public:
+  VlogCache(Env* env, int entries);
+  ~VlogCache();
+
+  //从编号为number的vlog的pos处读最多size字节到scratch，*n为实际读到的字节数，
+  //只有读到文件尾时才会少于size。fname是vlog现在所在的路径，没打开时用它打开
+  Status Read(uint64_t number, const std::string& fname, uint64_t pos,
+              size_t size, char* scratch, size_t* n);
+
+  //释放vlog中offset偏移处len长的磁盘空间
+  Status DeallocateDiskSpace(uint64_t number, const std::string& fname,
+                             uint64_t offset, uint64_t len);
+
+  //vlog删掉、重用或者搬到别的目录后调用，下次读时按新路径重新打开
+  void Evict(uint64_t number);
+
+ private:
+  Env* const env_;
+  Cache* cache_;
+
+  Status FindVlog(uint64_t number, const std::string& fname, Cache::Handle**);
+
+  // No copying allowed
+  VlogCache(const VlogCache&);
+  void operator=(const VlogCache&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_VLOG_CACHE_H_
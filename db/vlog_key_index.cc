@@ -0,0 +1,91 @@
+#include "db/vlog_key_index.h"
+#include "leveldb/write_batch.h"
+#include "util/hash.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+class IndexUpdater : public WriteBatch::Handler {
+ public:
+  VlogKeyIndex* index_;
+  virtual void Put(const Slice& key, const Slice& value) {
+    index_->Put(key, value);
+  }
+  virtual void Delete(const Slice& key) {
+    index_->Delete(key);
+  }
+};
+}  // namespace
+
+VlogKeyIndex::VlogKeyIndex(int partitions)
+    : num_partitions_(partitions > 0 ? partitions : 1),
+      partitions_(new Partition[num_partitions_])
+{
+}
+
+VlogKeyIndex::~VlogKeyIndex()
+{
+    delete[] partitions_;
+}
+
+VlogKeyIndex::Partition* VlogKeyIndex::GetPartition(const Slice& key)
+{
+    return &partitions_[Hash(key.data(), key.size(), 0) % num_partitions_];
+}
+
+void VlogKeyIndex::Apply(const WriteBatch* batch, uint64_t pos, uint64_t file_numb)
+{
+    IndexUpdater updater;
+    updater.index_ = this;
+    batch->Iterate(&updater, pos, file_numb);//batch已经成功插入过memtable，不会出错
+}
+
+void VlogKeyIndex::Put(const Slice& key, const Slice& ptr)
+{
+    Partition* p = GetPartition(key);
+    MutexLock l(&p->mutex_);
+    p->ptrs_[key.ToString()].assign(ptr.data(), ptr.size());
+}
+
+void VlogKeyIndex::Delete(const Slice& key)
+{
+    Partition* p = GetPartition(key);
+    MutexLock l(&p->mutex_);
+    p->ptrs_.erase(key.ToString());
+}
+
+bool VlogKeyIndex::Replace(const Slice& key, const Slice& old_ptr, const Slice& new_ptr)
+{
+    Partition* p = GetPartition(key);
+    MutexLock l(&p->mutex_);
+    std::tr1::unordered_map<std::string, std::string>::iterator iter = p->ptrs_.find(key.ToString());
+    if(iter == p->ptrs_.end() || Slice(iter->second) != old_ptr)
+        return false;
+    iter->second.assign(new_ptr.data(), new_ptr.size());
+    return true;
+}
+
+bool VlogKeyIndex::Get(const Slice& key, std::string* ptr)
+{
+    Partition* p = GetPartition(key);
+    MutexLock l(&p->mutex_);
+    std::tr1::unordered_map<std::string, std::string>::const_iterator iter = p->ptrs_.find(key.ToString());
+    if(iter == p->ptrs_.end())
+        return false;
+    *ptr = iter->second;
+    return true;
+}
+
+uint64_t VlogKeyIndex::NumKeys()
+{
+    uint64_t n = 0;
+    for(int i = 0; i < num_partitions_; i++)
+    {
+        MutexLock l(&partitions_[i].mutex_);
+        n += partitions_[i].ptrs_.size();
+    }
+    return n;
+}
+
+}
@@ -0,0 +1,50 @@
+#ifndef STORAGE_LEVELDB_DB_VLOG_KEY_INDEX_H_
+#define STORAGE_LEVELDB_DB_VLOG_KEY_INDEX_H_
+
+#include <stdint.h>
+#include <string>
+#include <tr1/unordered_map>
+#include "leveldb/slice.h"
+#include "port/port.h"
+
+namespace leveldb {
+
+class WriteBatch;
+
+//内存里记录每个key最新的值指针，按key的hash分成多个分区，每个分区一把锁。
+//gc判断一条vlog记录是否有效时查这里，不用再到lsm里GetPtr。
+//打开数据库时从lsm扫一遍建立，之后用户写入、gc搬迁、合并搬迁都要同步更新
+class VlogKeyIndex
+{
+    public:
+        explicit VlogKeyIndex(int partitions);
+        ~VlogKeyIndex();
+
+        //用户写入的batch，pos是batch在file_numb中的起始位置
+        void Apply(const WriteBatch* batch, uint64_t pos, uint64_t file_numb);
+        void Put(const Slice& key, const Slice& ptr);
+        void Delete(const Slice& key);
+        //key的指针还是old_ptr时才换成new_ptr并返回true，搬迁期间用户可能已经写了新值
+        bool Replace(const Slice& key, const Slice& old_ptr, const Slice& new_ptr);
+        //key被删除或者不存在时返回false
+        bool Get(const Slice& key, std::string* ptr);
+        uint64_t NumKeys();
+
+    private:
+        struct Partition{
+            port::Mutex mutex_;
+            std::tr1::unordered_map<std::string, std::string> ptrs_;
+        };
+        Partition* GetPartition(const Slice& key);
+
+        const int num_partitions_;
+        Partition* partitions_;
+
+        // No copying allowed
+        VlogKeyIndex(const VlogKeyIndex&);
+        void operator=(const VlogKeyIndex&);
+};
+
+}
+
+#endif
@@ -1,74 +1,145 @@
-#include "db/vlog_reader.h"
 #include "db/vlog_manager.h"
+#include <algorithm>
 #include "util/coding.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
-    VlogManager::VlogManager(uint64_t clean_threshold):clean_threshold_(clean_threshold),now_vlog_(0),cleaning_vlog_(0)
+    static const uint64_t kExtentsMarker = ~static_cast<uint64_t>(0);//旧格式里失效区间的开始
+    static const uint64_t kFormatMarker = ~static_cast<uint64_t>(1);//现在的格式，旧格式开头不会是它
+    static const uintptr_t kReadSampleInterval = 16;
+    static const int kMigrateColdPeriods = 2;
+
+    VlogManager::VlogManager(uint64_t clean_threshold):clean_threshold_(clean_threshold),now_vlog_(0),cold_vlog_(0),cleaning_vlog_(0),has_paths_(NULL),read_counter_(NULL),has_forwards_(NULL)
     {
     }
 
     VlogManager::~VlogManager()
     {
-        std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.begin();
-        for(;iter != manager_.end();iter++)
-        {
-            delete iter->second.vlog_;
-        }
     }
 
-    void VlogManager::AddVlog(uint64_t vlog_numb, log::VReader* vlog)
+    void VlogManager::AddVlog(uint64_t vlog_numb, bool is_now, int path)
     {
+        MutexLock l(&mutex_);
         VlogInfo v;
-        v.vlog_ = vlog;
         v.count_ = 0;
+        v.estimated_count_ = 0;
+        v.to_punch_bytes_ = 0;
+        v.expiration_ = 0;
+        v.path_ = path;
+        v.cold_periods_ = 0;
         bool b = manager_.insert(std::make_pair(vlog_numb, v)).second;
         assert(b);
-        now_vlog_ = vlog_numb;
+        if(is_now)
+            now_vlog_ = vlog_numb;
+        PublishPath(vlog_numb, path);
     }
 //得在单独加一个set nowlog接口,因为dbimpl->recover时最后addDropCount不一定就是now_vlog_
     void VlogManager::SetNowVlog(uint64_t vlog_numb)
     {
+        MutexLock l(&mutex_);
         now_vlog_ = vlog_numb;
     }
 
+    void VlogManager::SetColdVlog(uint64_t vlog_numb)
+    {
+        MutexLock l(&mutex_);
+        uint64_t old = cold_vlog_;
+        cold_vlog_ = vlog_numb;
+        //写满的cold vlog在写的时候垃圾就可能已经超过阈值了，换下来后才能回收
+        std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.find(old);
+        if(iter != manager_.end() && GarbageCount(iter->second) >= clean_threshold_ && old != now_vlog_)
+            cleaning_vlog_set_.insert(old);
+    }
+
     void VlogManager::RemoveCleaningVlog()//与GetVlogToClean对应
     {
+        MutexLock l(&mutex_);
         assert(cleaning_vlog_>0);
-        std::tr1::unordered_map<uint64_t, VlogInfo>::const_iterator iter = manager_.find (cleaning_vlog_);
-        delete iter->second.vlog_;
-        manager_.erase(iter);
+        manager_.erase(cleaning_vlog_);
+        PublishPath(cleaning_vlog_, 0);
         cleaning_vlog_set_.erase(cleaning_vlog_);
         cleaning_vlog_=0;
     }
     void VlogManager::RemoveCleaningVlog(uint64_t vlog_numb)//与GetVlogsToClean对应
     {
-        std::tr1::unordered_map<uint64_t, VlogInfo>::const_iterator iter = manager_.find (vlog_numb);
-        delete iter->second.vlog_;
-        manager_.erase(iter);
+        MutexLock l(&mutex_);
+        if(cleaning_vlog_ == vlog_numb)
+            cleaning_vlog_ = 0;
+        manager_.erase(vlog_numb);
+        cleaning_vlog_set_.erase(vlog_numb);
+        PublishPath(vlog_numb, 0);
+    }
+
+    void VlogManager::RemoveVlog(uint64_t vlog_numb)
+    {
+        MutexLock l(&mutex_);
+        manager_.erase(vlog_numb);
         cleaning_vlog_set_.erase(vlog_numb);
+        PublishPath(vlog_numb, 0);
+    }
+
+    uint64_t VlogManager::GetDropCount(uint64_t vlog_numb)
+    {
+        MutexLock l(&mutex_);
+        std::tr1::unordered_map<uint64_t, VlogInfo>::const_iterator iter = manager_.find(vlog_numb);
+        return iter == manager_.end() ? 0 : iter->second.count_;
     }
 
     void VlogManager::AddDropCount(uint64_t vlog_numb)
     {
+        MutexLock l(&mutex_);
          std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.find (vlog_numb);
          if(iter != manager_.end())
          {
             iter->second.count_++;
-            if(iter->second.count_ >= clean_threshold_ && vlog_numb != now_vlog_)
+            if(GarbageCount(iter->second) >= clean_threshold_ && vlog_numb != now_vlog_ && vlog_numb != cold_vlog_ &&
+               iter->second.expiration_ == 0)
             {
                 cleaning_vlog_set_.insert(vlog_numb);
             }
          }//否则说明该vlog已经clean过了
     }
 
+    void VlogManager::SetExpiration(uint64_t vlog_numb, uint64_t expiration)
+    {
+        MutexLock l(&mutex_);
+         std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.find (vlog_numb);
+         if(iter != manager_.end())
+            iter->second.expiration_ = expiration;
+    }
+
+    uint64_t VlogManager::GetExpiration(uint64_t vlog_numb)
+    {
+        MutexLock l(&mutex_);
+         std::tr1::unordered_map<uint64_t, VlogInfo>::const_iterator iter = manager_.find (vlog_numb);
+         return iter == manager_.end() ? 0 : iter->second.expiration_;
+    }
+
+    void VlogManager::SetEstimatedDropCount(uint64_t vlog_numb, uint64_t count)
+    {
+        MutexLock l(&mutex_);
+         std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.find (vlog_numb);
+         if(iter != manager_.end())
+         {
+            iter->second.estimated_count_ = count;
+            if(GarbageCount(iter->second) >= clean_threshold_ && vlog_numb != now_vlog_ && vlog_numb != cold_vlog_ &&
+               iter->second.expiration_ == 0)
+            {
+                cleaning_vlog_set_.insert(vlog_numb);
+            }
+         }
+    }
+
     std::set<uint64_t> VlogManager::GetVlogsToClean(uint64_t clean_threshold)
     {
+        MutexLock l(&mutex_);
         std::set<uint64_t> res;
         std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.begin();
         for(;iter != manager_.end();iter++)
         {
-            if(iter->second.count_ >= clean_threshold && iter->first != now_vlog_)
+            if(GarbageCount(iter->second) >= clean_threshold && iter->first != now_vlog_ && iter->first != cold_vlog_ &&
+               iter->second.expiration_ == 0)
                 res.insert(iter->first);
         }
         return res;
@@ -76,75 +147,442 @@ namespace leveldb {
 
     uint64_t VlogManager::GetVlogToClean()
     {
+        MutexLock l(&mutex_);
         if(cleaning_vlog_ == 0)//数据库open时如果有需要恢复的clean时cleaning_vlog_不为0,
         {
+            //HasVlogToClean之后该vlog可能已经没有引用被删掉了
             std::tr1::unordered_set<uint64_t>::iterator iter = cleaning_vlog_set_.begin();
-            assert(iter != cleaning_vlog_set_.end());
-            cleaning_vlog_ = *iter;
+            if(iter != cleaning_vlog_set_.end())
+                cleaning_vlog_ = *iter;
         }
         return cleaning_vlog_;
     }
 
-    log::VReader* VlogManager::GetVlog(uint64_t vlog_numb)
+    bool VlogManager::CanClean(uint64_t vlog_numb)
+    {
+        MutexLock l(&mutex_);
+        std::tr1::unordered_map<uint64_t, VlogInfo>::const_iterator iter = manager_.find(vlog_numb);
+        return vlog_numb != now_vlog_ && vlog_numb != cold_vlog_ &&
+               iter != manager_.end() && iter->second.expiration_ == 0;
+    }
+
+    void VlogManager::SetCleaningVlog(uint64_t vlog_numb)
+    {
+        MutexLock l(&mutex_);
+        cleaning_vlog_ = vlog_numb;
+    }
+
+    bool VlogManager::ShouldRelocate(uint64_t vlog_numb, uint64_t threshold)
+    {
+        MutexLock l(&mutex_);
+        if(vlog_numb == now_vlog_ || vlog_numb == cold_vlog_ || vlog_numb == cleaning_vlog_)
+            return false;
+        std::tr1::unordered_map<uint64_t, VlogInfo>::const_iterator iter = manager_.find(vlog_numb);
+        return iter != manager_.end() && GarbageCount(iter->second) >= threshold &&
+               iter->second.expiration_ == 0;
+    }
+
+    static bool ForwardBefore(const VlogManager::Forward& f, uint64_t pos)
+    {
+        return f.old_pos_ < pos;
+    }
+
+    void VlogManager::AddForward(uint64_t vlog_numb, const Forward& forward)
+    {
+        MutexLock l(&forward_mutex_);
+        std::vector<Forward>& forwards = forwards_[vlog_numb];
+        if(forwards.empty() || forwards.back().old_pos_ < forward.old_pos_)
+        {
+            forwards.push_back(forward);
+        }
+        else
+        {//同一个vlog停下后又从头回收，或者恢复时加载乱序的转发文件
+            std::vector<Forward>::iterator iter =
+                std::lower_bound(forwards.begin(), forwards.end(), forward.old_pos_, ForwardBefore);
+            if(iter != forwards.end() && iter->old_pos_ == forward.old_pos_)
+                *iter = forward;
+            else
+                forwards.insert(iter, forward);
+        }
+        has_forwards_.Release_Store(this);
+    }
+
+    void VlogManager::RemoveForwards(uint64_t vlog_numb)
+    {
+        MutexLock l(&forward_mutex_);
+        forwards_.erase(vlog_numb);
+    }
+
+    bool VlogManager::ResolveForward(uint64_t* file_numb, uint64_t* pos)
+    {
+        if(has_forwards_.Acquire_Load() == NULL)
+            return false;
+        MutexLock l(&forward_mutex_);
+        bool forwarded = false;
+        while(true)
+        {//搬过去的值可能又被gc搬走了，一直找到没有转发的位置
+            std::tr1::unordered_map<uint64_t, std::vector<Forward> >::const_iterator iter = forwards_.find(*file_numb);
+            if(iter == forwards_.end())
+                break;
+            const std::vector<Forward>& forwards = iter->second;
+            std::vector<Forward>::const_iterator f =
+                std::lower_bound(forwards.begin(), forwards.end(), *pos, ForwardBefore);
+            if(f == forwards.end() || f->old_pos_ != *pos)
+                break;
+            *file_numb = f->new_file_;
+            *pos = f->new_pos_;
+            forwarded = true;
+        }
+        return forwarded;
+    }
+
+    void VlogManager::AddForwardTargets(std::set<uint64_t>* live, uint64_t min_live_vlog)
+    {
+        MutexLock l(&forward_mutex_);
+        std::vector<uint64_t> pending(live->begin(), live->end());
+        std::tr1::unordered_map<uint64_t, std::vector<Forward> >::const_iterator it = forwards_.begin();
+        for(; it != forwards_.end(); it++)
+        {
+            if(it->first >= min_live_vlog && live->insert(it->first).second)
+                pending.push_back(it->first);
+        }
+        while(!pending.empty())
+        {
+            uint64_t vlog_numb = pending.back();
+            pending.pop_back();
+            std::tr1::unordered_map<uint64_t, std::vector<Forward> >::const_iterator iter = forwards_.find(vlog_numb);
+            if(iter == forwards_.end())
+                continue;
+            const std::vector<Forward>& forwards = iter->second;
+            for(size_t i = 0; i < forwards.size(); i++)
+            {
+                if(live->insert(forwards[i].new_file_).second)
+                    pending.push_back(forwards[i].new_file_);
+            }
+        }
+    }
+
+    void VlogManager::EncodeForwards(const std::vector<Forward>& forwards, std::string* dst)
+    {
+        for(size_t i = 0; i < forwards.size(); i++)
+        {
+            PutVarint64(dst, forwards[i].old_pos_);
+            PutVarint64(dst, forwards[i].new_file_);
+            PutVarint64(dst, forwards[i].new_pos_);
+        }
+    }
+
+    bool VlogManager::DecodeForwards(Slice input, std::vector<Forward>* forwards)
+    {
+        while(!input.empty())
+        {
+            Forward f;
+            if(!GetVarint64(&input, &f.old_pos_) || !GetVarint64(&input, &f.new_file_) ||
+               !GetVarint64(&input, &f.new_pos_))
+                return false;
+            forwards->push_back(f);
+        }
+        return true;
+    }
+
+    bool VlogManager::HasVlog(uint64_t vlog_numb)
+    {
+        MutexLock l(&mutex_);
+        return manager_.find(vlog_numb) != manager_.end();
+    }
+
+    int VlogManager::GetPath(uint64_t vlog_numb)
+    {
+        if(has_paths_.Acquire_Load() == NULL)
+            return 0;
+        MutexLock l(&path_mutex_);
+        PathMap::const_iterator iter = paths_.find(vlog_numb);
+        return iter == paths_.end() ? 0 : iter->second;
+    }
+
+    void VlogManager::MoveVlog(uint64_t vlog_numb, int path)
+    {
+        MutexLock l(&mutex_);
+        std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.find (vlog_numb);
+        assert(iter != manager_.end());
+        iter->second.path_ = path;
+        PublishPath(vlog_numb, path);
+    }
+
+    void VlogManager::PublishPath(uint64_t vlog_numb, int path)
     {
-        std::tr1::unordered_map<uint64_t, VlogInfo>::const_iterator iter = manager_.find (vlog_numb);
-        if(iter == manager_.end())
-            return NULL;
+        MutexLock l(&path_mutex_);
+        if(path == 0)
+            paths_.erase(vlog_numb);
         else
-            return iter->second.vlog_;
+            paths_[vlog_numb] = path;
+        has_paths_.Release_Store(paths_.empty() ? NULL : this);
+    }
+
+    void VlogManager::SampleRead(uint64_t vlog_numb)
+    {
+        const uintptr_t n = reinterpret_cast<uintptr_t>(read_counter_.NoBarrier_Load()) + 1;
+        read_counter_.NoBarrier_Store(reinterpret_cast<void*>(n));
+        if(n % kReadSampleInterval != 0)
+            return;
+        MutexLock l(&read_mutex_);
+        sampled_reads_[vlog_numb]++;
+    }
+
+    void VlogManager::GetVlogsToMigrate(uint64_t threshold, uint64_t max_vlog, std::vector<uint64_t>* vlogs)
+    {
+        std::tr1::unordered_map<uint64_t, uint64_t> reads;
+        {
+            MutexLock l(&read_mutex_);
+            reads.swap(sampled_reads_);
+        }
+        MutexLock l(&mutex_);
+        std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.begin();
+        for(;iter != manager_.end();iter++)
+        {
+            VlogInfo& info = iter->second;
+            if(info.path_ != 0)
+                continue;
+            std::tr1::unordered_map<uint64_t, uint64_t>::const_iterator r = reads.find(iter->first);
+            const uint64_t n = (r == reads.end() ? 0 : r->second * kReadSampleInterval);
+            if(iter->first == now_vlog_ || iter->first == cold_vlog_ || iter->first >= max_vlog ||
+               info.expiration_ != 0 || cleaning_vlog_set_.count(iter->first) > 0 || n >= threshold)
+            {//刚写完的vlog至少要观察一个完整的周期
+                info.cold_periods_ = 0;
+                continue;
+            }
+            if(++info.cold_periods_ >= kMigrateColdPeriods)
+                vlogs->push_back(iter->first);
+        }
+        std::sort(vlogs->begin(), vlogs->end());
     }
 
     bool VlogManager::HasVlogToClean()
     {
+        MutexLock l(&mutex_);
         return !cleaning_vlog_set_.empty();
     }
 
-    bool VlogManager::Serialize(std::string& val)
+    void VlogManager::InsertExtent(std::map<uint64_t, uint64_t>* dead, uint64_t start, uint64_t end)
+    {
+        std::map<uint64_t, uint64_t>::iterator iter = dead->upper_bound(start);
+        if(iter != dead->begin())
+        {
+            --iter;
+            if(iter->second >= start)
+            {//和前一个区间相连
+                start = iter->first;
+                if(iter->second > end)
+                    end = iter->second;
+                dead->erase(iter++);
+            }
+            else
+                ++iter;
+        }
+        while(iter != dead->end() && iter->first <= end)
+        {//和后面的区间相连
+            if(iter->second > end)
+                end = iter->second;
+            dead->erase(iter++);
+        }
+        (*dead)[start] = end;
+    }
+
+    void VlogManager::AddDeadExtent(uint64_t vlog_numb, uint64_t pos, uint64_t size)
+    {
+        MutexLock l(&mutex_);
+        std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.find(vlog_numb);
+        if(iter != manager_.end())
+            iter->second.unsaved_.push_back(std::make_pair(pos, pos + size));
+    }
+
+    void VlogManager::GetDeadExtents(uint64_t vlog_numb, std::map<uint64_t, uint64_t>* extents)
+    {
+        MutexLock l(&mutex_);
+        extents->clear();
+        std::tr1::unordered_map<uint64_t, VlogInfo>::const_iterator iter = manager_.find(vlog_numb);
+        if(iter != manager_.end())
+            *extents = iter->second.dead_;
+    }
+
+    bool VlogManager::CanPunch(uint64_t vlog_numb, const VlogInfo& info, uint64_t threshold, uint64_t min_replay_vlog)
+    {
+        return info.to_punch_bytes_ >= threshold && vlog_numb < min_replay_vlog &&
+               vlog_numb != now_vlog_ && vlog_numb != cold_vlog_ && vlog_numb != cleaning_vlog_;
+    }
+
+    bool VlogManager::HasHolesToPunch(uint64_t threshold, uint64_t min_replay_vlog)
+    {
+        MutexLock l(&mutex_);
+        std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.begin();
+        for(;iter != manager_.end();iter++)
+        {
+            if(CanPunch(iter->first, iter->second, threshold, min_replay_vlog))
+                return true;
+        }
+        return false;
+    }
+
+    void VlogManager::GetHolesToPunch(uint64_t threshold, uint64_t min_replay_vlog, std::vector<Hole>* holes)
     {
+        MutexLock l(&mutex_);
+        static const uint64_t kPunchAlign = 4096;//只释放整块的磁盘空间
+        std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.begin();
+        for(;iter != manager_.end();iter++)
+        {
+            VlogInfo& info = iter->second;
+            if(!CanPunch(iter->first, info, threshold, min_replay_vlog))
+                continue;
+            std::set<uint64_t> done;//新的失效区间可能已经合并到同一个大区间里了
+            for(size_t i = 0; i < info.to_punch_.size(); i++)
+            {
+                std::map<uint64_t, uint64_t>::iterator extent = info.dead_.upper_bound(info.to_punch_[i].first);
+                assert(extent != info.dead_.begin());
+                --extent;
+                if(!done.insert(extent->first).second)
+                    continue;
+                uint64_t start = (extent->first + kPunchAlign - 1) / kPunchAlign * kPunchAlign;
+                uint64_t end = extent->second / kPunchAlign * kPunchAlign;
+                if(start < end)
+                {
+                    Hole hole;
+                    hole.vlog_numb_ = iter->first;
+                    hole.offset_ = start;
+                    hole.len_ = end - start;
+                    holes->push_back(hole);
+                }
+            }
+            info.to_punch_.clear();
+            info.to_punch_bytes_ = 0;
+        }
+    }
+
+    bool VlogManager::Serialize(std::string& val)
+    {//开头8字节的格式标记之后，每个vlog依次是：vlog编号，垃圾数，失效区间个数，每个区间的起点和长度
+        MutexLock l(&mutex_);
         val.clear();
-        uint64_t size = manager_.size();
-        if(size == 0)
+        if(manager_.empty())
             return false;
 
+        char buf[8];
+        EncodeFixed64(buf, kFormatMarker);
+        val.append(buf, 8);
         std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.begin();
         for(;iter != manager_.end();iter++)
         {
-            char buf[8];
-            EncodeFixed64(buf, (iter->second.count_ << 16) | iter->first);
-            val.append(buf, 8);
+            //本次持久化之后这些区间就可以打洞了
+            VlogInfo& info = iter->second;
+            for(size_t i = 0; i < info.unsaved_.size(); i++)
+            {
+                InsertExtent(&info.dead_, info.unsaved_[i].first, info.unsaved_[i].second);
+                info.to_punch_.push_back(info.unsaved_[i]);
+                info.to_punch_bytes_ += info.unsaved_[i].second - info.unsaved_[i].first;
+            }
+            info.unsaved_.clear();
+            PutVarint64(&val, iter->first);
+            PutVarint64(&val, info.count_);
+            PutVarint64(&val, info.dead_.size());
+            std::map<uint64_t, uint64_t>::const_iterator extent = info.dead_.begin();
+            for(;extent != info.dead_.end();extent++)
+            {
+                PutVarint64(&val, extent->first);
+                PutVarint64(&val, extent->second - extent->first);
+            }
         }
         return true;
     }
 
+    bool VlogManager::IsLegacyFormat(const Slice& val)
+    {
+        return val.size() < 8 || DecodeFixed64(val.data()) != kFormatMarker;
+    }
+
     bool VlogManager::Deserialize(std::string& val)
     {
+        MutexLock l(&mutex_);
         Slice input(val);
+        if(IsLegacyFormat(input))
+            return DeserializeLegacy(input);
+        input.remove_prefix(8);
         while(!input.empty())
+        {
+            uint64_t file_numb, count, n;
+            if(!GetVarint64(&input, &file_numb) || !GetVarint64(&input, &count) ||
+               !GetVarint64(&input, &n))
+                return false;
+            RestoreDropCount(file_numb, count);
+            if(!DecodeExtents(&input, file_numb, n))
+                return false;
+        }
+        return true;
+    }
+
+    //旧格式每个vlog占8字节，(垃圾数 << 16) | vlog编号，vlog编号只有16位；
+    //8字节全1之后是各个vlog的失效区间：vlog编号，区间个数，每个区间的起点和长度
+    bool VlogManager::DeserializeLegacy(Slice input)
+    {
+        while(input.size() >= 8)
         {
             uint64_t code = DecodeFixed64(input.data());
-            uint64_t file_numb = code & 0xffff;
-            size_t count = code>>16;
-            if(manager_.count(file_numb) > 0)//检查manager_现在是否还有该vlog，因为有可能已经删除了
+            input.remove_prefix(8);
+            if(code == kExtentsMarker)
             {
-                manager_[file_numb].count_ = count;
-                if(count >= clean_threshold_ && file_numb != now_vlog_)
+                while(!input.empty())
                 {
-                    cleaning_vlog_set_.insert(file_numb);
+                    uint64_t file_numb, n;
+                    if(!GetVarint64(&input, &file_numb) || !GetVarint64(&input, &n) ||
+                       !DecodeExtents(&input, file_numb, n))
+                        return false;
                 }
+                return true;
             }
-            input.remove_prefix(8);
+            RestoreDropCount(code & 0xffff, code >> 16);
         }
         return true;
     }
 
-    void VlogManager::Recover(uint64_t vlog_numb)
+    void VlogManager::RestoreDropCount(uint64_t file_numb, uint64_t count)
     {
-        std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.find(vlog_numb);
-        if(iter != manager_.end())
+        std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.find(file_numb);
+        if(iter != manager_.end())//检查manager_现在是否还有该vlog，因为有可能已经删除了
         {
-            assert(iter->second.count_ >= clean_threshold_);
-            cleaning_vlog_ = vlog_numb;
+            iter->second.count_ = count;
+            if(GarbageCount(iter->second) >= clean_threshold_ && file_numb != now_vlog_ &&
+               iter->second.expiration_ == 0)
+            {
+                cleaning_vlog_set_.insert(file_numb);
+            }
         }
     }
 
+    bool VlogManager::DecodeExtents(Slice* input, uint64_t file_numb, uint64_t n)
+    {
+        std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.find(file_numb);
+        for(uint64_t i = 0; i < n; i++)
+        {
+            uint64_t start, len;
+            if(!GetVarint64(input, &start) || !GetVarint64(input, &len))
+                return false;
+            if(iter != manager_.end())
+            {//不知道上次关闭前打洞了没有，重新打一次也没关系
+                InsertExtent(&iter->second.dead_, start, start + len);
+                iter->second.to_punch_.push_back(std::make_pair(start, start + len));
+                iter->second.to_punch_bytes_ += len;
+            }
+        }
+        return true;
+    }
+
+    bool VlogManager::Recover(uint64_t vlog_numb)
+    {
+        MutexLock l(&mutex_);
+        std::tr1::unordered_map<uint64_t, VlogInfo>::iterator iter = manager_.find(vlog_numb);
+        //手动gc回收的vlog垃圾数可能不到阈值，重启后不接着回收
+        if(iter == manager_.end() || GarbageCount(iter->second) < clean_threshold_ ||
+           iter->second.expiration_ != 0)
+            return false;
+        cleaning_vlog_ = vlog_numb;
+        return true;
+    }
+
 }
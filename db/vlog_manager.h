@@ -3,41 +3,140 @@
 
 #include <tr1/unordered_map>
 #include <tr1/unordered_set>
-#include "db/vlog_reader.h"
+#include "leveldb/slice.h"
+#include "port/port.h"
+#include <algorithm>
+#include <map>
 #include <set>
+#include <vector>
 
 namespace leveldb {
+    //可以不持有db的mutex_调用：元数据由自己的mutex_保护，临界区里不做io；
+    //读路径上的GetPath、ResolveForward和SampleRead不用这把锁
     class VlogManager
     {
         public:
+            //只记录vlog的元数据，读vlog用的reader在VlogCache里，用到时才打开
             struct VlogInfo{
-                log::VReader* vlog_;
                 uint64_t count_;//代表该vlog文件垃圾kv的数量
+                uint64_t estimated_count_;//抽样估计的垃圾数，不持久化，挑回收对象时和count_取大的
+                std::map<uint64_t, uint64_t> dead_;//已经持久化的失效区间[start,end)，相邻的区间会合并
+                std::vector<std::pair<uint64_t, uint64_t> > unsaved_;//还没有持久化的失效区间
+                std::vector<std::pair<uint64_t, uint64_t> > to_punch_;//已经持久化但还没有打洞的失效区间
+                uint64_t to_punch_bytes_;
+                uint64_t expiration_;//ttl vlog里所有值都在这之前过期，0代表不是ttl vlog
+                int path_;//0代表在dbname_下，i代表搬到了第i个冷存储目录
+                int cold_periods_;//连续多少个检查周期读得少
+            };
+            struct Hole{
+                uint64_t vlog_numb_;
+                uint64_t offset_;
+                uint64_t len_;
+            };
+            //gc把old_pos处的值搬到了new_file的new_pos处，lsm里的指针还是旧的
+            struct Forward{
+                uint64_t old_pos_;
+                uint64_t new_file_;
+                uint64_t new_pos_;
             };
 
             VlogManager(uint64_t clean_threshold);
             ~VlogManager();
 
-            void AddVlog(uint64_t vlog_numb, log::VReader* vlog);//vlog一定要是new出来的，vlog_manager的析构函数会delete它
+            //gc写的cold vlog不是当前vlog,is_now为false
+            void AddVlog(uint64_t vlog_numb, bool is_now = true, int path = 0);
             void RemoveCleaningVlog();
             void RemoveCleaningVlog(uint64_t vlog_numb);
+            //没有任何sst和memtable引用的vlog直接删掉，不用等gc
+            void RemoveVlog(uint64_t vlog_numb);
 
-            log::VReader* GetVlog(uint64_t vlog_numb);
+            bool HasVlog(uint64_t vlog_numb);
+            //vlog所在的目录，见VlogInfo::path_。只用paths_自己的锁，没有搬过vlog时不加锁
+            int GetPath(uint64_t vlog_numb);
+            //vlog已经拷到了path目录下，VlogCache里原来的reader要另外Evict
+            void MoveVlog(uint64_t vlog_numb, int path);
+            //RealValue每读一次调用一次，每kReadSampleInterval次记一次读的是哪个vlog
+            void SampleRead(uint64_t vlog_numb);
+            //结束一个检查周期：估计的读次数连续两个周期少于threshold、编号小于max_vlog、
+            //还在dbname_下的vlog放进vlogs，当前vlog、cold vlog、ttl vlog和正在回收的vlog除外
+            void GetVlogsToMigrate(uint64_t threshold, uint64_t max_vlog, std::vector<uint64_t>* vlogs);
             void AddDropCount(uint64_t vlog_numb);
             bool HasVlogToClean();
-            uint64_t GetDropCount(uint64_t vlog_numb){return manager_[vlog_numb].count_;}
+            uint64_t GetDropCount(uint64_t vlog_numb);
+            //ttl vlog不用gc，到期后整个删掉
+            void SetExpiration(uint64_t vlog_numb, uint64_t expiration);
+            uint64_t GetExpiration(uint64_t vlog_numb);
+            //抽样估计出来的垃圾数，单独记着，不加到count_上；GetDropCount返回的还是确切的垃圾数
+            void SetEstimatedDropCount(uint64_t vlog_numb, uint64_t count);
             std::set<uint64_t> GetVlogsToClean(uint64_t clean_threshold);
+            //返回0代表没有要回收的vlog了
             uint64_t GetVlogToClean();
+            //合并时是否顺便搬迁该vlog里的有效kv：垃圾数达到threshold，且不是当前vlog、cold vlog或者正在回收的vlog
+            bool ShouldRelocate(uint64_t vlog_numb, uint64_t threshold);
+            //手动gc能否回收该vlog：vlog还在，且不是当前vlog或者cold vlog
+            bool CanClean(uint64_t vlog_numb);
+            //手动gc正在回收的vlog，合并和自动gc不碰它；回收完由RemoveCleaningVlog清掉，中途停了设回0
+            void SetCleaningVlog(uint64_t vlog_numb);
             void SetNowVlog(uint64_t vlog_numb);
+            //gc正在往里追加的cold vlog，和now_vlog_一样不能被回收
+            void SetColdVlog(uint64_t vlog_numb);
+            //合并丢弃的指针在vlog中对应的区间，只有在下次Serialize持久化后才能打洞
+            void AddDeadExtent(uint64_t vlog_numb, uint64_t pos, uint64_t size);
+            //gc遍历有洞的vlog时要跳过这些区间
+            void GetDeadExtents(uint64_t vlog_numb, std::map<uint64_t, uint64_t>* extents);
+            //待打洞的字节数达到threshold的vlog，编号不小于min_replay_vlog的vlog恢复时要回放，不能打洞
+            bool HasHolesToPunch(uint64_t threshold, uint64_t min_replay_vlog);
+            void GetHolesToPunch(uint64_t threshold, uint64_t min_replay_vlog, std::vector<Hole>* holes);
+            //转发表有自己的锁，读路径不用持有db的mutex_
+            void AddForward(uint64_t vlog_numb, const Forward& forward);
+            void RemoveForwards(uint64_t vlog_numb);
+            //沿着转发表找到值现在的位置，返回false代表没有被转发过
+            bool ResolveForward(uint64_t* file_numb, uint64_t* pos);
+            //转发表指向的vlog也要保留，live里的vlog和编号不小于min_live_vlog的vlog沿转发表能到的都加进去
+            void AddForwardTargets(std::set<uint64_t>* live, uint64_t min_live_vlog);
+            static void EncodeForwards(const std::vector<Forward>& forwards, std::string* dst);
+            static bool DecodeForwards(Slice input, std::vector<Forward>* forwards);
             bool Serialize(std::string& val);
             bool Deserialize(std::string& val);
-            void Recover(uint64_t vlog_numb);
+            //val是vlog编号只有16位的旧格式，打开数据库时要马上用Serialize重写
+            static bool IsLegacyFormat(const Slice& val);
+            //重启后接着回收留下回收位置的vlog，vlog不在或者垃圾数不到阈值时返回false
+            bool Recover(uint64_t vlog_numb);
         private:
-            std::tr1::unordered_map<uint64_t, VlogInfo> manager_;
+            //挑回收对象用的垃圾数：确切的和估计的取大的，估计值里已经包含了确切的那部分
+            static uint64_t GarbageCount(const VlogInfo& info) {
+                return std::max(info.count_, info.estimated_count_);
+            }
+            bool DeserializeLegacy(Slice input);
+            void RestoreDropCount(uint64_t file_numb, uint64_t count);
+            bool DecodeExtents(Slice* input, uint64_t file_numb, uint64_t n);
+            static void InsertExtent(std::map<uint64_t, uint64_t>* dead, uint64_t start, uint64_t end);
+            bool CanPunch(uint64_t vlog_numb, const VlogInfo& info, uint64_t threshold, uint64_t min_replay_vlog);
+            //vlog所在目录有变化时更新paths_
+            void PublishPath(uint64_t vlog_numb, int path);
+
+            typedef std::tr1::unordered_map<uint64_t, int> PathMap;
+
+            port::Mutex mutex_;
+            std::tr1::unordered_map<uint64_t, VlogInfo> manager_;//以下受mutex_保护
             std::tr1::unordered_set<uint64_t> cleaning_vlog_set_;
             uint64_t clean_threshold_;
             uint64_t now_vlog_;
+            uint64_t cold_vlog_;
             uint64_t cleaning_vlog_;
+
+            port::Mutex path_mutex_;
+            PathMap paths_;//不在dbname_下的vlog所在的目录，受path_mutex_保护
+            port::AtomicPointer has_paths_;//没有搬过vlog时读路径不用加锁
+
+            port::Mutex read_mutex_;
+            port::AtomicPointer read_counter_;//丢几次计数无所谓，不用加锁
+            std::tr1::unordered_map<uint64_t, uint64_t> sampled_reads_;//受read_mutex_保护
+
+            port::Mutex forward_mutex_;
+            //每个vlog的转发表按old_pos_有序，gc顺序扫描vlog，转发基本都是追加到末尾
+            std::tr1::unordered_map<uint64_t, std::vector<Forward> > forwards_;
+            port::AtomicPointer has_forwards_;//没有转发表时读路径不用加锁
     };
 }
 
@@ -4,6 +4,7 @@
 
 #include "db/vlog_reader.h"
 #include <stdio.h>
+#include <algorithm>
 #include "leveldb/env.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
@@ -20,9 +21,20 @@ VReader::VReader(SequentialFile* file,  bool checksum,
     : file_(file),
       reporter_ (NULL),
       checksum_(checksum),
-      backing_store_(new char[kBlockSize]),//一次从磁盘读kblocksize，多余的做缓存以便下次读
+      block_size_(kBlockSize),//默认一次从磁盘读kblocksize，多余的做缓存以便下次读
+      env_(NULL),
+      backing_store_(NULL),
+      spare_store_(NULL),
       buffer_(),
-      eof_(false){
+      eof_(false),
+      clean_end_(false),
+      prefetching_(false),
+      prefetch_cv_(&prefetch_mutex_),
+      prefetch_done_(false),
+      prefetch_started_(false),
+      prefetch_requested_(false),
+      prefetch_stop_(false),
+      prefetch_exited_(false){
     if(initial_offset > 0)
         SkipToPos(initial_offset);
 }
@@ -32,77 +44,197 @@ VReader::VReader(SequentialFile* file, Reporter* reporter, bool checksum,
     : file_(file),
       reporter_ (reporter),
       checksum_(checksum),
-      backing_store_(new char[kBlockSize]),//一次从磁盘读kblocksize，多余的做缓存以便下次读
+      block_size_(kBlockSize),
+      env_(NULL),
+      backing_store_(NULL),
+      spare_store_(NULL),
       buffer_(),
-      eof_(false){
+      eof_(false),
+      clean_end_(false),
+      prefetching_(false),
+      prefetch_cv_(&prefetch_mutex_),
+      prefetch_done_(false),
+      prefetch_started_(false),
+      prefetch_requested_(false),
+      prefetch_stop_(false),
+      prefetch_exited_(false){
     if(initial_offset > 0)
         SkipToPos(initial_offset);
 }
 
 VReader::~VReader() {
+    WaitForPrefetch();//预读线程还在用file_和spare_store_
+    {
+        MutexLock l(&prefetch_mutex_);
+        if(prefetch_started_)
+        {
+            prefetch_stop_ = true;
+            prefetch_cv_.SignalAll();
+            while(!prefetch_exited_)
+                prefetch_cv_.Wait();
+        }
+    }
     delete[] backing_store_;
+    delete[] spare_store_;
     delete file_;
 }
 
+void VReader::EnableReadahead(Env* env, size_t buffer_size)
+{
+    assert(backing_store_ == NULL);
+    env_ = env;
+    block_size_ = std::max<size_t>(buffer_size, kVHeaderMaxSize);
+}
+
 bool VReader::SkipToPos(size_t pos) {
-  if (pos > 0) {//跳到距file文件头偏移pos的地方
-      Status skip_status = file_->SkipFromHead(pos);
-    if (!skip_status.ok()) {
-      ReportDrop(pos, skip_status);
-      return false;
-    }
+  //预读的内容是跳之前位置的，丢掉
+  WaitForPrefetch();
+  prefetching_ = false;
+  buffer_.clear();
+  eof_ = false;
+  //跳到距file文件头偏移pos的地方，读过之后再读开头也要跳回去；
+  //不支持跳的文件只能从头顺序读
+  Status skip_status = file_->SkipFromHead(pos);
+  if (!skip_status.ok() && !(pos == 0 && skip_status.IsNotSupportedError())) {
+    ReportDrop(pos, skip_status);
+    return false;
   }
   return true;
 }
 
+void VReader::PrefetchThread(void* arg)
+{
+    reinterpret_cast<VReader*>(arg)->PrefetchLoop();
+}
+
+void VReader::PrefetchLoop()
+{
+    prefetch_mutex_.Lock();
+    while(true)
+    {
+        while(!prefetch_requested_ && !prefetch_stop_)
+            prefetch_cv_.Wait();
+        if(prefetch_stop_)
+            break;
+        prefetch_requested_ = false;
+        prefetch_mutex_.Unlock();
+        Slice result;
+        Status s = file_->Read(block_size_, &result, spare_store_ + kVHeaderMaxSize);
+        prefetch_mutex_.Lock();
+        prefetch_result_ = result;
+        prefetch_status_ = s;
+        prefetch_done_ = true;
+        prefetch_cv_.SignalAll();
+    }
+    prefetch_exited_ = true;//这之后不能再碰reader
+    prefetch_cv_.SignalAll();
+    prefetch_mutex_.Unlock();
+}
+
+void VReader::StartPrefetch()
+{
+    MutexLock l(&prefetch_mutex_);
+    prefetch_done_ = false;
+    prefetch_requested_ = true;
+    prefetching_ = true;
+    if(!prefetch_started_)
+    {//整个扫描只用这一个线程
+        prefetch_started_ = true;
+        env_->StartThread(&VReader::PrefetchThread, this);
+    }
+    else
+    {
+        prefetch_cv_.SignalAll();
+    }
+}
+
+void VReader::WaitForPrefetch()
+{
+    if(!prefetching_)
+        return;
+    MutexLock l(&prefetch_mutex_);
+    while(!prefetch_done_)
+        prefetch_cv_.Wait();
+}
+
+bool VReader::NextBuffer()
+{
+    if(backing_store_ == NULL)
+    {
+        backing_store_ = new char[kVHeaderMaxSize + block_size_];
+        spare_store_ = new char[kVHeaderMaxSize + block_size_];
+    }
+    size_t left_head_size = buffer_.size();
+    assert(left_head_size <= kVHeaderMaxSize);
+    char* data = spare_store_ + kVHeaderMaxSize;
+    Slice fragment;
+    Status status;
+    if(prefetching_)
+    {//下一块已经在后台读了，等它读完
+        WaitForPrefetch();
+        prefetching_ = false;
+        fragment = prefetch_result_;
+        status = prefetch_status_;
+    }
+    else
+    {
+        status = file_->Read(block_size_, &fragment, data);
+    }
+    if(left_head_size > 0)//如果读缓冲还剩内容，拷贝到新数据前面
+        memcpy(data - left_head_size, buffer_.data(), left_head_size);
+    std::swap(backing_store_, spare_store_);
+    if (!status.ok())
+    {
+        buffer_.clear();
+        ReportDrop(block_size_, status);
+        eof_ = true;
+        return false;
+    }
+    buffer_ = Slice(data - left_head_size, left_head_size + fragment.size());
+    if(fragment.size() < block_size_)
+        eof_ = true;
+    else if(env_ != NULL)
+        StartPrefetch();//解析这一块的同时读下一块
+    return true;
+}
+
 bool VReader::ReadRecord(Slice* record, std::string* scratch, int& head_size)
 {//日志回放的时候是单线程
     scratch->clear();
     record->clear();
+    clean_end_ = false;
 
-    if(buffer_.size() < kVHeaderMaxSize)
+    if(buffer_.size() < kVHeaderMaxSize && !eof_)
     {//遇到buffer_剩的空间不够解析头部时
-        if(!eof_)
-        {
-            size_t left_head_size = buffer_.size();
-            if(left_head_size > 0)//如果读缓冲还剩内容，拷贝到读缓冲区头
-                memcpy(backing_store_, buffer_.data(), left_head_size);
-            buffer_.clear();
-            Status status = file_->Read(kBlockSize - left_head_size, &buffer_, backing_store_ + left_head_size);
-
-            if(left_head_size > 0)
-                buffer_.go_back(left_head_size);
-
-            if (!status.ok())
-            {
-                buffer_.clear();
-                ReportDrop(kBlockSize, status);
-                eof_ = true;
-                return false;
-            }
-            else if(buffer_.size() < kBlockSize)//因为前面回退了，所以这里是kblocksize
-            {
-                eof_ = true;
-                if(buffer_.size() < 4 + 1 + 1)//最少的一条记录也需要6个字节，一个字节的数据
-                   return false;
-            }
-        }
-        else
-        {
-            if(buffer_.size() < 4 + 1 + 1)
-            {
-                buffer_.clear();
-                return false;
-            }
-        }
+        if(!NextBuffer())
+            return false;
+    }
+    if(buffer_.size() < 4 + 1 + 1)
+    {//最少的一条记录也需要6个字节，一个字节的数据
+        //剩下的字节全是0才是干净的文件尾，否则是没写完的头部
+        clean_end_ = eof_ &&
+            buffer_.size() == static_cast<size_t>(std::count(
+                buffer_.data(), buffer_.data() + buffer_.size(), '\0'));
+        buffer_.clear();
+        return false;
     }
     //解析头部
     uint64_t length = 0;
-    uint32_t expected_crc = crc32c::Unmask(DecodeFixed32(buffer_.data()));//早一点解析出crc,因为后面可能buffer_.data内容会变
+    const uint32_t masked_crc = DecodeFixed32(buffer_.data());
+    uint32_t expected_crc = crc32c::Unmask(masked_crc);//早一点解析出crc,因为后面可能buffer_.data内容会变
     buffer_.remove_prefix(4);
     const char *varint64_begin = buffer_.data();
-    bool b = GetVarint64(&buffer_, &length);
-    assert(b);
+    if(!GetVarint64(&buffer_, &length))
+    {//文件尾的头部不完整
+        buffer_.clear();
+        return false;
+    }
+    if(length == 0 && masked_crc == 0)
+    {//空记录的crc掩码后不为0，头部全0的是预分配或者崩溃时没写到的清零部分，当作文件尾
+        clean_end_ = true;
+        buffer_.clear();
+        return false;
+    }
     head_size = 4 + (buffer_.data() - varint64_begin);
     if(length <= buffer_.size())
     {
@@ -118,70 +250,66 @@ bool VReader::ReadRecord(Slice* record, std::string* scratch, int& head_size)
         buffer_.remove_prefix(length);
         return true;
     }
-    else
+    if(eof_)
     {
-        if(eof_ == true)
-        {
-            return false;//日志最后一条记录不完整的情况，直接忽略
-        }
-        //逻辑记录不能在buffer中全部容纳，需要将读取结果写入到scratch
-        scratch->reserve(length);
-        size_t buffer_size = buffer_.size();
-        scratch->assign(buffer_.data(), buffer_size);
         buffer_.clear();
-        const uint64_t left_length = length - buffer_size;
-        if(left_length > kBlockSize/2)//如果剩余待读的记录超过block块的一半大小，则直接读到scratch中
-        {
+        return false;//日志最后一条记录不完整的情况，直接忽略
+    }
+    //逻辑记录不能在buffer中全部容纳，需要将读取结果写入到scratch
+    scratch->reserve(length);
+    scratch->assign(buffer_.data(), buffer_.size());
+    buffer_.clear();
+    uint64_t left_length = length - scratch->size();
+    while(left_length > 0)
+    {
+        if(env_ == NULL && left_length > block_size_/2)
+        {//不预读时，如果剩余待读的记录超过block块的一半大小，则直接读到scratch中
             Slice buffer;
+            size_t buffer_size = scratch->size();
             scratch->resize(length);
             Status status = file_->Read(left_length, &buffer, const_cast<char*>(scratch->data()) + buffer_size);
 
             if(!status.ok())
             {
                 ReportDrop(left_length, status);
+                scratch->clear();
                 return false;
             }
             if(buffer.size() < left_length)
             {
                 eof_ = true;
                 scratch->clear();
-
                 return false;
             }
+            break;
         }
-        else
-        {//否则读一整块到buffer中
-            Status status = file_->Read(kBlockSize, &buffer_, backing_store_);
-
-            if(!status.ok())
-            {
-                ReportDrop(kBlockSize, status);
-                return false;
-            }
-            else if(buffer_.size() < kBlockSize)
-            {
-                if(buffer_.size() < left_length)
-                {
-                    eof_ = true;
-                    scratch->clear();
-                    ReportCorruption(left_length, "last record not full");
-                    return false;////////////////////////////////
-                }
-                eof_ = true; //这个判断不要也可以，加的话算是优化，提早知道到头了，省的read一次才知道
-            }
-            scratch->append(buffer_.data(), left_length);
-            buffer_.remove_prefix(left_length);
+        //否则读一整块到buffer中，预读时大记录可能跨好几块
+        if(!NextBuffer())
+        {
+            scratch->clear();
+            return false;
         }
-        if (checksum_) {
-            uint32_t actual_crc = crc32c::Value(scratch->data(), length);
-            if (actual_crc != expected_crc) {
-               ReportCorruption(head_size + length, "checksum mismatch");
-                return false;
-            }
+        if(eof_ && buffer_.size() < left_length)
+        {
+            buffer_.clear();
+            scratch->clear();
+            ReportCorruption(left_length, "last record not full");
+            return false;
         }
-        *record = Slice(*scratch);
-        return true;
+        size_t n = std::min<uint64_t>(left_length, buffer_.size());
+        scratch->append(buffer_.data(), n);
+        buffer_.remove_prefix(n);
+        left_length -= n;
     }
+    if (checksum_) {
+        uint32_t actual_crc = crc32c::Value(scratch->data(), length);
+        if (actual_crc != expected_crc) {
+           ReportCorruption(head_size + length, "checksum mismatch");
+            return false;
+        }
+    }
+    *record = Slice(*scratch);
+    return true;
 }
 
 //get查询中根据索引从vlog文件中读value值
@@ -201,6 +329,23 @@ bool VReader::Read(char* val, size_t size, size_t pos)
     return true;
 }
 
+bool VReader::ReadUpTo(char* val, size_t size, size_t pos, size_t* n)
+{
+    MutexLock l(&mutex_);
+    if (!SkipToPos(pos)) {
+      return false;
+    }
+    Slice buffer;
+    Status status = file_->Read(size, &buffer, val);
+    if (!status.ok())
+    {
+        ReportDrop(size, status);
+        return false;
+    }
+    *n = buffer.size();
+    return true;
+}
+
 void VReader::ReportCorruption(uint64_t bytes, const char* reason) {
   ReportDrop(bytes, Status::Corruption(reason));
 }
@@ -13,6 +13,7 @@
 #include "port/port.h"
 namespace leveldb {
 
+class Env;
 class SequentialFile;
 
 namespace log {
@@ -35,19 +36,52 @@ class VReader {
   ~VReader();
 
   bool Read(char* val, size_t size, size_t pos);//从文件pos偏移读取size长的内容给val
+  //同Read，但读到文件尾时允许少于size，实际读到的字节数放在n里
+  bool ReadUpTo(char* val, size_t size, size_t pos, size_t* n);
   //读取一条完整的日志记录到record，record的内容可能在scratch，也可能在backing_store_中
   bool ReadRecord(Slice* record, std::string* scratch, int& head_size);
+  //ReadRecord返回false后调用：停在文件尾或者全0的头部(重用或预分配文件里没写到的部分)时返回true，
+  //crc不对、记录或头部不完整、读出错时返回false
+  bool StoppedCleanly() const { return clean_end_; }
   bool SkipToPos(size_t pos);//跳到文件指定偏移
   bool DeallocateDiskSpace(uint64_t offset, size_t len);//释放offset偏移处len长的磁盘空间
+  //顺序扫描整个vlog(gc、回放、dump)时在第一次ReadRecord之前调用，每次从磁盘读buffer_size字节，
+  //env不为NULL时用两块缓冲区轮换，解析当前缓冲区的同时由reader自己的预读线程读下一块
+  void EnableReadahead(Env* env, size_t buffer_size);
 
  private:
   port::Mutex mutex_;
   SequentialFile* const file_;//要读的文件
   Reporter* const reporter_;//用于报告错误的
   bool const checksum_;//是否进行数据校验
-  char* const backing_store_;//读缓冲区
+  size_t block_size_;//一次从磁盘读多少字节
+  Env* env_;//用来起预读线程，为NULL时不预读
+  //两块读缓冲区，第一次ReadRecord时才分配，只用Read的reader不占这部分内存。
+  //每块前面留kVHeaderMaxSize字节，放上一块剩下的不完整头部
+  char* backing_store_;//当前在解析的缓冲区
+  char* spare_store_;//预读线程在填的缓冲区
   Slice buffer_;//读缓冲区的封装，便于表示当前读缓冲区待读部分
   bool eof_;   // Last Read() indicated EOF by returning < kBlockSize//是否读到文件尾了
+  bool clean_end_;//上一次ReadRecord是不是干净地停在了文件尾
+
+  bool prefetching_;//发起了预读，结果还没取走，只有读线程访问
+  port::Mutex prefetch_mutex_;
+  port::CondVar prefetch_cv_;//读线程和预读线程都在上面等
+  bool prefetch_done_;//以下受prefetch_mutex_保护
+  Status prefetch_status_;
+  Slice prefetch_result_;
+  //预读线程第一次预读时启动，之后一直等下一次请求，析构时让它退出并等它退出
+  bool prefetch_started_;
+  bool prefetch_requested_;
+  bool prefetch_stop_;
+  bool prefetch_exited_;
+
+  //换到下一块缓冲区，buffer_里剩下的字节(不足一个头部)挪到新数据的前面
+  bool NextBuffer();
+  void StartPrefetch();
+  void WaitForPrefetch();
+  static void PrefetchThread(void* arg);
+  void PrefetchLoop();
   // Reports dropped bytes to the reporter.
   // buffer_ must be updated to remove the dropped bytes prior to invocation.
   void ReportCorruption(uint64_t bytes, const char* reason);
@@ -0,0 +1,457 @@
+#include "db/vlog_replayer.h"
+#include <algorithm>
+#include "db/log_format.h"
+#include "db/vlog_reader.h"
+#include "leveldb/env.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+static const size_t kChunkSize = 1 << 20;
+static const size_t kMaxQueuedChunks = 8;//每段最多攒这么多块等着插入memtable
+static const uint64_t kRangeSize = 4 << 20;//大vlog按这么多字节切成几段并行读
+static const uint64_t kNoLimit = ~static_cast<uint64_t>(0);
+static const size_t kSyncWindow = 64 << 10;//找段里第一条记录时每次读这么多字节
+static const uint64_t kBatchHeader = 12;//batch的头部长
+
+struct ReplayReporter : public log::VReader::Reporter {
+    Logger* info_log;
+    const char* fname;
+    Status* status;  // NULL if paranoid_checks==false
+    virtual void Corruption(size_t bytes, const Status& s) {
+        Log(info_log, "%s%s: dropping %d bytes; %s",
+            (this->status == NULL ? "(ignoring error) " : ""),
+            fname, static_cast<int>(bytes), s.ToString().c_str());
+        if (this->status != NULL && this->status->ok()) *this->status = s;
+    }
+};
+}  // namespace
+
+struct VlogReplayer::Fallback{
+    ReplayReporter reporter;
+    Status read_status;
+    log::VReader* reader;//第一次取的时候才打开
+    uint64_t pos;
+    Fallback() : reader(NULL), pos(0) { }
+    ~Fallback() { delete reader; }
+};
+
+VlogReplayer::VlogReplayer(Env* env, Logger* info_log, bool paranoid,
+                           size_t readahead_size, int threads)
+    : env_(env),
+      info_log_(info_log),
+      paranoid_(paranoid),
+      readahead_size_(readahead_size),
+      threads_(threads > 0 ? threads : 1),
+      cv_(&mutex_),
+      next_range_(0),
+      consuming_(0),
+      running_(0),
+      stop_(false)
+{
+}
+
+VlogReplayer::~VlogReplayer()
+{
+    MutexLock l(&mutex_);
+    stop_ = true;
+    cv_.SignalAll();
+    while(running_ > 0)
+        cv_.Wait();
+    for(size_t i = 0; i < ranges_.size(); i++)
+    {
+        for(size_t j = 0; j < ranges_[i].chunks.size(); j++)
+            delete ranges_[i].chunks[j];
+    }
+    for(size_t i = 0; i < logs_.size(); i++)
+        delete logs_[i].fallback;
+}
+
+void VlogReplayer::Start(const std::vector<std::string>& fnames, uint64_t first_pos)
+{
+    MutexLock l(&mutex_);
+    assert(logs_.empty());
+    fnames_ = fnames;
+    logs_.resize(fnames.size());
+    for(size_t i = 0; i < fnames.size(); i++)
+    {
+        uint64_t start = (i == 0 ? first_pos : 0);
+        uint64_t file_size = 0;
+        env_->GetFileSize(fnames[i], &file_size);//出错时整个vlog是一段，打开文件时再报错
+        logs_[i].begin = logs_[i].cur = ranges_.size();
+        Range range;
+        range.log = i;
+        range.synced = true;//vlog开头的位置是确定的
+        range.first = start;
+        while(start + kRangeSize < file_size)
+        {
+            range.start = start;
+            range.limit = start + kRangeSize;
+            ranges_.push_back(range);
+            range.synced = false;
+            start += kRangeSize;
+        }
+        range.start = start;
+        range.limit = kNoLimit;
+        ranges_.push_back(range);
+        logs_[i].end = ranges_.size();
+    }
+    const int n = std::min(static_cast<size_t>(threads_), ranges_.size());
+    env_->SetBackgroundThreads(n, Env::kRecovery);
+    for(int i = 0; i < n; i++)
+    {
+        running_++;
+        env_->Schedule(&VlogReplayer::BGWork, this, Env::kRecovery);
+    }
+}
+
+void VlogReplayer::BGWork(void* arg)
+{
+    reinterpret_cast<VlogReplayer*>(arg)->Work();
+}
+
+void VlogReplayer::Work()
+{
+    mutex_.Lock();
+    //按顺序领段，回放线程正在等的段一定已经有人在读，不会互相等死
+    while(!stop_)
+    {
+        while(next_range_ < ranges_.size() && ranges_[next_range_].cancelled)
+            next_range_++;
+        if(next_range_ == ranges_.size())
+            break;
+        if(next_range_ >= consuming_ + threads_)
+        {
+            cv_.Wait();
+            continue;
+        }
+        const size_t r = next_range_++;
+        mutex_.Unlock();
+        ReplayRange(r);
+        mutex_.Lock();
+    }
+    running_--;
+    cv_.SignalAll();
+    mutex_.Unlock();
+}
+
+void VlogReplayer::ReplayRange(size_t r)
+{
+    mutex_.Lock();
+    Range* range = &ranges_[r];
+    const std::string& fname = fnames_[range->log];
+    const uint64_t limit = range->limit;
+    bool synced = range->synced;
+    uint64_t pos = range->first;
+    const uint64_t start = range->start;
+    mutex_.Unlock();
+
+    bool empty = false;
+    if(!synced)
+    {
+        empty = !FindFirstRecord(fname, start, limit, &pos);
+        MutexLock l(&mutex_);
+        range->synced = true;
+        range->empty = empty;
+        range->first = pos;
+        cv_.SignalAll();
+    }
+
+    Status status;
+    bool stopped = false;
+    bool clean_end = false;
+    if(!empty)
+    {
+        SequentialFile* file;
+        status = env_->NewSequentialFile(fname, &file);
+        if(status.ok())
+        {
+            ReplayReporter reporter;
+            reporter.info_log = info_log_;
+            reporter.fname = fname.c_str();
+            Status read_status;
+            reporter.status = (paranoid_ ? &read_status : NULL);
+            log::VReader reader(file, &reporter, true/*checksum*/, 0);//reader析构时会delete掉file
+            reader.EnableReadahead(env_, readahead_size_);
+            if(pos > 0 && !reader.SkipToPos(pos))
+            {
+                status = Status::Corruption("reader skip false");
+            }
+            else
+            {
+                bool more = true;
+                while(more && pos < limit)
+                {
+                    Chunk* chunk = new Chunk;
+                    more = FillChunk(&reader, limit, &pos, chunk);
+                    if(chunk->records.empty())
+                        delete chunk;
+                    else if(!Push(r, chunk))
+                        return;
+                }
+                stopped = !more;
+                clean_end = stopped && reader.StoppedCleanly();
+                status = read_status;
+            }
+        }
+        if(!status.ok())
+            stopped = true;
+    }
+
+    MutexLock l(&mutex_);
+    range->done = true;
+    range->end = pos;
+    range->stopped = stopped;
+    range->clean_end = clean_end;
+    range->status = status;
+    cv_.SignalAll();
+}
+
+bool VlogReplayer::FindFirstRecord(const std::string& fname, uint64_t start,
+                                   uint64_t limit, uint64_t* first)
+{
+    uint64_t file_size = 0;
+    RandomAccessFile* file;
+    if(!env_->GetFileSize(fname, &file_size).ok() ||
+       !env_->NewRandomAccessFile(fname, &file).ok())
+        return false;
+    const uint64_t end = std::min(limit, file_size);
+    //窗口后面多读一个记录头和batch头，窗口末尾开始的记录也能检查
+    std::string window(kSyncWindow + log::kVHeaderMaxSize + kBatchHeader, '\0');
+    std::string scratch;
+    bool found = false;
+    for(uint64_t off = start; off < end && !found; off += kSyncWindow)
+    {
+        Slice data;
+        const size_t n = std::min<uint64_t>(window.size(), file_size - off);//mmap读不能超过文件尾
+        if(!file->Read(off, n, &data, &window[0]).ok())
+            break;
+        const char* limit_ptr = data.data() + data.size();
+        for(size_t i = 0; i < kSyncWindow && off + i < end && i + 4 < data.size(); i++)
+        {
+            const char* p = data.data() + i;
+            uint64_t length;
+            const char* q = GetVarint64Ptr(p + 4, limit_ptr, &length);
+            if(q == NULL)
+                continue;
+            const uint64_t head = q - p;
+            if(length < kBatchHeader || off + i + head + length > file_size ||
+               q + kBatchHeader > limit_ptr)
+                continue;
+            const uint32_t count = DecodeFixed32(q + 8);
+            if(count == 0 || count > length)
+                continue;
+            Slice contents;
+            if(q + length <= limit_ptr)
+            {
+                contents = Slice(q, length);
+            }
+            else
+            {//记录比窗口剩下的部分长，单独读一次
+                scratch.resize(length);
+                if(!file->Read(off + i + head, length, &contents, &scratch[0]).ok() ||
+                   contents.size() != length)
+                    continue;
+            }
+            if(crc32c::Unmask(DecodeFixed32(p)) !=
+               crc32c::Value(contents.data(), contents.size()))
+                continue;
+            *first = off + i;
+            found = true;
+            break;
+        }
+    }
+    delete file;
+    return found;
+}
+
+bool VlogReplayer::FillChunk(log::VReader* reader, uint64_t limit,
+                             uint64_t* pos, Chunk* chunk)
+{
+    std::string scratch;
+    Slice record;
+    int head_size = 0;
+    while(*pos < limit && chunk->data.size() < kChunkSize)
+    {
+        if(!reader->ReadRecord(&record, &scratch, head_size))
+            return false;
+        chunk->data.append(record.data(), record.size());
+        chunk->records.push_back(std::make_pair(chunk->data.size(), head_size));
+        *pos += head_size + record.size();
+    }
+    return true;
+}
+
+bool VlogReplayer::Push(size_t r, Chunk* chunk)
+{
+    MutexLock l(&mutex_);
+    Range& range = ranges_[r];
+    while(!stop_ && !range.cancelled && range.chunks.size() >= kMaxQueuedChunks)
+        cv_.Wait();
+    if(stop_ || range.cancelled)
+    {
+        delete chunk;
+        return false;
+    }
+    range.chunks.push_back(chunk);
+    cv_.SignalAll();
+    return true;
+}
+
+void VlogReplayer::CancelRanges(size_t i, size_t from)
+{
+    mutex_.AssertHeld();
+    for(size_t r = from; r < logs_[i].end; r++)
+    {
+        Range& range = ranges_[r];
+        range.cancelled = true;
+        for(size_t j = 0; j < range.chunks.size(); j++)
+            delete range.chunks[j];
+        range.chunks.clear();
+    }
+    //剩下的段不用读了，领段的线程可以去读下一个vlog
+    consuming_ = std::max(consuming_, logs_[i].end);
+    cv_.SignalAll();
+}
+
+void VlogReplayer::StartFallback(size_t i, uint64_t pos)
+{
+    mutex_.AssertHeld();
+    LogState& log = logs_[i];
+    CancelRanges(i, log.cur + 1);
+    log.fallback = new Fallback;
+    log.fallback->reporter.info_log = info_log_;
+    log.fallback->reporter.fname = fnames_[i].c_str();
+    log.fallback->reporter.status = (paranoid_ ? &log.fallback->read_status : NULL);
+    log.fallback->pos = pos;
+}
+
+VlogReplayer::Chunk* VlogReplayer::Next(size_t i)
+{
+    mutex_.Lock();
+    LogState& log = logs_[i];
+    Chunk* chunk = NULL;
+    while(!log.done && log.fallback == NULL)
+    {
+        Range& range = ranges_[log.cur];
+        if(!range.chunks.empty())
+        {
+            chunk = range.chunks.front();
+            range.chunks.pop_front();
+            cv_.SignalAll();
+            break;
+        }
+        if(!range.done)
+        {
+            cv_.Wait();
+            continue;
+        }
+        if(range.stopped)
+        {//vlog在这一段里结束了
+            log.done = true;
+            log.clean_end = range.clean_end;
+            log.status = range.status;
+            CancelRanges(i, log.cur + 1);
+            break;
+        }
+        //这一段读到了limit，后面第一条记录的开头要正好是这一段读到的结尾，
+        //中间没有记录开头的段由横跨它的记录盖住
+        size_t next = log.cur + 1;
+        bool wait = false;
+        for(; next < log.end; next++)
+        {
+            const Range& n = ranges_[next];
+            if(!n.synced)
+            {
+                wait = true;
+                break;
+            }
+            if(!n.empty || range.end < n.limit)
+                break;
+        }
+        if(wait)
+        {
+            if(next > consuming_)
+            {
+                consuming_ = next;
+                cv_.SignalAll();
+            }
+            cv_.Wait();
+            continue;
+        }
+        if(next < log.end && !ranges_[next].empty && ranges_[next].first == range.end)
+        {
+            log.cur = next;
+            consuming_ = std::max(consuming_, next);
+            cv_.SignalAll();
+            continue;
+        }
+        //接不上：开头那条记录crc对不上(比如打过洞)被跳过了，或者碰巧有数据的crc对得上，
+        //和不切段时一样从这里顺序读下去
+        Log(info_log_, "%s: range at %llu does not start where the previous one "
+            "ended at %llu, reading the rest in order", fnames_[i].c_str(),
+            static_cast<unsigned long long>(range.limit),
+            static_cast<unsigned long long>(range.end));
+        StartFallback(i, range.end);
+    }
+    const bool fallback = (chunk == NULL && !log.done && log.fallback != NULL);
+    mutex_.Unlock();
+    if(fallback)
+        chunk = NextFromFallback(i);
+    return chunk;
+}
+
+VlogReplayer::Chunk* VlogReplayer::NextFromFallback(size_t i)
+{//fallback只有回放线程访问，不用加锁
+    Fallback* f = logs_[i].fallback;
+    Status status;
+    if(f->reader == NULL)
+    {
+        SequentialFile* file;
+        status = env_->NewSequentialFile(fnames_[i], &file);
+        if(status.ok())
+        {
+            f->reader = new log::VReader(file, &f->reporter, true/*checksum*/, 0);
+            f->reader->EnableReadahead(env_, readahead_size_);
+            if(f->pos > 0 && !f->reader->SkipToPos(f->pos))
+                status = Status::Corruption("reader skip false");
+        }
+    }
+    Chunk* chunk = NULL;
+    bool more = false;
+    if(status.ok())
+    {
+        chunk = new Chunk;
+        more = FillChunk(f->reader, kNoLimit, &f->pos, chunk);
+        if(chunk->records.empty())
+        {
+            delete chunk;
+            chunk = NULL;
+        }
+    }
+    if(!more)
+    {
+        MutexLock l(&mutex_);
+        LogState& log = logs_[i];
+        log.done = true;
+        log.clean_end = status.ok() && f->reader->StoppedCleanly();
+        log.status = status.ok() ? f->read_status : status;
+        log.fallback = NULL;
+        delete f;
+    }
+    return chunk;
+}
+
+Status VlogReplayer::Finish(size_t i, bool* clean_end)
+{
+    MutexLock l(&mutex_);
+    assert(logs_[i].done);
+    if(clean_end != NULL)
+        *clean_end = logs_[i].clean_end;
+    return logs_[i].status;
+}
+
+}
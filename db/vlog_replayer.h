@@ -0,0 +1,124 @@
+#ifndef STORAGE_LEVELDB_DB_VLOG_REPLAYER_H_
+#define STORAGE_LEVELDB_DB_VLOG_REPLAYER_H_
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+#include "port/port.h"
+
+namespace leveldb {
+
+class Env;
+class Logger;
+
+namespace log {
+class VReader;
+}
+
+//打开数据库时回放重启点之后的vlog。每个vlog按kRangeSize切成几段，Env的kRecovery线程按顺序各领一段，
+//读出来并校验crc，切成一块一块放进该段的队列；打开数据库的线程按顺序取出来插入memtable。
+//每个队列有长度上限，领段的线程也不会跑到回放位置之后太远，内存不会随未刷盘的尾巴变大
+class VlogReplayer
+{
+    public:
+        //一块连续的vlog记录，records里是每条记录在data中的结束位置和记录头长度
+        struct Chunk{
+            std::string data;
+            std::vector<std::pair<size_t, int> > records;
+        };
+
+        //paranoid为true时vlog里的损坏会让对应vlog的Finish返回错误，否则只记日志
+        VlogReplayer(Env* env, Logger* info_log, bool paranoid,
+                     size_t readahead_size, int threads);
+        //还在读的线程会被叫停，等它们都退出后才返回
+        ~VlogReplayer();
+
+        //fnames按回放顺序排列，第一个vlog从first_pos开始读，其余从头读
+        void Start(const std::vector<std::string>& fnames, uint64_t first_pos);
+        //取第i个vlog的下一块，返回NULL表示该vlog读完了，调用者delete返回的chunk
+        Chunk* Next(size_t i);
+        //第i个vlog读完后调用，返回打开文件的错误或者paranoid时遇到的损坏；
+        //clean_end不为NULL时存读取是不是干净地停在了文件尾，见VReader::StoppedCleanly
+        Status Finish(size_t i, bool* clean_end = NULL);
+
+    private:
+        struct Fallback;
+
+        //vlog里的一段。除了vlog开头，一段从start之后第一条crc对得上的记录开始读，
+        //读到起点不小于limit的记录为止，横跨limit的记录归前一段
+        struct Range{
+            size_t log;
+            uint64_t start;
+            uint64_t limit;//vlog的最后一段是不设上限，一直读到停下
+            std::deque<Chunk*> chunks;
+            bool synced;//找过第一条记录了，empty和first有效
+            bool empty;//段里没有记录开头
+            uint64_t first;//第一条记录的位置
+            bool done;
+            uint64_t end;//读到的最后一条记录的结尾
+            bool stopped;//没读到limit记录就读不下去了，vlog到这里结束
+            bool clean_end;
+            bool cancelled;//回放线程不要这一段了
+            Status status;
+            Range() : log(0), start(0), limit(0), synced(false), empty(false), first(0),
+                      done(false), end(0), stopped(false), clean_end(false),
+                      cancelled(false) { }
+        };
+
+        struct LogState{
+            size_t begin;//该vlog的段在ranges_里的下标范围
+            size_t end;
+            size_t cur;//回放线程正在取的段
+            Fallback* fallback;//段接不上时回放线程自己从接不上的位置顺序读
+            bool done;
+            bool clean_end;
+            Status status;
+            LogState() : begin(0), end(0), cur(0), fallback(NULL), done(false),
+                         clean_end(false) { }
+        };
+
+        static void BGWork(void* arg);
+        void Work();
+        void ReplayRange(size_t r);
+        //从start开始找第一条起点小于limit、crc对得上的记录，找到返回true
+        bool FindFirstRecord(const std::string& fname, uint64_t start,
+                             uint64_t limit, uint64_t* first);
+        //从reader读记录追加到chunk，chunk满了或者读到起点不小于limit的记录时返回true，
+        //reader读不下去了返回false。*pos是下一条记录的位置
+        static bool FillChunk(log::VReader* reader, uint64_t limit,
+                              uint64_t* pos, Chunk* chunk);
+        //队列满时等着，叫停了或者这一段不要了返回false
+        bool Push(size_t r, Chunk* chunk);
+        //第i个vlog读完了，或者剩下的段接不上要顺序读时，扔掉剩下的段
+        void CancelRanges(size_t i, size_t from);
+        //从pos开始顺序读第i个vlog剩下的部分，REQUIRES: mutex_ held
+        void StartFallback(size_t i, uint64_t pos);
+        Chunk* NextFromFallback(size_t i);
+
+        Env* const env_;
+        Logger* const info_log_;
+        const bool paranoid_;
+        const size_t readahead_size_;
+        const int threads_;
+        std::vector<std::string> fnames_;
+
+        port::Mutex mutex_;
+        port::CondVar cv_;
+        std::vector<LogState> logs_;//以下受mutex_保护，两个vector在Start之后不再变大小
+        std::vector<Range> ranges_;
+        size_t next_range_;//下一个没人领的段
+        size_t consuming_;//回放线程正在取的段，领段的线程最多领到它之后threads_段
+        int running_;
+        bool stop_;
+
+        // No copying allowed
+        VlogReplayer(const VlogReplayer&);
+        void operator=(const VlogReplayer&);
+};
+
+}
+
+#endif
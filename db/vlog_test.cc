@@ -114,6 +114,19 @@ class VlogTest {
     }
   };
 
+  //数一数预读起了几个线程
+  class ThreadCountingEnv : public EnvWrapper {
+   public:
+    port::AtomicPointer threads_;
+    ThreadCountingEnv() : EnvWrapper(Env::Default()), threads_(NULL) { }
+    virtual void StartThread(void (*function)(void*), void* arg) {
+      threads_.Release_Store(reinterpret_cast<void*>(
+          reinterpret_cast<uintptr_t>(threads_.Acquire_Load()) + 1));
+      target()->StartThread(function, arg);
+    }
+  };
+
+  ThreadCountingEnv env_;
   StringDest* pd_;
   StringSource* ps_;
   StringDest& dest_;
@@ -178,6 +191,15 @@ class VlogTest {
     }
   }
 
+  //顺序扫描用小缓冲区预读，方便覆盖换缓冲区和跨多块的记录
+  void EnableReadahead(size_t buffer_size) {
+    reader_->EnableReadahead(&env_, buffer_size);
+  }
+
+  int ThreadsStarted() {
+    return static_cast<int>(reinterpret_cast<uintptr_t>(env_.threads_.Acquire_Load()));
+  }
+
   void IncrementByte(int offset, int delta) {
     dest_.contents_[offset] += delta;
   }
@@ -190,6 +212,10 @@ class VlogTest {
     dest_.contents_.resize(dest_.contents_.size() - bytes);
   }
 
+  void GrowWithZeros(int bytes) {
+    dest_.contents_.append(bytes, '\0');
+  }
+
   void ForceError() {
     source_.force_error_ = true;
   }
@@ -330,6 +356,59 @@ TEST(VlogTest, RandomRead) {
   ASSERT_EQ("EOF", Read());
 }
 
+TEST(VlogTest, ReadaheadRandomRead) {
+  EnableReadahead(1000);
+  const int N = 500;
+  Random write_rnd(301);
+  for (int i = 0; i < N; i++) {
+    Write(RandomSkewedString(i, &write_rnd));
+  }
+  Random read_rnd(301);
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(RandomSkewedString(i, &read_rnd), Read());
+  }
+  ASSERT_EQ("EOF", Read());
+}
+
+TEST(VlogTest, ReadaheadRecordsSpanBuffers) {
+  EnableReadahead(100);
+  Write("small");
+  Write(BigString("foo", 1000));//跨好几块缓冲区
+  Write("x");
+  Write(BigString("bar", 150));
+  ASSERT_EQ("small", Read());
+  ASSERT_EQ(BigString("foo", 1000), Read());
+  ASSERT_EQ("x", Read());
+  ASSERT_EQ(BigString("bar", 150), Read());
+  ASSERT_EQ("EOF", Read());
+}
+
+TEST(VlogTest, ReadaheadUsesOneThread) {
+  EnableReadahead(100);
+  const int N = 200;
+  for (int i = 0; i < N; i++) {
+    Write(BigString(NumberString(i), 50));
+  }
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQ(BigString(NumberString(i), 50), Read());
+  }
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ(1, ThreadsStarted());
+}
+
+TEST(VlogTest, ReadaheadPartialLastIsReported) {
+  EnableReadahead(100);
+  Write(BigString("bar", 1000));
+  ShrinkSize(1);
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ("OK", MatchError("last record not full"));
+}
+
+TEST(VlogTest, ReadaheadSkipToPos) {
+  EnableReadahead(4096);
+  CheckInitialOffsetRecord(kBlockSize, 1);
+}
+
 // Tests of all the error paths in log_reader.cc follow:
 
 TEST(VlogTest, ReadError) {
@@ -359,6 +438,18 @@ TEST(VlogTest, BadLengthAtEndIsIgnored) {
   ASSERT_EQ("", ReportMessage());
 }
 
+TEST(VlogTest, ZeroedTailIsEof) {
+  // Reused vlog files read back zeros past the last record
+  Write("foo");
+  Write("");
+  GrowWithZeros(100);
+  ASSERT_EQ("foo", Read());
+  ASSERT_EQ("", Read());
+  ASSERT_EQ("EOF", Read());
+  ASSERT_EQ(0, DroppedBytes());
+  ASSERT_EQ("", ReportMessage());
+}
+
 TEST(VlogTest, ChecksumMismatch) {
   Write("foo");
   IncrementByte(0, 1);
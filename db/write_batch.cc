@@ -8,7 +8,14 @@
 //    data: record[count]
 // record :=
 //    kTypeValue varstring varstring         |
-//    kTypeDeletion varstring
+//    kTypeDeletion varstring                |
+//    kTypeExpiringValue expire varstring varstring |
+//    kTypeValueRef varstring varstring
+// expire :=
+//    fixed64, seconds since the epoch
+// kTypeExpiringValue records live in TTL vlogs.  For each of them the
+// vlog that doubles as the write-ahead log gets a kTypeValueRef record
+// holding the key and the value pointer into the TTL vlog.
 // varstring :=
 //    len: varint32
 //    data: uint8[len]
@@ -18,6 +25,7 @@
 #include "leveldb/db.h"
 #include "db/dbformat.h"
 #include "db/memtable.h"
+#include "db/ptr_cache.h"
 #include "db/write_batch_internal.h"
 #include "util/coding.h"
 
@@ -69,6 +77,28 @@ Status WriteBatch::ParseRecord(uint64_t& pos, Slice& key, Slice& value, bool& is
         isDel = true;
         break;
           }
+      case kTypeExpiringValue:
+          {
+        if (input.size() < 8) {
+          return Status::Corruption("bad WriteBatch expiring Put");
+        }
+        input.remove_prefix(8);
+        if (!(GetLengthPrefixedSlice(&input, &key) &&
+            GetLengthPrefixedSlice(&input, &value))) {
+          return Status::Corruption("bad WriteBatch expiring Put");
+        }
+        isDel = false;
+        break;
+          }
+      case kTypeValueRef:
+          {//值在ttl vlog里，这条记录只用来回放，和删除一样没有要搬的值
+        if (!(GetLengthPrefixedSlice(&input, &key) &&
+            GetLengthPrefixedSlice(&input, &value))) {
+          return Status::Corruption("bad WriteBatch value ref");
+        }
+        isDel = true;
+        break;
+          }
       default:
         return Status::Corruption("unknown WriteBatch tag");
     }
@@ -105,6 +135,26 @@ Status WriteBatch::Iterate(Handler* handler) const {
           return Status::Corruption("bad WriteBatch Delete");
         }
         break;
+      case kTypeExpiringValue:
+        if (input.size() < 8) {
+          return Status::Corruption("bad WriteBatch expiring Put");
+        }
+        input.remove_prefix(8);
+        if (GetLengthPrefixedSlice(&input, &key) &&
+            GetLengthPrefixedSlice(&input, &value)) {
+          handler->Put(key, value);
+        } else {
+          return Status::Corruption("bad WriteBatch expiring Put");
+        }
+        break;
+      case kTypeValueRef:
+        if (GetLengthPrefixedSlice(&input, &key) &&
+            GetLengthPrefixedSlice(&input, &value)) {
+          handler->Put(key, value);
+        } else {
+          return Status::Corruption("bad WriteBatch value ref");
+        }
+        break;
       default:
         return Status::Corruption("unknown WriteBatch tag");
     }
@@ -141,9 +191,7 @@ Status WriteBatch::Iterate(Handler* handler, uint64_t& pos, uint64_t file_numb)
           last_pos = now_pos;
 
           std::string v;
-          PutVarint64(&v, len);
-          PutVarint32(&v, file_numb);
-          PutVarint64(&v, pos);
+          EncodeValuePtr(&v, len, file_numb, pos);
           handler->Put(key, v);
           pos = pos + len;//更新pos
         } else {
@@ -162,6 +210,37 @@ Status WriteBatch::Iterate(Handler* handler, uint64_t& pos, uint64_t file_numb)
           return Status::Corruption("bad WriteBatch Delete");
         }
         break;
+      case kTypeExpiringValue:
+        if (input.size() >= 8) {
+          const uint64_t expiration = DecodeFixed64(input.data());
+          input.remove_prefix(8);
+          if (GetLengthPrefixedSlice(&input, &key) &&
+              GetLengthPrefixedSlice(&input, &value)) {
+            const char* now_pos = input.data();
+            size_t len = now_pos - last_pos;
+            last_pos = now_pos;
+
+            std::string v;
+            EncodeValuePtr(&v, len, file_numb, pos);
+            PutVarint64(&v, expiration);
+            handler->Put(key, v);
+            pos = pos + len;
+            break;
+          }
+        }
+        return Status::Corruption("bad WriteBatch expiring Put");
+      case kTypeValueRef:
+        if (GetLengthPrefixedSlice(&input, &key) &&
+            GetLengthPrefixedSlice(&input, &value)) {
+          const char* now_pos = input.data();
+          pos = pos + (now_pos - last_pos);//指针指向ttl vlog，原样插入
+          last_pos = now_pos;
+
+          handler->Put(key, value);
+        } else {
+          return Status::Corruption("bad WriteBatch value ref");
+        }
+        break;
       default:
         return Status::Corruption("unknown WriteBatch tag");
     }
@@ -196,6 +275,23 @@ void WriteBatch::Put(const Slice& key, const Slice& value) {
   PutLengthPrefixedSlice(&rep_, value);
 }
 
+void WriteBatchInternal::PutExpiring(WriteBatch* b, const Slice& key,
+                                     const Slice& value, uint64_t expiration) {
+  SetCount(b, Count(b) + 1);
+  b->rep_.push_back(static_cast<char>(kTypeExpiringValue));
+  PutFixed64(&b->rep_, expiration);
+  PutLengthPrefixedSlice(&b->rep_, key);
+  PutLengthPrefixedSlice(&b->rep_, value);
+}
+
+void WriteBatchInternal::PutRef(WriteBatch* b, const Slice& key,
+                                const Slice& ptr) {
+  SetCount(b, Count(b) + 1);
+  b->rep_.push_back(static_cast<char>(kTypeValueRef));
+  PutLengthPrefixedSlice(&b->rep_, key);
+  PutLengthPrefixedSlice(&b->rep_, ptr);
+}
+
 void WriteBatch::Delete(const Slice& key) {
   WriteBatchInternal::SetCount(this, WriteBatchInternal::Count(this) + 1);
   rep_.push_back(static_cast<char>(kTypeDeletion));
@@ -207,12 +303,17 @@ class MemTableInserter : public WriteBatch::Handler {
  public:
   SequenceNumber sequence_;
   MemTable* mem_;
+  PtrCache* ptr_cache_;
+  MemTableInserter() : ptr_cache_(NULL) { }
   virtual void Put(const Slice& key, const Slice& value) {
     mem_->Add(sequence_, kTypeValue, key, value);
+    //只让缓存失效，不放新指针：sequence还没发布，放进去的话batch里的key会一个个先被读到
+    if (ptr_cache_ != NULL) ptr_cache_->Invalidate(key, sequence_);
     sequence_++;
   }
   virtual void Delete(const Slice& key) {
     mem_->Add(sequence_, kTypeDeletion, key, Slice());
+    if (ptr_cache_ != NULL) ptr_cache_->Invalidate(key, sequence_);
     sequence_++;
   }
 };
@@ -226,10 +327,12 @@ Status WriteBatchInternal::InsertInto(const WriteBatch* b,
   return b->Iterate(&inserter);
 }
 Status WriteBatchInternal::InsertInto(const WriteBatch* b,
-                                      MemTable* memtable, uint64_t& pos, uint64_t file_numb) {
+                                      MemTable* memtable, uint64_t& pos, uint64_t file_numb,
+                                      PtrCache* ptr_cache) {
   MemTableInserter inserter;
   inserter.sequence_ = WriteBatchInternal::Sequence(b);
   inserter.mem_ = memtable;
+  inserter.ptr_cache_ = ptr_cache;
   return b->Iterate(&inserter, pos, file_numb);
 }
 
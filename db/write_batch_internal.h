@@ -11,6 +11,7 @@
 namespace leveldb {
 
 class MemTable;
+class PtrCache;
 
 // WriteBatchInternal provides static methods for manipulating a
 // WriteBatch that we don't want in the public WriteBatch interface.
@@ -40,10 +41,16 @@ class WriteBatchInternal {
   static void SetContents(WriteBatch* batch, const Slice& contents);
 
   static Status InsertInto(const WriteBatch* batch, MemTable* memtable);
-  static Status InsertInto(const WriteBatch* batch, MemTable* memtable, uint64_t& pos, uint64_t file_numb);
+  //ptr_cache不为NULL时让batch里写到的key在缓存里失效
+  static Status InsertInto(const WriteBatch* batch, MemTable* memtable, uint64_t& pos, uint64_t file_numb,
+                           PtrCache* ptr_cache);
   //从batch的pos位置解析出一条kv对，并把pos更新为下一条记录在batch中偏移，isdel代表这条kv记录是不是删除操作
   static Status ParseRecord(const WriteBatch* batch, uint64_t& pos, Slice& key, Slice& value, bool& isDel);
   static void Append(WriteBatch* dst, const WriteBatch* src);
+  //ttl写入：值连同过期时间写到ttl vlog，用户vlog里只记key和指向ttl vlog的指针
+  static void PutExpiring(WriteBatch* batch, const Slice& key,
+                          const Slice& value, uint64_t expiration);
+  static void PutRef(WriteBatch* batch, const Slice& key, const Slice& ptr);
 };
 
 }  // namespace leveldb
@@ -86,6 +86,19 @@ class Env {
   virtual Status NewAppendableFile(const std::string& fname,
                                    WritableFile** result);
 
+  // Give the existing file "old_fname" the name "fname" and open it for
+  // writing from offset 0, as NewWritableFile() would.  The file starts
+  // out empty, but implementations may keep the disk space already
+  // allocated to it.  The old contents are never visible under "fname",
+  // even after a crash.  On success,
+  // stores a pointer to the new file in *result and returns OK.  On
+  // failure stores NULL in *result and returns non-OK.
+  //
+  // The returned file will only be accessed by one thread at a time.
+  virtual Status ReuseWritableFile(const std::string& old_fname,
+                                   const std::string& fname,
+                                   WritableFile** result);
+
   // Returns true iff the named file exists.
   virtual bool FileExists(const std::string& fname) = 0;
 
@@ -111,6 +124,12 @@ class Env {
   virtual Status RenameFile(const std::string& src,
                             const std::string& target) = 0;
 
+  // Make the files created, renamed or deleted in directory "dirname"
+  // so far survive a crash.
+  //
+  // The default implementation does nothing.
+  virtual Status SyncDir(const std::string& dirname);
+
   // Lock the specified file.  Used to prevent concurrent access to
   // the same db by multiple processes.  On failure, stores NULL in
   // *lock and returns non-OK.
@@ -142,6 +161,32 @@ class Env {
       void (*function)(void* arg),
       void* arg) = 0;
 
+  // Kinds of background work, most urgent first.  Each priority has its
+  // own queue and threads, so a memtable flush never waits behind a long
+  // compaction and GC never holds up either.
+  enum Priority {
+    kFlush = 0,
+    kL0Compaction,
+    kCompaction,
+    kGarbageCollection,
+    kRecovery,  // Reading logs in parallel while a DB is being opened
+    kNumPriorities
+  };
+
+  // Arrange to run "(*function)(arg)" once in a background thread that
+  // serves priority "pri".
+  //
+  // The default implementation runs kGarbageCollection work on a thread
+  // of its own, since it may wait for flushes and compactions, and hands
+  // everything else to Schedule(function, arg).
+  virtual void Schedule(void (*function)(void* arg), void* arg,
+                        Priority pri);
+
+  // Use "number" threads for work scheduled at priority "pri".  The pool
+  // only ever grows.  Pools belong to the Env, so every DB opened with the
+  // same Env shares them.  The default implementation does nothing.
+  virtual void SetBackgroundThreads(int number, Priority pri);
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
@@ -245,6 +290,21 @@ class WritableFile {
   virtual Status Flush() = 0;
   virtual Status Sync() = 0;
 
+  // Reserve disk space for the byte range [offset, offset+len) without
+  // changing the file size, so that later appends into the range do not
+  // have to allocate.  Reserved space that was never written is released
+  // when the file is closed.
+  //
+  // The default implementation returns NotSupported; callers must treat
+  // preallocation as a hint only.
+  virtual Status Preallocate(uint64_t offset, uint64_t len);
+
+  // Cut the file down to "size" bytes.  Later appends continue at the
+  // new end of the file.
+  //
+  // The default implementation returns NotSupported.
+  virtual Status Truncate(uint64_t size);
+
  private:
   // No copying allowed
   WritableFile(const WritableFile&);
@@ -318,6 +378,10 @@ class EnvWrapper : public Env {
   Status NewAppendableFile(const std::string& f, WritableFile** r) {
     return target_->NewAppendableFile(f, r);
   }
+  Status ReuseWritableFile(const std::string& o, const std::string& f,
+                           WritableFile** r) {
+    return target_->ReuseWritableFile(o, f, r);
+  }
   bool FileExists(const std::string& f) { return target_->FileExists(f); }
   Status GetChildren(const std::string& dir, std::vector<std::string>* r) {
     return target_->GetChildren(dir, r);
@@ -331,6 +395,7 @@ class EnvWrapper : public Env {
   Status RenameFile(const std::string& s, const std::string& t) {
     return target_->RenameFile(s, t);
   }
+  Status SyncDir(const std::string& d) { return target_->SyncDir(d); }
   Status LockFile(const std::string& f, FileLock** l) {
     return target_->LockFile(f, l);
   }
@@ -338,6 +403,12 @@ class EnvWrapper : public Env {
   void Schedule(void (*f)(void*), void* a) {
     return target_->Schedule(f, a);
   }
+  void Schedule(void (*f)(void*), void* a, Priority pri) {
+    return target_->Schedule(f, a, pri);
+  }
+  void SetBackgroundThreads(int number, Priority pri) {
+    return target_->SetBackgroundThreads(number, pri);
+  }
   void StartThread(void (*f)(void*), void* a) {
     return target_->StartThread(f, a);
   }
@@ -7,6 +7,8 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 namespace leveldb {
 
@@ -158,6 +160,35 @@ struct Options {
   uint64_t min_clean_threshold;
   uint64_t log_dropCount_threshold;
   uint64_t max_vlog_size;
+  bool compaction_relocate;
+  uint64_t punch_hole_threshold;
+  uint64_t clean_checkpoint_size;
+  uint64_t vlog_readahead_size;
+  bool vlog_forwarding;
+
+  // If positive, keep the latest value pointer of every live key in an
+  // in-memory index split into this many partitions, so that GC checks
+  // validity without LSM lookups.  Memory grows with the number of keys,
+  // and DB::Open rebuilds the index with a full scan of the LSM tree.
+  //
+  // Default: 0
+  int key_index_partitions;
+
+  size_t scan_readahead_size;
+  int scan_rewrite_samples;
+  int garbage_sample_records;
+  uint64_t ttl_vlog_window;
+  std::vector<std::string> vlog_cold_paths;
+  uint64_t vlog_cold_read_threshold;
+  uint64_t vlog_preallocate_size;
+  int recycle_vlog_num;
+  int vlog_replay_threads;
+  uint64_t max_recovery_bytes;
+  int max_open_vlogs;
+  size_t ptr_cache_size;
+  int background_flush_threads;
+  int background_compaction_threads;
+  int background_gc_threads;
   // Create an Options object with default values for all fields.
   Options();
 };
@@ -208,8 +239,17 @@ struct WriteOptions {
   // Default: false
   bool sync;
 
+  // If non-zero, the values put by this write expire "ttl" seconds from
+  // now.  Expired values are hidden from Get() and iterators, and the
+  // TTL vlogs holding them are deleted as a whole once everything in
+  // them has expired.
+  //
+  // Default: 0 (never expire)
+  uint64_t ttl;
+
   WriteOptions()
-      : sync(false) {
+      : sync(false),
+        ttl(0) {
   }
 };
 
@@ -97,6 +97,11 @@ class AtomicPointer {
 
   // Set va as the stored pointer with no ordering guarantees.
   void NoBarrier_Store(void* v);
+
+  // If the stored pointer equals expected, replace it with v and return
+  // true; otherwise leave it alone and return false.  Acts as a full
+  // memory barrier.
+  bool CompareAndSwap(void* expected, void* v);
 };
 
 // ------------------ Compression -------------------
@@ -13,6 +13,42 @@ Status Env::NewAppendableFile(const std::string& fname, WritableFile** result) {
   return Status::NotSupported("NewAppendableFile", fname);
 }
 
+Status Env::ReuseWritableFile(const std::string& old_fname,
+                              const std::string& fname,
+                              WritableFile** result) {
+  *result = NULL;
+  // Empty the file before it takes the new name, so that its old
+  // contents never show up under "fname".
+  WritableFile* old_file;
+  Status s = NewWritableFile(old_fname, &old_file);
+  if (s.ok()) {
+    s = old_file->Close();
+    delete old_file;
+  }
+  if (s.ok()) {
+    s = RenameFile(old_fname, fname);
+  }
+  if (s.ok()) {
+    s = NewWritableFile(fname, result);
+  }
+  return s;
+}
+
+Status Env::SyncDir(const std::string& dirname) {
+  return Status::OK();
+}
+
+void Env::Schedule(void (*function)(void*), void* arg, Priority pri) {
+  if (pri == kGarbageCollection) {
+    StartThread(function, arg);
+  } else {
+    Schedule(function, arg);
+  }
+}
+
+void Env::SetBackgroundThreads(int number, Priority pri) {
+}
+
 SequentialFile::~SequentialFile() {
 }
 
@@ -22,6 +58,14 @@ RandomAccessFile::~RandomAccessFile() {
 WritableFile::~WritableFile() {
 }
 
+Status WritableFile::Preallocate(uint64_t offset, uint64_t len) {
+  return Status::NotSupported("Preallocate");
+}
+
+Status WritableFile::Truncate(uint64_t size) {
+  return Status::NotSupported("Truncate");
+}
+
 Logger::~Logger() {
 }
 
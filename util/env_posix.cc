@@ -42,6 +42,20 @@ static Status PosixError(const std::string& context, int err_number) {
   }
 }
 
+static Status SyncDirectory(const std::string& dir) {
+  Status s;
+  int fd = open(dir.c_str(), O_RDONLY);
+  if (fd < 0) {
+    s = PosixError(dir, errno);
+  } else {
+    if (fsync(fd) < 0) {
+      s = PosixError(dir, errno);
+    }
+    close(fd);
+  }
+  return s;
+}
+
 // Helper class to limit resource usage to avoid exhaustion.
 // Currently used to limit read-only file descriptors and mmap file usage
 // so that we do not end up running out of file descriptors, virtual memory,
@@ -133,9 +147,13 @@ class PosixSequentialFile: public SequentialFile {
   }
   virtual Status DeallocateDiskSpace(uint64_t offset, size_t len)
   {//释放指定磁盘空间
+#if defined(OS_LINUX)
       if(fallocate(fileno(file_),FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, offset, len)<0)
           return PosixError(filename_, errno);
       return Status::OK();
+#else
+      return SequentialFile::DeallocateDiskSpace(offset, len);
+#endif
   }
 };
 
@@ -228,14 +246,33 @@ class PosixWritableFile : public WritableFile {
  private:
   std::string filename_;
   FILE* file_;
+  bool preallocated_;//文件尾之后有KEEP_SIZE预分配的空间，重用的旧文件也是
+
+  //关闭时把写到的位置之后预分配的空间还回去。
+  //KEEP_SIZE预分配不改变文件大小，文件大小就是写到的位置
+  Status ReleaseUnusedSpace() {
+    if (fflush_unlocked(file_) != 0) {
+      return PosixError(filename_, errno);
+    }
+    struct stat sbuf;
+    if (fstat(fileno(file_), &sbuf) != 0 ||
+        ftruncate(fileno(file_), sbuf.st_size) != 0) {
+      return PosixError(filename_, errno);
+    }
+    return Status::OK();
+  }
 
  public:
-  PosixWritableFile(const std::string& fname, FILE* f)
-      : filename_(fname), file_(f) { }
+  PosixWritableFile(const std::string& fname, FILE* f,
+                    bool preallocated = false)
+      : filename_(fname), file_(f), preallocated_(preallocated) { }
 
   ~PosixWritableFile() {
     if (file_ != NULL) {
       // Ignoring any potential errors
+      if (preallocated_) {
+        ReleaseUnusedSpace();
+      }
       fclose(file_);
     }
   }
@@ -250,7 +287,10 @@ class PosixWritableFile : public WritableFile {
 
   virtual Status Close() {
     Status result;
-    if (fclose(file_) != 0) {
+    if (preallocated_) {
+      result = ReleaseUnusedSpace();
+    }
+    if (fclose(file_) != 0 && result.ok()) {
       result = PosixError(filename_, errno);
     }
     file_ = NULL;
@@ -278,15 +318,7 @@ class PosixWritableFile : public WritableFile {
     }
     Status s;
     if (basename.starts_with("MANIFEST")) {
-      int fd = open(dir.c_str(), O_RDONLY);
-      if (fd < 0) {
-        s = PosixError(dir, errno);
-      } else {
-        if (fsync(fd) < 0) {
-          s = PosixError(dir, errno);
-        }
-        close(fd);
-      }
+      s = SyncDirectory(dir);
     }
     return s;
   }
@@ -303,6 +335,28 @@ class PosixWritableFile : public WritableFile {
     }
     return s;
   }
+
+  virtual Status Preallocate(uint64_t offset, uint64_t len) {
+#if defined(OS_LINUX)
+    if (fallocate(fileno(file_), FALLOC_FL_KEEP_SIZE, offset, len) < 0) {
+      return PosixError(filename_, errno);
+    }
+    preallocated_ = true;
+    return Status::OK();
+#else
+    return WritableFile::Preallocate(offset, len);
+#endif
+  }
+
+  virtual Status Truncate(uint64_t size) {
+    //"a"方式打开的文件写入总在文件末尾，fseek只对重用文件起作用
+    if (fflush_unlocked(file_) != 0 ||
+        ftruncate(fileno(file_), size) != 0 ||
+        fseek(file_, size, SEEK_SET) != 0) {
+      return PosixError(filename_, errno);
+    }
+    return Status::OK();
+  }
 };
 
 static int LockOrUnlock(int fd, bool lock) {
@@ -416,6 +470,44 @@ class PosixEnv : public Env {
     return s;
   }
 
+  virtual Status ReuseWritableFile(const std::string& old_fname,
+                                   const std::string& fname,
+                                   WritableFile** result) {
+    *result = NULL;
+    FILE* f = fopen(old_fname.c_str(), "r+");
+    if (f == NULL) {
+      return PosixError(old_fname, errno);
+    }
+    //旧内容先截掉并落盘再改名，崩溃后新文件名下不会出现旧记录，文件大小始终是写到的位置。
+    //原来的长度再用KEEP_SIZE预分配回来，不支持时就是一个普通的空文件
+    const int fd = fileno(f);
+    struct stat sbuf;
+    bool preallocated = false;
+    int r = fstat(fd, &sbuf);
+    if (r == 0 && sbuf.st_size > 0) {
+      r = ftruncate(fd, 0);
+#if defined(OS_LINUX)
+      if (r == 0) {
+        preallocated =
+            (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, sbuf.st_size) == 0);
+      }
+#endif
+    }
+    if (r == 0) {
+      r = fdatasync(fd);
+    }
+    if (r == 0) {
+      r = rename(old_fname.c_str(), fname.c_str());
+    }
+    if (r != 0) {
+      Status s = PosixError(fname, errno);
+      fclose(f);
+      return s;
+    }
+    *result = new PosixWritableFile(fname, f, preallocated);
+    return Status::OK();
+  }
+
   virtual bool FileExists(const std::string& fname) {
     return access(fname.c_str(), F_OK) == 0;
   }
@@ -479,6 +571,10 @@ class PosixEnv : public Env {
     return result;
   }
 
+  virtual Status SyncDir(const std::string& dirname) {
+    return SyncDirectory(dirname);
+  }
+
   virtual Status LockFile(const std::string& fname, FileLock** lock) {
     *lock = NULL;
     Status result;
@@ -515,6 +611,10 @@ class PosixEnv : public Env {
 
   virtual void Schedule(void (*function)(void*), void* arg);
 
+  virtual void Schedule(void (*function)(void*), void* arg, Priority pri);
+
+  virtual void SetBackgroundThreads(int number, Priority pri);
+
   virtual void StartThread(void (*function)(void* arg), void* arg);
 
   virtual Status GetTestDirectory(std::string* result) {
@@ -567,22 +667,35 @@ class PosixEnv : public Env {
     }
   }
 
-  // BGThread() is the body of the background thread
-  void BGThread();
+  // BGThread() is the body of the background threads serving "pri"
+  void BGThread(Priority pri);
+  struct BGThreadArg { PosixEnv* env; Priority pri; };
   static void* BGThreadWrapper(void* arg) {
-    reinterpret_cast<PosixEnv*>(arg)->BGThread();
+    BGThreadArg* a = reinterpret_cast<BGThreadArg*>(arg);
+    PosixEnv* env = a->env;
+    Priority pri = a->pri;
+    delete a;
+    env->BGThread(pri);
     return NULL;
   }
+  // Start threads for "pri" until it has as many as configured.
+  // REQUIRES: mu_ held.
+  void StartBGThreads(Priority pri);
 
   pthread_mutex_t mu_;
-  pthread_cond_t bgsignal_;
-  pthread_t bgthread_;
-  bool started_bgthread_;
 
   // Entry per Schedule() call
   struct BGItem { void* arg; void (*function)(void*); };
   typedef std::deque<BGItem> BGQueue;
-  BGQueue queue_;
+
+  // Queue and threads of one priority, protected by mu_
+  struct BGPool {
+    pthread_cond_t bgsignal;
+    BGQueue queue;
+    int max_threads;
+    int started_threads;
+  };
+  BGPool pools_[kNumPriorities];
 
   PosixLockTable locks_;
   Limiter mmap_limit_;
@@ -618,49 +731,77 @@ static intptr_t MaxOpenFiles() {
 }
 
 PosixEnv::PosixEnv()
-    : started_bgthread_(false),
-      mmap_limit_(MaxMmaps()),
+    : mmap_limit_(MaxMmaps()),
       fd_limit_(MaxOpenFiles()) {
   PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
-  PthreadCall("cvar_init", pthread_cond_init(&bgsignal_, NULL));
+  for (int i = 0; i < kNumPriorities; i++) {
+    PthreadCall("cvar_init", pthread_cond_init(&pools_[i].bgsignal, NULL));
+    pools_[i].max_threads = 1;
+    pools_[i].started_threads = 0;
+  }
 }
 
 void PosixEnv::Schedule(void (*function)(void*), void* arg) {
+  Schedule(function, arg, kCompaction);
+}
+
+void PosixEnv::Schedule(void (*function)(void*), void* arg, Priority pri) {
+  assert(pri >= 0 && pri < kNumPriorities);
   PthreadCall("lock", pthread_mutex_lock(&mu_));
+  BGPool* pool = &pools_[pri];
 
-  // Start background thread if necessary
-  if (!started_bgthread_) {
-    started_bgthread_ = true;
-    PthreadCall(
-        "create thread",
-        pthread_create(&bgthread_, NULL,  &PosixEnv::BGThreadWrapper, this));
-  }
+  // Start background threads if necessary
+  StartBGThreads(pri);
 
-  // If the queue is currently empty, the background thread may currently be
-  // waiting.
-  if (queue_.empty()) {
-    PthreadCall("signal", pthread_cond_signal(&bgsignal_));
-  }
+  // Add to the queue of this priority and wake one of its threads
+  pool->queue.push_back(BGItem());
+  pool->queue.back().function = function;
+  pool->queue.back().arg = arg;
+  PthreadCall("signal", pthread_cond_signal(&pool->bgsignal));
 
-  // Add to priority queue
-  queue_.push_back(BGItem());
-  queue_.back().function = function;
-  queue_.back().arg = arg;
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
 
+void PosixEnv::SetBackgroundThreads(int number, Priority pri) {
+  assert(pri >= 0 && pri < kNumPriorities);
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  BGPool* pool = &pools_[pri];
+  if (number > pool->max_threads) {
+    pool->max_threads = number;
+    // Only start them now if the first Schedule() already did
+    if (pool->started_threads > 0) {
+      StartBGThreads(pri);
+    }
+  }
   PthreadCall("unlock", pthread_mutex_unlock(&mu_));
 }
 
-void PosixEnv::BGThread() {
+void PosixEnv::StartBGThreads(Priority pri) {
+  BGPool* pool = &pools_[pri];
+  while (pool->started_threads < pool->max_threads) {
+    BGThreadArg* arg = new BGThreadArg;
+    arg->env = this;
+    arg->pri = pri;
+    pthread_t t;
+    PthreadCall(
+        "create thread",
+        pthread_create(&t, NULL,  &PosixEnv::BGThreadWrapper, arg));
+    pool->started_threads++;
+  }
+}
+
+void PosixEnv::BGThread(Priority pri) {
+  BGPool* pool = &pools_[pri];
   while (true) {
     // Wait until there is an item that is ready to run
     PthreadCall("lock", pthread_mutex_lock(&mu_));
-    while (queue_.empty()) {
-      PthreadCall("wait", pthread_cond_wait(&bgsignal_, &mu_));
+    while (pool->queue.empty()) {
+      PthreadCall("wait", pthread_cond_wait(&pool->bgsignal, &mu_));
     }
 
-    void (*function)(void*) = queue_.front().function;
-    void* arg = queue_.front().arg;
-    queue_.pop_front();
+    void (*function)(void*) = pool->queue.front().function;
+    void* arg = pool->queue.front().arg;
+    pool->queue.pop_front();
 
     PthreadCall("unlock", pthread_mutex_unlock(&mu_));
     (*function)(arg);
@@ -66,6 +66,35 @@ TEST(EnvTest, RunMany) {
   ASSERT_EQ(4, reinterpret_cast<uintptr_t>(cur));
 }
 
+TEST(EnvTest, SchedulePriorities) {
+  port::AtomicPointer flushed(NULL);
+  port::AtomicPointer saw_flush(NULL);
+
+  struct CB {
+    port::AtomicPointer* flushed;
+    port::AtomicPointer* saw_flush;
+    Env* env;
+
+    // Occupies the compaction thread until the flush has run, which only
+    // happens if flushes do not queue behind it.
+    static void Compact(void* v) {
+      CB* cb = reinterpret_cast<CB*>(v);
+      for (int i = 0; i < 100 && cb->flushed->Acquire_Load() == NULL; i++) {
+        cb->env->SleepForMicroseconds(kDelayMicros / 10);
+      }
+      cb->saw_flush->Release_Store(cb->flushed->Acquire_Load());
+    }
+  };
+
+  CB cb = { &flushed, &saw_flush, env_ };
+  env_->Schedule(&CB::Compact, &cb, Env::kCompaction);
+  env_->Schedule(&SetBool, &flushed, Env::kFlush);
+  for (int i = 0; i < 200 && saw_flush.Acquire_Load() == NULL; i++) {
+    env_->SleepForMicroseconds(kDelayMicros / 10);
+  }
+  ASSERT_TRUE(saw_flush.Acquire_Load() != NULL);
+}
+
 struct State {
   port::Mutex mu;
   int val;
@@ -31,7 +31,31 @@ Options::Options()
      // clean_threshold(1*124 * 1024),
       min_clean_threshold(clean_threshold/5),//log进行手动清理时，只有文件垃圾记录条数达到min_clean_threshold才会清理
       log_dropCount_threshold(100),//合并后新产生log_dropCount_threshold条垃圾记录时记录各个log文件的信息
-      max_vlog_size(1024*1024*1024){//log文件大小上限值
+      max_vlog_size(1024*1024*1024),//vlog文件大小上限值，写到这么大就换新vlog，和memtable切换无关
+      compaction_relocate(false),//最底层合并时把垃圾数达到min_clean_threshold的vlog里的有效kv搬到cold vlog
+      punch_hole_threshold(0),//vlog里新失效的字节数达到该值时对失效区间打洞释放磁盘空间，0代表不打洞
+      clean_checkpoint_size(64<<20),//gc每扫描这么多字节就把搬迁后的指针刷到sst并记录回收位置，0代表只在结束时刷
+      vlog_readahead_size(4<<20),//gc和回放顺序扫描vlog时一次读这么多字节，并在后台预读下一块
+      vlog_forwarding(false),//gc搬迁的值只记在被回收vlog的转发表里，不改lsm中的指针
+      key_index_partitions(0),//大于0时在内存里按hash分区记录每个key最新的指针，gc查它判断有效性，不查lsm
+      scan_readahead_size(256<<10),//迭代器发现相邻的值在vlog里也相邻时，一次读这么多字节，0表示不合并
+      scan_rewrite_samples(0),//大于0时，一个sst文件被扫描采样到这么多次，就把它的key范围按key顺序重写到新的vlog
+      garbage_sample_records(0),//大于0时，打开数据库后从每个vlog随机抽这么多条记录估计垃圾数，比持久化的垃圾数多时用估计值
+      ttl_vlog_window(3600),//ttl写入按过期时间每这么多秒分到一个ttl vlog，窗口结束后整个vlog删掉
+      vlog_cold_paths(),//冷存储目录，比如大容量的sata ssd或者机械盘，每个数据库要用自己的目录
+      vlog_cold_read_threshold(64),//配置了冷存储目录时，每换一次vlog检查一次，连续两个周期读次数少于这个的vlog搬到冷存储目录
+      vlog_preallocate_size(64<<20),//当前vlog每次按这么多字节预分配磁盘空间，直到max_vlog_size，0代表不预分配
+      recycle_vlog_num(0),//最多留这么多个回收完的vlog文件给新vlog重用，保留已分配的磁盘空间，0代表直接删除
+      vlog_replay_threads(4),//打开数据库时用Env的kRecovery线程池里这么多个线程并行读取和校验要回放的vlog，大vlog切成几段读，插入memtable仍然按顺序
+      max_recovery_bytes(0),//大于0时重启点之后的vlog超过这么多字节就提前切换memtable刷到sst，限制打开数据库时的回放量，0代表只按write_buffer_size切换
+      max_open_vlogs(1000),//最多同时打开这么多个vlog读，第一次读到某个vlog时才打开，超过时关掉最久没读的
+      ptr_cache_size(0),//大于0时用这么多字节缓存热点key的最新指针，Get命中时不用查lsm，0代表不缓存
+      //下面三个是Env里刷imm、合并(level0和其它level各一个池)、gc线程池的大小。线程池属于Env，
+      //用同一个Env(比如Env::Default())的数据库共用，只会变大，取各个数据库设的最大值。
+      //一个数据库同时最多只有一个刷imm、一个合并、一个gc任务，多个数据库共用Env时才需要调大
+      background_flush_threads(1),
+      background_compaction_threads(1),
+      background_gc_threads(1){
  //     max_vlog_size(124*1024*1024){
  //     clean_threshold(0xffffffffffff){
 }